@@ -0,0 +1,187 @@
+#include "BatchRunner.h"
+
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include "TransferScheduler.h"
+
+namespace
+{
+    // Helper function to write a string as a JSON string literal
+    void write_json_string(std::ostream& o, const std::string& s)
+    {
+        o << '"';
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                o << '\\' << c;
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+                o << escaped;
+            }
+            else
+            {
+                o << c;
+            }
+        }
+        o << '"';
+    }
+}
+
+// Prints the summary as a single JSON line, e.g. {"commands":3,"succeeded":3,"failed":0,...}
+void BatchReport::print_json(std::ostream& o) const
+{
+    o << "{\"commands\":" << succeeded + failed
+      << ",\"succeeded\":" << succeeded
+      << ",\"failed\":" << failed
+      << ",\"bytes\":" << bytes
+      << ",\"seconds\":" << seconds
+      << ",\"errors\":[";
+
+    for (size_t i = 0; i < errors.size(); i++)
+    {
+        if (i > 0) o << ",";
+        o << "{\"line\":" << errors[i].line << ",\"message\":";
+        write_json_string(o, errors[i].message);
+        o << "}";
+    }
+    o << "]}\n";
+}
+
+// Constructor for BatchRunner
+BatchRunner::BatchRunner(FTPClient* ftp, FTPCommandInterpreter* ci) : ftp{ ftp }, ci{ ci }
+{
+    // A script owns its session, so its listings are cached unless it says otherwise with 'cache ttl'
+    if (!ftp->get_listing_cache().is_enabled())
+        ftp->get_listing_cache().set_ttl(ListingCache::BATCH_TTL_SECONDS);
+}
+
+// Parses the whole script up front, so a typo on the last line does not surface after an hour of transfers
+void BatchRunner::load(std::istream& script)
+{
+    std::string text;
+    for (int line = 1; std::getline(script, text); line++)
+    {
+        // Scripts written on Windows keep their CR
+        if (!text.empty() && text.back() == '\r')
+            text.pop_back();
+
+        size_t first = text.find_first_not_of(' ');
+        if (first == std::string::npos || text[first] == '#')
+            continue;
+
+        try
+        {
+            steps.push_back(BatchStep{ line, ci->prepare(text.c_str()) });
+        }
+        catch (const std::exception& e)
+        {
+            throw std::runtime_error("line " + std::to_string(line) + ": " + e.what());
+        }
+    }
+}
+
+// Checks whether a step is "<verb> <path>"
+bool BatchRunner::is_transfer(const BatchStep& step, const char* verb)
+{
+    return step.command.words.size() == 2 && step.command.words[0] == verb;
+}
+
+// Runs one get/put on the main session, counting its bytes
+void BatchRunner::run_single_transfer(const BatchStep& step, BatchReport& report)
+{
+    const char* path = step.command.words[1].c_str();
+    if (step.command.words[0] == "put")
+    {
+        ftp->prepare_data_port();
+        report.bytes += ftp->stor(path);
+        return;
+    }
+
+    if (ftp->get_segments() > 1)
+    {
+        report.bytes += ftp->retr_segmented(path);
+        return;
+    }
+    ftp->prepare_data_port();
+    report.bytes += ftp->retr(path);
+}
+
+// Runs the run of consecutive get (or put) steps starting at first, returns the index after it
+size_t BatchRunner::run_transfers(size_t first, BatchReport& report)
+{
+    const char* verb = steps[first].command.words[0] == "put" ? "put" : "get";
+    size_t end = first;
+    while (end < steps.size() && is_transfer(steps[end], verb))
+        end++;
+
+    // A lone transfer is not worth opening extra sessions for
+    if (end - first == 1)
+    {
+        try
+        {
+            run_single_transfer(steps[first], report);
+            report.succeeded++;
+        }
+        catch (const std::exception& e)
+        {
+            report.failed++;
+            report.errors.push_back(BatchReport::Error{ steps[first].line, e.what() });
+        }
+        return end;
+    }
+
+    std::vector<TransferJob> jobs;
+    for (size_t i = first; i < end; i++)
+        jobs.push_back(TransferJob{ steps[i].command.words[1], steps[i].command.words[0] == "put" });
+
+    TransferScheduler scheduler(ftp, ftp->get_pool_size());
+    TransferReport transfers = scheduler.run(jobs);
+
+    report.succeeded += transfers.succeeded;
+    report.failed += transfers.failed;
+    report.bytes += transfers.bytes;
+
+    // Job i is the step first + i
+    for (const auto& error : transfers.errors)
+        report.errors.push_back(BatchReport::Error{ steps[first + error.job].line, error.message });
+    return end;
+}
+
+// Runs every step in order; a failing step is recorded and the script goes on
+BatchReport BatchRunner::run()
+{
+    BatchReport report;
+    auto start = std::chrono::steady_clock::now();
+
+    // Each transfer opens the data connection of the next one while the control connection is idle
+    ftp->set_speculative(true);
+
+    for (size_t i = 0; i < steps.size(); )
+    {
+        if (is_transfer(steps[i], "get") || is_transfer(steps[i], "put"))
+        {
+            i = run_transfers(i, report);
+            continue;
+        }
+
+        try
+        {
+            ci->execute(steps[i].command);
+            report.succeeded++;
+        }
+        catch (const std::exception& e)
+        {
+            report.failed++;
+            report.errors.push_back(BatchReport::Error{ steps[i].line, e.what() });
+        }
+        i++;
+    }
+
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
@@ -0,0 +1,614 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include "bout.h"
+#include "EventLoop.h"
+#include "TreeWalker.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "Psapi.lib") // Link against process status library
+#else
+#include <fstream>
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    constexpr unsigned long long KB = 1024;
+    constexpr unsigned long long MB = 1024 * KB;
+    constexpr unsigned long long GB = 1024 * MB;
+
+    // Helper function to name a size the way the cases are named: 1KB, 64MB, 4GB
+    std::string size_label(unsigned long long size)
+    {
+        if (size >= GB && size % GB == 0) return std::to_string(size / GB) + "GB";
+        if (size >= MB && size % MB == 0) return std::to_string(size / MB) + "MB";
+        if (size >= KB && size % KB == 0) return std::to_string(size / KB) + "KB";
+        return std::to_string(size) + "B";
+    }
+
+    // Helper function to name a transfer case: retr_1MB on the plain engine, retr_1MB_uring on another one
+    std::string transfer_label(const char* operation, unsigned long long size, const char* engine)
+    {
+        std::string name = std::string(operation) + "_" + size_label(size);
+        return strcmp(engine, "plain") == 0 ? name : name + "_" + engine;
+    }
+
+    // Helper function to name an entry count: 10, 10k, 1M
+    std::string count_label(unsigned long long count)
+    {
+        if (count >= 1000000 && count % 1000000 == 0) return std::to_string(count / 1000000) + "M";
+        if (count >= 1000 && count % 1000 == 0) return std::to_string(count / 1000) + "k";
+        return std::to_string(count);
+    }
+
+    // Helper function to start measuring the peak resident set again; Linux resets it through clear_refs,
+    // elsewhere the peak of the whole run is kept
+    void reset_peak_rss()
+    {
+#ifdef __linux__
+        std::ofstream clear_refs("/proc/self/clear_refs");
+        clear_refs << "5";
+#endif
+    }
+
+    // Helper function to get the peak resident set of the process in bytes (0 when the system cannot tell)
+    unsigned long long peak_rss()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return counters.PeakWorkingSetSize;
+        return 0;
+#else
+#ifdef __linux__
+        // VmHWM follows clear_refs, ru_maxrss does not
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line))
+        {
+            if (line.compare(0, 6, "VmHWM:") == 0)
+                return std::stoull(line.substr(6)) * KB;
+        }
+#endif
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+#ifdef __APPLE__
+        return (unsigned long long)usage.ru_maxrss;
+#else
+        return (unsigned long long)usage.ru_maxrss * KB;
+#endif
+#endif
+    }
+
+    // Helper function to get the user + system CPU time the process has used so far, in seconds
+    double process_cpu_seconds()
+    {
+#ifdef _WIN32
+        FILETIME created, exited, kernel, user;
+        if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+            return 0;
+        ULARGE_INTEGER k, u;
+        k.LowPart = kernel.dwLowDateTime;
+        k.HighPart = kernel.dwHighDateTime;
+        u.LowPart = user.dwLowDateTime;
+        u.HighPart = user.dwHighDateTime;
+        return (k.QuadPart + u.QuadPart) / 1e7; // 100 ns units
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+    }
+
+    // Helper function to connect a data connection to the address of a PASV reply
+    void connect_pasv(TelNetClient& control, TCP& data)
+    {
+        const char* line_pfx = "227 Entering Passive Mode (";
+        if (control.send_command("PASV") != 227 || strncmp(control.get_reply_line(), line_pfx, strlen(line_pfx)) != 0)
+            throw std::runtime_error("Entering passive mode failed");
+
+        int a[6]{};
+        FTPClient::parse_pasv_addr(control.get_reply_line() + strlen(line_pfx), a);
+        bout ip_text;
+        data.connect(ip_text << a[0] << "." << a[1] << "." << a[2] << "." << a[3] << bfin, a[4] * 256 + a[5]);
+    }
+
+    // Helper function to get the nearest-rank percentile (0 < p <= 1) of sorted samples
+    double percentile(const std::vector<double>& sorted, double p)
+    {
+        if (sorted.empty())
+            return 0;
+        size_t rank = (size_t)std::ceil(p * sorted.size());
+        return sorted[rank == 0 ? 0 : rank - 1];
+    }
+}
+
+// Operations per second over the whole case
+double BenchmarkResult::ops_per_second() const
+{
+    return seconds > 0 ? iterations / seconds : 0;
+}
+
+// Payload throughput over the whole case
+double BenchmarkResult::mb_per_second() const
+{
+    return seconds > 0 ? bytes / seconds / 1e6 : 0;
+}
+
+// Constructor for Benchmark
+Benchmark::Benchmark(const char* host, int port, bool full) : host{ host }, port{ port }, full{ full } { }
+
+// Logs a new connection in the way every case does, without echoing the session
+void Benchmark::log_in(FTPClient& ftp) const
+{
+    ftp.set_quiet(true);
+    ftp.login("bench", "bench");
+    ftp.mode_binary();
+}
+
+// Registers a file written under vfs_root; a file already there is the user's and stops the run
+void Benchmark::claim_local_file(const std::string& path)
+{
+    if (std::find(local_files.begin(), local_files.end(), path) != local_files.end())
+        return;
+    if (std::filesystem::exists(std::filesystem::path("vfs_root") / path))
+        throw std::runtime_error(bout() << "vfs_root/" << path.c_str() << " already exists, move it away before running the benchmark" << bfin);
+    local_files.push_back(path);
+}
+
+// Removes the files the run wrote, then the directories holding them if nothing else is left there
+void Benchmark::remove_local_files()
+{
+    VirtualFS filesystem("vfs_root");
+    for (const std::string& path : local_files)
+        filesystem.remove(path);
+    local_files.clear();
+
+    std::error_code ec;
+    for (const char* directory : { "vfs_root/bench/data", "vfs_root/bench/upload", "vfs_root/bench" })
+        std::filesystem::remove(directory, ec);
+}
+
+// Compares a downloaded file with the bytes the LoopbackServer generates for it
+void Benchmark::check_download(FTPClient& ftp, const std::string& path, unsigned long long size) const
+{
+    VirtualFS::Reader reader = ftp.get_filesystem()->open_reader(path);
+    if (reader.get_size() != size)
+        throw std::runtime_error(bout() << path.c_str() << ": " << reader.get_size() << " of " << size << " bytes on disk" << bfin);
+
+    std::vector<char> buffer(64 * KB);
+    unsigned long long offset = 0;
+    size_t count;
+    while ((count = reader.read(buffer.data(), buffer.size())) > 0)
+    {
+        for (size_t i = 0; i < count; i++, offset++)
+        {
+            if ((unsigned char)buffer[i] != LoopbackServer::pattern_byte(offset))
+                throw std::runtime_error(bout() << path.c_str() << ": wrong byte at offset " << offset << bfin);
+        }
+    }
+}
+
+// Runs one case: times every iteration, then keeps the totals and the latency percentiles
+void Benchmark::measure(const std::string& name, int iterations, const std::function<unsigned long long()>& iteration)
+{
+    using Clock = std::chrono::steady_clock;
+
+    if (max_iterations > 0 && iterations > max_iterations)
+        iterations = max_iterations;
+
+    BenchmarkResult result;
+    result.name = name;
+    result.iterations = iterations;
+
+    std::vector<double> latencies_ms;
+    latencies_ms.reserve(iterations);
+
+    reset_peak_rss();
+    double cpu_started = process_cpu_seconds();
+    Clock::time_point started = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        Clock::time_point iteration_started = Clock::now();
+        result.bytes += iteration();
+        latencies_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - iteration_started).count());
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - started).count();
+    result.cpu_seconds = process_cpu_seconds() - cpu_started;
+    result.peak_rss = peak_rss();
+
+    std::sort(latencies_ms.begin(), latencies_ms.end());
+    result.p50_ms = percentile(latencies_ms, 0.50);
+    result.p99_ms = percentile(latencies_ms, 0.99);
+
+    results.push_back(result);
+}
+
+// Connect, greeting, USER/PASS and QUIT on a new control connection
+void Benchmark::bench_login(int iterations)
+{
+    measure("login", iterations, [this]()
+    {
+        FTPClient ftp(host.c_str(), port);
+        ftp.set_quiet(true);
+        ftp.login("bench", "bench");
+        ftp.logout();
+        return 0ULL;
+    });
+}
+
+// PASV + MLSD of a directory with the given number of entries, parsed into a DirectoryListing
+void Benchmark::bench_list(unsigned long long entries, int iterations)
+{
+    FTPClient ftp(host.c_str(), port);
+    log_in(ftp);
+    ftp.get_listing_cache().set_ttl(0);
+
+    std::string path = "bench/list/" + std::to_string(entries);
+    measure("list_" + count_label(entries), iterations, [&]()
+    {
+        ftp.list(path.c_str());
+        return 0ULL;
+    });
+
+    ftp.logout();
+}
+
+// Streamed MLSD of a large directory, stopped at the first entry: how soon a consumer can start
+void Benchmark::bench_list_first_entry(unsigned long long entries, int iterations)
+{
+    FTPClient ftp(host.c_str(), port);
+    log_in(ftp);
+
+    std::string path = "bench/list/" + std::to_string(entries);
+    measure("list_" + count_label(entries) + "_first_entry", iterations, [&]()
+    {
+        ftp.list_stream(path.c_str(), [](const ListingEntry&) { return false; });
+        return 0ULL;
+    });
+
+    ftp.logout();
+}
+
+// Repeated listing of an unchanged directory, answered by the listing cache after the first one
+void Benchmark::bench_list_cached(unsigned long long entries, int iterations)
+{
+    FTPClient ftp(host.c_str(), port);
+    log_in(ftp);
+    ftp.get_listing_cache().set_ttl(ListingCache::BATCH_TTL_SECONDS);
+
+    std::string path = "bench/list/" + std::to_string(entries);
+    ftp.list_cached(path.c_str());
+    measure("list_" + count_label(entries) + "_cached", iterations, [&]()
+    {
+        ftp.list_cached(path.c_str());
+        return 0ULL;
+    });
+
+    ftp.logout();
+}
+
+// Recursive listing of bench/tree/<F> by a TreeWalker with the given number of sessions, entries counted and dropped
+void Benchmark::bench_walk(unsigned long long fanout, int sessions, bool ordered, int iterations)
+{
+    FTPClient ftp(host.c_str(), port);
+    log_in(ftp);
+
+    unsigned long long directories = 1 + fanout + fanout * fanout + fanout * fanout * fanout;
+    std::string path = "bench/tree/" + std::to_string(fanout);
+    std::string name = "walk_" + count_label(directories) + "_x" + std::to_string(sessions);
+    measure(ordered ? name + "_ordered" : name, iterations, [&]()
+    {
+        TreeWalker walker(&ftp, sessions);
+        walker.set_ordered(ordered);
+        TreeWalkReport report = walker.walk(path.c_str(), [](const std::string&, const ListingEntry&) { return true; });
+        if (report.failed > 0 || report.directories != directories)
+            throw std::runtime_error(bout() << name.c_str() << ": " << report.directories << " of " << directories << " directories listed" << bfin);
+        return 0ULL;
+    });
+
+    ftp.logout();
+}
+
+// PASV + RETR of a generated file on the given data engine, written to disk through the VirtualFS like any download
+// (skipped when the engine is not available on this system)
+void Benchmark::bench_retr(unsigned long long size, const char* engine, int iterations)
+{
+    FTPClient ftp(host.c_str(), port);
+    ftp.set_engine(engine);
+    if (strcmp(ftp.get_engine_name(), engine) != 0)
+        return;
+    log_in(ftp);
+
+    std::string path = "bench/data/" + std::to_string(size);
+    claim_local_file(path);
+    measure(transfer_label("retr", size, engine), iterations, [&]()
+    {
+        ftp.prepare_data_port();
+        unsigned long long received = ftp.retr(path.c_str());
+        if (received != size)
+            throw std::runtime_error(bout() << path.c_str() << ": received " << received << " of " << size << " bytes" << bfin);
+        return received;
+    });
+    check_download(ftp, path, size);
+
+    ftp.logout();
+}
+
+// PASV + STOR of a local file of the given size (created once, before the timed iterations) on the given data engine
+// (skipped when the engine is not available on this system)
+void Benchmark::bench_stor(unsigned long long size, const char* engine, int iterations)
+{
+    FTPClient ftp(host.c_str(), port);
+    ftp.set_engine(engine);
+    if (strcmp(ftp.get_engine_name(), engine) != 0)
+        return;
+    log_in(ftp);
+
+    std::string path = "bench/upload/" + std::to_string(size);
+    claim_local_file(path);
+    {
+        std::vector<char> block(64 * KB);
+        for (size_t i = 0; i < block.size(); i++)
+            block[i] = (char)LoopbackServer::pattern_byte(i);
+
+        VirtualFS::Writer writer = ftp.get_filesystem()->open_writer(path);
+        for (unsigned long long written = 0; written < size; )
+        {
+            size_t chunk = (size_t)std::min<unsigned long long>(block.size(), size - written);
+            writer.write(block.data(), chunk);
+            written += chunk;
+        }
+        writer.close();
+    }
+
+    measure(transfer_label("stor", size, engine), iterations, [&]()
+    {
+        ftp.prepare_data_port();
+        return ftp.stor(path.c_str());
+    });
+
+    ftp.logout();
+}
+
+// One SIZE round trip after the other, the way a client without pipelining probes files
+void Benchmark::bench_size_serial(int files, int iterations)
+{
+    FTPClient ftp(host.c_str(), port);
+    log_in(ftp);
+
+    measure("size_" + count_label(files) + "_serial", iterations, [&]()
+    {
+        for (int i = 0; i < files; i++)
+            ftp.size(("bench/data/" + std::to_string(i + 1)).c_str());
+        return 0ULL;
+    });
+
+    ftp.logout();
+}
+
+// SIZE and MDTM of the same files, pipelined by stat_many
+void Benchmark::bench_stat_pipelined(int files, int iterations)
+{
+    FTPClient ftp(host.c_str(), port);
+    log_in(ftp);
+
+    std::vector<std::string> paths;
+    for (int i = 0; i < files; i++)
+        paths.push_back("bench/data/" + std::to_string(i + 1));
+
+    measure("stat_" + count_label(files) + "_pipelined", iterations, [&]()
+    {
+        ftp.stat_many(paths);
+        return 0ULL;
+    });
+
+    ftp.logout();
+}
+
+// RETR split over parallel sessions (REST + RETR per range)
+void Benchmark::bench_retr_segmented(unsigned long long size, int segments, int iterations)
+{
+    FTPClient ftp(host.c_str(), port);
+    log_in(ftp);
+    ftp.set_segments(segments);
+
+    std::string path = "bench/data/" + std::to_string(size);
+    claim_local_file(path);
+    measure("retr_" + size_label(size) + "_seg" + std::to_string(segments), iterations, [&]()
+    {
+        return ftp.retr_segmented(path.c_str());
+    });
+    check_download(ftp, path, size);
+
+    ftp.logout();
+}
+
+// RETR with the data connection of each transfer opened during the previous one
+void Benchmark::bench_retr_speculative(unsigned long long size, int iterations)
+{
+    FTPClient ftp(host.c_str(), port);
+    log_in(ftp);
+    ftp.set_speculative(true);
+
+    std::string path = "bench/data/" + std::to_string(size);
+    claim_local_file(path);
+    measure("retr_" + size_label(size) + "_speculative", iterations, [&]()
+    {
+        ftp.prepare_data_port();
+        return ftp.retr(path.c_str());
+    });
+    check_download(ftp, path, size);
+
+    ftp.logout();
+}
+
+// STOR of a buffer written through an EventLoop, which has to wait for writability after every partial write, then a
+// receive on a silent data connection that must end at its deadline; throws when either misbehaves (Linux only)
+void Benchmark::bench_event_loop(unsigned long long size, int iterations)
+{
+#ifdef __linux__
+    using Clock = EventLoop::Clock;
+    constexpr int DEADLINE_MS = 50;
+
+    TelNetClient control(host.c_str(), port);
+    if (control.send_command("USER bench") != 331 || control.send_command("PASS bench") != 230 || control.send_command("TYPE I") != 200)
+        throw std::runtime_error("event loop: login failed");
+
+    std::vector<char> block((size_t)size);
+    for (size_t i = 0; i < block.size(); i++)
+        block[i] = (char)LoopbackServer::pattern_byte(i);
+
+    EventLoop loop;
+    measure("event_loop_stor_" + size_label(size), iterations, [&]()
+    {
+        TCP data;
+        connect_pasv(control, data);
+        if (control.send_command("STOR bench/upload/event_loop") != 150)
+            throw std::runtime_error("event loop: STOR refused");
+
+        TCPResult sent = TCPResult::fail(0);
+        loop.async_send(data, block.data(), block.size(), Clock::now() + std::chrono::seconds(30), [&](TCPResult result) { sent = result; });
+        loop.run();
+        if (!sent.ok || (unsigned long long)sent.bytes_count != size)
+            throw std::runtime_error(bout() << "event loop: sent " << sent.bytes_count << " of " << size << " bytes" << bfin);
+
+        data.close();
+        if (control.recv_response() != 226)
+            throw std::runtime_error("event loop: upload not confirmed");
+        return size;
+    });
+
+    // Nothing is ever sent on a data connection without a transfer command
+    TCP silent;
+    connect_pasv(control, silent);
+    char byte;
+    TCPResult received = TCPResult::success(0);
+    Clock::time_point started = Clock::now();
+    loop.async_recv(silent, &byte, 1, started + std::chrono::milliseconds(DEADLINE_MS), [&](TCPResult result) { received = result; });
+    loop.run();
+    long long waited_ms = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - started).count();
+    if (!received.is_timed_out() || waited_ms < DEADLINE_MS || waited_ms > 20 * DEADLINE_MS)
+        throw std::runtime_error(bout() << "event loop: silent receive ended after " << waited_ms << " ms without timing out at " << DEADLINE_MS << " ms" << bfin);
+    silent.close();
+
+    control.send_command("QUIT");
+#endif
+}
+
+// Runs every case in a fixed order, then removes the local files it wrote
+void Benchmark::run()
+{
+    results.clear();
+
+    // The local files go away even when a case fails
+    try
+    {
+        bench_login(100);
+
+        bench_list(10, 200);
+        bench_list(10000, 20);
+        bench_list_first_entry(10000, 20);
+        bench_list_cached(10000, 1000);
+        bench_walk(8, 1, false, 3);
+        bench_walk(8, 8, false, 3);
+        bench_walk(8, 8, true, 3);
+        if (full)
+        {
+            bench_list(1000000, 2);
+            bench_list_first_entry(1000000, 2);
+        }
+
+        // Every transfer size on both data engines
+        for (const char* engine : { "plain", "uring" })
+        {
+            bench_retr(1 * KB, engine, 200);
+            bench_retr(1 * MB, engine, 50);
+            bench_retr(64 * MB, engine, 5);
+            bench_retr(1 * GB, engine, full ? 2 : 1);
+            if (full)
+                bench_retr(4 * GB, engine, 1);
+
+            bench_stor(1 * KB, engine, 200);
+            bench_stor(1 * MB, engine, 50);
+            bench_stor(64 * MB, engine, 5);
+            bench_stor(1 * GB, engine, full ? 2 : 1);
+            if (full)
+                bench_stor(4 * GB, engine, 1);
+        }
+
+        // Uploads through a user space buffer, what the sendfile/TransmitFile path of stor_* saves
+        bench_stor(1 * MB, "copy", 50);
+        bench_stor(64 * MB, "copy", 5);
+        bench_stor(1 * GB, "copy", full ? 2 : 1);
+
+        // The same work with and without the latency features, their difference grows with the round trip
+        bench_size_serial(100, 5);
+        bench_stat_pipelined(100, 5);
+        bench_stat_pipelined(1000, 5);
+        bench_retr_segmented(64 * MB, 4, 5);
+        bench_retr_speculative(1 * MB, 50);
+
+        // One thread driving a data connection with partial writes and deadlines (Linux)
+        bench_event_loop(64 * MB, 5);
+    }
+    catch (const std::exception&)
+    {
+        remove_local_files();
+        throw;
+    }
+    remove_local_files();
+}
+
+// Prints one aligned line per case
+void Benchmark::print(std::ostream& o) const
+{
+    char line[160];
+    snprintf(line, sizeof(line), "%-22s %6s %12s %10s %10s %10s %10s %10s\n", "case", "iter", "ops/s", "MB/s", "p50 ms", "p99 ms", "peak MB", "cpu s");
+    o << line;
+    for (const BenchmarkResult& result : results)
+    {
+        char throughput[32] = "-";
+        if (result.bytes > 0)
+            snprintf(throughput, sizeof(throughput), "%.1f", result.mb_per_second());
+
+        snprintf(line, sizeof(line), "%-22s %6d %12.1f %10s %10.3f %10.3f %10.1f %10.3f\n", result.name.c_str(), result.iterations,
+            result.ops_per_second(), throughput, result.p50_ms, result.p99_ms, result.peak_rss / 1e6, result.cpu_seconds);
+        o << line;
+    }
+}
+
+// Writes the results as JSON, mb_per_sec only for cases that move a payload
+void Benchmark::write_json(std::ostream& o) const
+{
+    o << "{\"link\":{\"delay_ms\":" << link.delay_ms << ",\"jitter_ms\":" << link.jitter_ms << ",\"bandwidth\":" << link.bandwidth << "},\n";
+    o << "\"benchmarks\":[\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult& result = results[i];
+        o << "{\"name\":\"" << result.name << "\""
+          << ",\"iterations\":" << result.iterations
+          << ",\"bytes\":" << result.bytes
+          << ",\"seconds\":" << result.seconds
+          << ",\"ops_per_sec\":" << result.ops_per_second();
+        if (result.bytes > 0)
+            o << ",\"mb_per_sec\":" << result.mb_per_second();
+        o << ",\"p50_ms\":" << result.p50_ms
+          << ",\"p99_ms\":" << result.p99_ms
+          << ",\"peak_rss_mb\":" << result.peak_rss / 1e6
+          << ",\"cpu_seconds\":" << result.cpu_seconds
+          << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    o << "]}\n";
+}
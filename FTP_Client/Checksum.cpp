@@ -0,0 +1,509 @@
+#include "Checksum.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CRC32C_HARDWARE 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE42
+#else
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+
+namespace
+{
+    // Helper struct holding the tables of one reflected CRC-32 polynomial: table[k][b] is the CRC of byte b followed
+    // by k zero bytes (slicing-by-8), powers[k] is x^(2^k) modulo the polynomial (moving a CRC past runs of zeros)
+    struct CrcTables
+    {
+        uint32_t polynomial;
+        uint32_t table[8][256];
+        uint32_t powers[32];
+
+        explicit CrcTables(uint32_t polynomial) : polynomial{ polynomial }
+        {
+            for (uint32_t b = 0; b < 256; b++)
+            {
+                uint32_t crc = b;
+                for (int bit = 0; bit < 8; bit++)
+                    crc = (crc >> 1) ^ (polynomial & (0 - (crc & 1)));
+                table[0][b] = crc;
+            }
+            for (int k = 1; k < 8; k++)
+            {
+                for (int b = 0; b < 256; b++)
+                    table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+            }
+
+            powers[0] = 1u << 30;  // x^1, bit 31 is x^0 in the reflected order
+            for (int k = 1; k < 32; k++)
+                powers[k] = multiply(powers[k - 1], powers[k - 1]);
+        }
+
+        // a * b modulo the polynomial; a must not be zero
+        uint32_t multiply(uint32_t a, uint32_t b) const
+        {
+            uint32_t m = 1u << 31, product = 0;
+            while (true)
+            {
+                if (a & m)
+                {
+                    product ^= b;
+                    if ((a & (m - 1)) == 0)
+                        break;
+                }
+                m >>= 1;
+                b = b & 1 ? (b >> 1) ^ polynomial : b >> 1;
+            }
+            return product;
+        }
+
+        // x^(8 * length) modulo the polynomial: what a CRC register is multiplied by when length zero bytes go through it
+        uint32_t zeros(unsigned long long length) const
+        {
+            uint32_t power = 1u << 31;
+            for (int k = 3; length != 0; length >>= 1, k++)
+            {
+                if (length & 1)
+                    power = multiply(powers[k & 31], power);
+            }
+            return power;
+        }
+
+        // CRC register after size more bytes, from a register holding crc
+        uint32_t update(uint32_t crc, const unsigned char* it, size_t size) const
+        {
+            // Eight bytes per step, the little-endian load folds the first four into the running CRC
+            while (size >= 8)
+            {
+                uint32_t low, high;
+                memcpy(&low, it, 4);
+                memcpy(&high, it + 4, 4);
+                low ^= crc;
+                crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24]
+                    ^ table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+                it += 8;
+                size -= 8;
+            }
+            while (size-- > 0)
+                crc = (crc >> 8) ^ table[0][(crc ^ *it++) & 0xFF];
+            return crc;
+        }
+
+        // CRC of the first stream followed by the second (both finished values) from the length of the second
+        uint32_t combine(uint32_t first, uint32_t second, unsigned long long length) const
+        {
+            return multiply(zeros(length), first) ^ second;
+        }
+    };
+
+    const CrcTables& crc32_tables()
+    {
+        static const CrcTables tables(0xEDB88320);
+        return tables;
+    }
+
+    const CrcTables& crc32c_tables()
+    {
+        static const CrcTables tables(0x82F63B78);
+        return tables;
+    }
+
+    // Helper function to format a 32-bit value as 8 upper case hex digits
+    std::string hex32(uint32_t value)
+    {
+        char text[9];
+        snprintf(text, sizeof(text), "%08X", (unsigned)value);
+        return text;
+    }
+
+    // Helper function to format bytes as upper case hex
+    std::string hex_bytes(const unsigned char* bytes, size_t size)
+    {
+        static const char DIGITS[] = "0123456789ABCDEF";
+        std::string text(size * 2, '0');
+        for (size_t i = 0; i < size; i++)
+        {
+            text[2 * i] = DIGITS[bytes[i] >> 4];
+            text[2 * i + 1] = DIGITS[bytes[i] & 0x0F];
+        }
+        return text;
+    }
+
+    // Helper function to feed 64-byte blocks to compress, keeping a partial block in block/buffered
+    template <typename Compress>
+    void feed_blocks(unsigned char* block, size_t& buffered, const char* data, size_t size, Compress compress)
+    {
+        const unsigned char* it = (const unsigned char*)data;
+        if (buffered > 0)
+        {
+            size_t take = 64 - buffered < size ? 64 - buffered : size;
+            memcpy(block + buffered, it, take);
+            buffered += take;
+            it += take;
+            size -= take;
+            if (buffered < 64)
+                return;
+            compress(block);
+            buffered = 0;
+        }
+        for (; size >= 64; it += 64, size -= 64)
+            compress(it);
+        memcpy(block, it, size);
+        buffered = size;
+    }
+
+    // Helper function to append the 0x80 byte, zeros and the bit length that end an MD5 or SHA-256 stream
+    template <typename Compress>
+    void finish_blocks(unsigned char* block, size_t buffered, unsigned long long length, bool big_endian, Compress compress)
+    {
+        block[buffered++] = 0x80;
+        if (buffered > 56)
+        {
+            memset(block + buffered, 0, 64 - buffered);
+            compress(block);
+            buffered = 0;
+        }
+        memset(block + buffered, 0, 56 - buffered);
+
+        unsigned long long bits = length * 8;
+        for (int i = 0; i < 8; i++)
+            block[big_endian ? 63 - i : 56 + i] = (unsigned char)(bits >> (8 * i));
+        compress(block);
+    }
+
+    uint32_t rotate_left(uint32_t value, int bits) { return (value << bits) | (value >> (32 - bits)); }
+    uint32_t rotate_right(uint32_t value, int bits) { return (value >> bits) | (value << (32 - bits)); }
+
+#ifdef CRC32C_HARDWARE
+    // Helper struct holding the operators that move a CRC-32C register past one stripe of zeros, a byte at a time:
+    // shifting is linear, so shift[k][b] is the register b << 8k after the stripe, and a register is the XOR of its bytes'
+    struct Crc32cShift
+    {
+        uint32_t shift[4][256];
+
+        explicit Crc32cShift(size_t stripe)
+        {
+            const CrcTables& tables = crc32c_tables();
+            uint32_t power = tables.zeros(stripe);
+            for (int k = 0; k < 4; k++)
+            {
+                for (uint32_t b = 0; b < 256; b++)
+                    shift[k][b] = tables.multiply(power, b << (8 * k));
+            }
+        }
+
+        uint32_t apply(uint32_t crc) const
+        {
+            return shift[0][crc & 0xFF] ^ shift[1][(crc >> 8) & 0xFF] ^ shift[2][(crc >> 16) & 0xFF] ^ shift[3][crc >> 24];
+        }
+    };
+
+    // Stripe lengths of the interleaved loops: long ones for the bulk of a buffer, short ones for the rest
+    constexpr size_t LONG_STRIPE = 8192;
+    constexpr size_t SHORT_STRIPE = 256;
+
+    const Crc32cShift& long_shift()
+    {
+        static const Crc32cShift shift(LONG_STRIPE);
+        return shift;
+    }
+
+    const Crc32cShift& short_shift()
+    {
+        static const Crc32cShift shift(SHORT_STRIPE);
+        return shift;
+    }
+
+    bool detect_sse42()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+#else
+        return __builtin_cpu_supports("sse4.2");
+#endif
+    }
+
+    uint64_t load64(const unsigned char* it)
+    {
+        uint64_t value;
+        memcpy(&value, it, 8);
+        return value;
+    }
+
+    // Helper function running the crc32 instruction over three adjacent stripes at once (its latency is three
+    // times its throughput), the stripes' registers merged by shifting them past the stripes that follow
+    TARGET_SSE42 uint32_t crc32c_stripes(uint32_t crc, const unsigned char*& it, size_t& size, size_t stripe, const Crc32cShift& shift)
+    {
+        while (size >= 3 * stripe)
+        {
+            uint64_t first = crc, second = 0, third = 0;
+            for (const unsigned char* end = it + stripe; it < end; it += 8)
+            {
+                first = _mm_crc32_u64(first, load64(it));
+                second = _mm_crc32_u64(second, load64(it + stripe));
+                third = _mm_crc32_u64(third, load64(it + 2 * stripe));
+            }
+            crc = shift.apply(shift.apply((uint32_t)first) ^ (uint32_t)second) ^ (uint32_t)third;
+            it += 2 * stripe;
+            size -= 3 * stripe;
+        }
+        return crc;
+    }
+
+    // Helper function to update a CRC-32C register with the crc32 instruction
+    TARGET_SSE42 uint32_t crc32c_hardware(uint32_t crc, const unsigned char* it, size_t size)
+    {
+        crc = crc32c_stripes(crc, it, size, LONG_STRIPE, long_shift());
+        crc = crc32c_stripes(crc, it, size, SHORT_STRIPE, short_shift());
+
+        uint64_t wide = crc;
+        for (; size >= 8; it += 8, size -= 8)
+            wide = _mm_crc32_u64(wide, load64(it));
+        crc = (uint32_t)wide;
+        while (size-- > 0)
+            crc = _mm_crc32_u8(crc, *it++);
+        return crc;
+    }
+#endif
+}
+
+// Name as the HASH command spells it
+const char* hash_name(HashAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case HashAlgorithm::CRC32: return "CRC32";
+    case HashAlgorithm::CRC32C: return "CRC32C";
+    case HashAlgorithm::MD5: return "MD5";
+    case HashAlgorithm::SHA256: return "SHA-256";
+    default: return "off";
+    }
+}
+
+// Parses the name of an algorithm, ignoring case and dashes
+bool parse_hash_algorithm(const char* name, HashAlgorithm& algorithm)
+{
+    std::string key;
+    for (const char* it = name; *it != '\0'; it++)
+    {
+        if (*it != '-')
+            key += (char)tolower((unsigned char)*it);
+    }
+
+    if (key == "off" || key == "none") algorithm = HashAlgorithm::NONE;
+    else if (key == "crc32") algorithm = HashAlgorithm::CRC32;
+    else if (key == "crc32c") algorithm = HashAlgorithm::CRC32C;
+    else if (key == "md5") algorithm = HashAlgorithm::MD5;
+    else if (key == "sha256") algorithm = HashAlgorithm::SHA256;
+    else return false;
+    return true;
+}
+
+// Creates an empty digest of the algorithm
+std::unique_ptr<Digest> Digest::create(HashAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case HashAlgorithm::CRC32: return std::unique_ptr<Digest>(new Crc32());
+    case HashAlgorithm::CRC32C: return std::unique_ptr<Digest>(new Crc32c());
+    case HashAlgorithm::MD5: return std::unique_ptr<Digest>(new Md5());
+    case HashAlgorithm::SHA256: return std::unique_ptr<Digest>(new Sha256());
+    default: return nullptr;
+    }
+}
+
+// Hashes cannot be extended without the data
+void Digest::append(const Digest&, unsigned long long)
+{
+    throw std::logic_error(std::string(hash_name(get_algorithm())) + " digests cannot be combined");
+}
+
+// Adds the next bytes to the CRC
+void Crc32::update(const char* data, size_t size)
+{
+    state = crc32_tables().update(state, (const unsigned char*)data, size);
+}
+
+// Upper case hex of the CRC
+std::string Crc32::hex() const { return hex32(value()); }
+
+// Extends the CRC with the CRC of the bytes that follow
+void Crc32::append(const Digest& following, unsigned long long length)
+{
+    if (following.get_algorithm() != HashAlgorithm::CRC32)
+        Digest::append(following, length);
+    state = crc32_tables().combine(value(), static_cast<const Crc32&>(following).value(), length) ^ 0xFFFFFFFF;
+}
+
+// Checks once for SSE 4.2
+bool Crc32c::has_hardware()
+{
+#ifdef CRC32C_HARDWARE
+    static const bool available = detect_sse42();
+    return available;
+#else
+    return false;
+#endif
+}
+
+// Adds the next bytes to the CRC
+void Crc32c::update(const char* data, size_t size)
+{
+#ifdef CRC32C_HARDWARE
+    if (has_hardware())
+    {
+        state = crc32c_hardware(state, (const unsigned char*)data, size);
+        return;
+    }
+#endif
+    state = crc32c_tables().update(state, (const unsigned char*)data, size);
+}
+
+// Upper case hex of the CRC
+std::string Crc32c::hex() const { return hex32(value()); }
+
+// Extends the CRC with the CRC of the bytes that follow
+void Crc32c::append(const Digest& following, unsigned long long length)
+{
+    if (following.get_algorithm() != HashAlgorithm::CRC32C)
+        Digest::append(following, length);
+    state = crc32c_tables().combine(value(), static_cast<const Crc32c&>(following).value(), length) ^ 0xFFFFFFFF;
+}
+
+// Runs the 64 MD5 steps over one block
+void Md5::compress(const unsigned char* data)
+{
+    static const uint32_t K[64] = {
+        0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+        0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+        0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+        0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+        0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+        0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+        0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+        0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391 };
+    static const int SHIFTS[4][4] = { { 7, 12, 17, 22 }, { 5, 9, 14, 20 }, { 4, 11, 16, 23 }, { 6, 10, 15, 21 } };
+
+    uint32_t w[16];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)data[4 * i] | (uint32_t)data[4 * i + 1] << 8 | (uint32_t)data[4 * i + 2] << 16 | (uint32_t)data[4 * i + 3] << 24;
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t f;
+        int g;
+        switch (i / 16)
+        {
+        case 0: f = (b & c) | (~b & d); g = i; break;
+        case 1: f = (d & b) | (~d & c); g = (5 * i + 1) % 16; break;
+        case 2: f = b ^ c ^ d; g = (3 * i + 5) % 16; break;
+        default: f = c ^ (b | ~d); g = (7 * i) % 16; break;
+        }
+        f += a + K[i] + w[g];
+        a = d;
+        d = c;
+        c = b;
+        b += rotate_left(f, SHIFTS[i / 16][i % 4]);
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+// Adds the next bytes to the hash
+void Md5::update(const char* data, size_t size)
+{
+    length += size;
+    feed_blocks(block, buffered, data, size, [this](const unsigned char* it) { compress(it); });
+}
+
+// Pads a copy of the state and formats the digest (little-endian words)
+std::string Md5::hex() const
+{
+    Md5 copy = *this;
+    finish_blocks(copy.block, copy.buffered, copy.length, false, [&copy](const unsigned char* it) { copy.compress(it); });
+
+    unsigned char digest[16];
+    for (int i = 0; i < 16; i++)
+        digest[i] = (unsigned char)(copy.state[i / 4] >> (8 * (i % 4)));
+    return hex_bytes(digest, sizeof(digest));
+}
+
+// Runs the 64 SHA-256 rounds over one block
+void Sha256::compress(const unsigned char* data)
+{
+    static const uint32_t K[64] = {
+        0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+        0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+        0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+        0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+        0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+        0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+        0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+        0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2 };
+
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)data[4 * i] << 24 | (uint32_t)data[4 * i + 1] << 16 | (uint32_t)data[4 * i + 2] << 8 | (uint32_t)data[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = rotate_right(w[i - 15], 7) ^ rotate_right(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotate_right(w[i - 2], 17) ^ rotate_right(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+// Adds the next bytes to the hash
+void Sha256::update(const char* data, size_t size)
+{
+    length += size;
+    feed_blocks(block, buffered, data, size, [this](const unsigned char* it) { compress(it); });
+}
+
+// Pads a copy of the state and formats the digest (big-endian words)
+std::string Sha256::hex() const
+{
+    Sha256 copy = *this;
+    finish_blocks(copy.block, copy.buffered, copy.length, true, [&copy](const unsigned char* it) { copy.compress(it); });
+
+    unsigned char digest[32];
+    for (int i = 0; i < 32; i++)
+        digest[i] = (unsigned char)(copy.state[i / 4] >> (24 - 8 * (i % 4)));
+    return hex_bytes(digest, sizeof(digest));
+}
@@ -1,25 +1,30 @@
 #include "CommandInterpreter.h"
 
-#include <exception>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
 #include "bout.h"
 #include "utils.h"
 
 // Maximum length for a command
 static constexpr int CMD_MAX_LENGTH = 256;
 
+// Maximum number of words in a command
+static constexpr int MAX_WORDS = 32;
+
 // Constructor for Parameter - initializes a string parameter
 Parameter::Parameter(const char* name, const char* value_str)
     : name{ name }, type{ ParameterType::STRING }, value_str{ value_str }, value_int{ 0 } {}
 
 // Constructor for Parameter - initializes an integer parameter
 Parameter::Parameter(const char* name, int value_int)
-    : name{ name }, type{ ParameterType::STRING }, value_str{ nullptr }, value_int{ value_int } {}
+    : name{ name }, type{ ParameterType::INTEGER }, value_str{ nullptr }, value_int{ value_int } {}
 
 // Validates if the parameter is of the requested type, throws exception if not
 void Parameter::validate_requested_type(ParameterType type) const
 {
     if (this->type != type)
-        throw std::exception(bout() << "Invalid parameter type for '" << this->name << "'" << bfin);
+        throw std::runtime_error(bout() << "Invalid parameter type for '" << this->name << "'" << bfin);
 }
 
 // Returns the string value of the parameter if it's a string type
@@ -43,9 +48,25 @@ Param::Param(int id, const char* name, ParameterType type)
 // Private structure to manage the commands and parsing logic
 struct CommandInterpreter::_privates_
 {
-    // List of commands
+    static constexpr int MAX_PARAMS = 10;
+
+    // Trie node: literal tokens are looked up by value, parameter tokens by type
+    struct Node
+    {
+        std::unordered_map<std::string_view, int> literals;     // literal -> child node
+        std::vector<std::pair<ParameterType, int>> params;      // parameter type -> child node, in registration order
+        int command = -1;                                       // command whose tokens end here
+    };
+
+    // List of commands, in registration order
     std::vector<Command> commands;
 
+    // Prefix trie over the command tokens, nodes[0] is the root
+    std::vector<Node> nodes = std::vector<Node>(1);
+
+    // Match by scanning the commands instead of walking the trie
+    bool linear = false;
+
     // Validates a path, checks for invalid characters and too long paths
     static void validate_path(const char* word)
     {
@@ -58,79 +79,161 @@ struct CommandInterpreter::_privates_
             if (*w == '/')
             {
                 if (dirname_len == 0 && folders_count != 0)
-                    throw std::exception("Invalid path name: duplicate / separators aren't allowed");
+                    throw std::runtime_error("Invalid path name: duplicate / separators aren't allowed");
                 folders_count++;
                 dirname_len = 0;
             }
             else dirname_len++;
         }
         if (*w)
-            throw std::exception("Path too long");
+            throw std::runtime_error("Path too long");
     }
 
-    // Tries to match a token with a word, and converts it into the correct parameter type
-    static bool try_match_token(const Token& tk, const char* word, /* ref */ Parameter*& param)
+    // Checks whether a word can fill a parameter of the given type
+    static bool accepts(ParameterType type, std::string_view word)
     {
-        if (tk.literal != nullptr)
-        {
-            // Match literal token
-            return strncmp(tk.literal, word, CMD_MAX_LENGTH) == 0;
-        }
+        if (type != ParameterType::INTEGER)
+            return true;
 
-        // Handle different parameter types (STRING, INTEGER, PATH)
-        if (tk.param_type == ParameterType::STRING)
+        for (char c : word)
         {
-            *(param++) = Parameter{ tk.param_name, word };
-            return true;
+            if (c < '0' || '9' < c)
+                return false;
         }
+        return true;
+    }
 
+    // Converts a word into the parameter described by the token
+    static Parameter to_parameter(const Token& tk, const char* word)
+    {
         if (tk.param_type == ParameterType::INTEGER)
-        {
-            *(param++) = Parameter{ tk.param_name, Utils::my_atoi(word) };
-            return true;
-        }
+            return Parameter{ tk.param_name, Utils::my_atoi(word) };
 
         if (tk.param_type == ParameterType::PATH)
-        {
             validate_path(word);
-            *(param++) = Parameter{ tk.param_name, word };
-            return true;
-        }
 
-        return false;
+        return Parameter{ tk.param_name, word };
     }
 
-    // Tries to parse a command from a list of words and assign the parameters
-    bool try_parse_command(const Command& cmd, const std::vector<char*>& words, /* out */ Parameter* pms)
+    // Adds the tokens of a command to the trie; the first command registered with a given token sequence wins
+    void insert(const Command& cmd, int index)
     {
-        int i = 0;
-        Parameter* iter_pms = pms;
+        int params_count = 0;
+        int node = 0;
         for (const auto& tk : cmd.tokens)
         {
-            if (i == words.size())
-                return false;
-            if (!try_match_token(tk, words[i++], iter_pms))
-                return false;
+            int next = -1;
+            if (tk.literal != nullptr)
+            {
+                auto it = nodes[node].literals.find(tk.literal);
+                if (it != nodes[node].literals.end())
+                    next = it->second;
+            }
+            else
+            {
+                if (++params_count > MAX_PARAMS)
+                    throw std::runtime_error("Too many parameters for one command");
+
+                for (const auto& [type, child] : nodes[node].params)
+                {
+                    if (type == tk.param_type)
+                        next = child;
+                }
+            }
+
+            if (next < 0)
+            {
+                next = (int)nodes.size();
+                if (tk.literal != nullptr)
+                    nodes[node].literals.emplace(tk.literal, next);
+                else
+                    nodes[node].params.emplace_back(tk.param_type, next);
+                nodes.emplace_back();
+            }
+            node = next;
         }
-        if (i < words.size())
-            return false;
 
-        return true;
+        if (nodes[node].command < 0)
+            nodes[node].command = index;
+    }
+
+    // Walks the trie along the words; literals are tried before parameters, with backtracking
+    int match(int node, const std::string_view* words, int count) const
+    {
+        if (count == 0)
+            return nodes[node].command;
+
+        auto it = nodes[node].literals.find(words[0]);
+        if (it != nodes[node].literals.end())
+        {
+            int found = match(it->second, words + 1, count - 1);
+            if (found >= 0) return found;
+        }
+
+        for (const auto& [type, child] : nodes[node].params)
+        {
+            if (!accepts(type, words[0])) continue;
+            int found = match(child, words + 1, count - 1);
+            if (found >= 0) return found;
+        }
+        return -1;
     }
 
-    // Tries to execute a command based on the list of words
-    bool try_execute(const std::vector<char*>& words)
+    // Scans the commands in registration order for the first one whose tokens accept the words
+    int match_linear(const std::string_view* words, int count) const
     {
-        Parameter pms[10];
-        for (const auto& cmd : commands)
+        for (int index = 0; index < (int)commands.size(); index++)
         {
-            if (try_parse_command(cmd, words, pms))
+            const std::vector<Token>& tokens = commands[index].tokens;
+            if ((int)tokens.size() != count)
+                continue;
+
+            int i = 0;
+            for (; i < count; i++)
             {
-                cmd.action(pms); // Execute the command if parsed successfully
-                return true;
+                if (tokens[i].literal != nullptr ? words[i] != tokens[i].literal : !accepts(tokens[i].param_type, words[i]))
+                    break;
             }
+            if (i == count)
+                return index;
         }
-        return false;
+        return -1;
+    }
+
+    // Finds the command the words select, -1 if none
+    int find(const std::string_view* words, int count) const
+    {
+        return linear ? match_linear(words, count) : match(0, words, count);
+    }
+
+    // Converts the parameter words of a matched command, in token order
+    static void bind_parameters(const Command& cmd, const std::string_view* words, int count, /* out */ Parameter* pms)
+    {
+        Parameter* iter_pms = pms;
+        for (int i = 0; i < count; i++)
+        {
+            if (cmd.tokens[i].literal == nullptr)
+                *(iter_pms++) = to_parameter(cmd.tokens[i], words[i].data());
+        }
+    }
+
+    // Runs the command at index with the given words ('\0'-terminated views)
+    void run(int index, const std::string_view* words, int count)
+    {
+        Parameter pms[MAX_PARAMS];
+        bind_parameters(commands[index], words, count, pms);
+        commands[index].action(pms); // Execute the matched command
+    }
+
+    // Tries to execute a command based on the list of words ('\0'-terminated views)
+    bool try_execute(const std::string_view* words, int count)
+    {
+        int index = find(words, count);
+        if (index < 0)
+            return false;
+
+        run(index, words, count);
+        return true;
     }
 
 };
@@ -141,8 +244,18 @@ CommandInterpreter::CommandInterpreter()
     privates = new _privates_();
 }
 
-// Adds a command to the command list
-void CommandInterpreter::add_command(const Command& cmd) { privates->commands.push_back(cmd); }
+// Adds a command to the command list and to the dispatch trie
+void CommandInterpreter::add_command(const Command& cmd)
+{
+    privates->insert(cmd, (int)privates->commands.size());
+    privates->commands.push_back(cmd);
+}
+
+// Selects the registration-order scan (true) or the trie (false) for matching commands
+void CommandInterpreter::set_linear_dispatch(bool linear)
+{
+    privates->linear = linear;
+}
 
 // Prints all the commands with their token definitions
 void CommandInterpreter::print_commands(std::ostream& o)
@@ -173,66 +286,107 @@ namespace
         if (c == ' ') return true;
         if (c == '/') return true;
         if (c == '.') return true;
+        if (c == '-') return true;  // "reverse-mirror", names such as "my-file.txt"
+        if (c == '*' || c == '?') return true;  // wildcards of name patterns
         return false;
     }
-}
 
-// Main function to execute a command by parsing it and finding the matching command
-void CommandInterpreter::execute(const char* cmd)
-{
-    char word[CMD_MAX_LENGTH] = { 0 };
-    char* iw = word;
-
-    std::vector<char*> words;
-
-    // Parse the command into words separated by spaces
-    for (int i = 0; i < CMD_MAX_LENGTH && *cmd; cmd++, i++)
+    // Splits a command into words separated by spaces; the words are views into line, each terminated by '\0'
+    int tokenize(const char* cmd, /* out */ char* line, /* out */ std::string_view* words)
     {
-        if (!is_valid_character(*cmd))
-            throw std::exception(bout() << "Invalid character: '" << *cmd << "'" << bfin);
+        int words_count = 0;
+        int word_start = -1;
+        int n = 0;
 
-        if (*cmd == ' ')
+        for (; n < CMD_MAX_LENGTH && *cmd; cmd++, n++)
         {
-            if (iw == word) continue;
-            int wlen = (int)(iw - word);
-            char* found_word = new char[wlen + 1];
-            memcpy(found_word, word, wlen);
-            found_word[wlen] = '\0';
-            words.push_back(found_word);
-            iw = word;
+            if (!is_valid_character(*cmd))
+                throw std::runtime_error(bout() << "Invalid character: '" << *cmd << "'" << bfin);
+
+            if (*cmd == ' ')
+            {
+                line[n] = '\0';
+                if (word_start < 0) continue;
+                if (words_count == MAX_WORDS)
+                    throw std::runtime_error("Wrong command");
+                words[words_count++] = std::string_view(line + word_start, n - word_start);
+                word_start = -1;
+            }
+            else
+            {
+                line[n] = *cmd;
+                if (word_start < 0) word_start = n;
+            }
         }
-        else
+        line[n] = '\0';
+
+        // If there is a remaining word, add it to words
+        if (word_start >= 0)
         {
-            *(iw++) = *cmd;
+            if (words_count == MAX_WORDS)
+                throw std::runtime_error("Wrong command");
+            words[words_count++] = std::string_view(line + word_start, n - word_start);
         }
-    }
 
-    // If there is a remaining word, add it to words
-    if (iw != word)
-    {
-        int wlen = (int)(iw - word);
-        char* found_word = new char[wlen + 1];
-        memcpy(found_word, word, wlen);
-        found_word[wlen] = '\0';
-        words.push_back(found_word);
-    }
+        // If the command exceeds maximum length, throw exception
+        if (*cmd)
+            throw std::runtime_error("Failed to parse command: input too long");
 
-    // If the command exceeds maximum length, throw exception
-    if (*cmd)
-    {
-        throw std::exception("Failed to parse command: input too long");
+        return words_count;
     }
+}
+
+// Main function to execute a command by parsing it and finding the matching command
+void CommandInterpreter::execute(const char* cmd)
+{
+    char line[CMD_MAX_LENGTH + 1];
+    std::string_view words[MAX_WORDS];
+    int words_count = tokenize(cmd, line, words);
 
     // If no words were parsed, return
-    if (words.size() == 0) return;
+    if (words_count == 0) return;
 
     // Try executing the command
-    if (!privates->try_execute(words))
+    if (!privates->try_execute(words, words_count))
     {
-        throw std::exception("Wrong command");
+        throw std::runtime_error("Wrong command");
     }
 }
 
+// Parses and type-checks a command without running it (errors are thrown as execute would)
+CommandInterpreter::PreparedCommand CommandInterpreter::prepare(const char* cmd)
+{
+    char line[CMD_MAX_LENGTH + 1];
+    std::string_view words[MAX_WORDS];
+    int words_count = tokenize(cmd, line, words);
+
+    PreparedCommand prepared;
+    if (words_count == 0) return prepared;
+
+    prepared.command = privates->find(words, words_count);
+    if (prepared.command < 0)
+        throw std::runtime_error("Wrong command");
+
+    Parameter pms[_privates_::MAX_PARAMS];
+    _privates_::bind_parameters(privates->commands[prepared.command], words, words_count, pms);
+
+    prepared.words.assign(words, words + words_count);
+    return prepared;
+}
+
+// Runs a command returned by prepare
+void CommandInterpreter::execute(const PreparedCommand& cmd)
+{
+    if (cmd.command < 0) return;
+
+    std::string_view words[MAX_WORDS];
+    int words_count = (int)cmd.words.size();
+    for (int i = 0; i < words_count; i++)
+        words[i] = std::string_view(cmd.words[i].c_str(), cmd.words[i].size());
+
+    privates->run(cmd.command, words, words_count);
+}
+
 // Destructor for CommandInterpreter, cleans up private data
 CommandInterpreter::~CommandInterpreter()
 {
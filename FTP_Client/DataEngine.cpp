@@ -0,0 +1,93 @@
+#include "DataEngine.h"
+
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include "tcp_exception.h"
+#include "Trace.h"
+
+// Creates the requested engine, falling back to the plain one when it cannot be set up
+DataEngine* DataEngine::create(const char* name)
+{
+    if (strcmp(name, "plain") == 0)
+        return new PlainDataEngine();
+
+    if (strcmp(name, "copy") == 0)
+        return new CopyDataEngine();
+
+    if (strcmp(name, "uring") == 0)
+    {
+#ifdef __linux__
+        try
+        {
+            return new UringDataEngine();
+        }
+        catch (const std::exception& e)
+        {
+            printf("io_uring unavailable (%s), using the plain data engine.\n", e.what());
+            return new PlainDataEngine();
+        }
+#else
+        printf("io_uring is only available on Linux, using the plain data engine.\n");
+        return new PlainDataEngine();
+#endif
+    }
+
+    throw std::runtime_error("Unknown data engine (expected plain, copy or uring)");
+}
+
+// Receives into a fixed buffer and appends every chunk to the file
+unsigned long long PlainDataEngine::recv_to_file(TCP& data_port, VirtualFS::Writer& writer, Digest* digest)
+{
+    std::vector<char> tmp_buffer(BUFFER_SIZE);
+    unsigned long long received = 0;
+    TCPResult result{};
+
+    while ((result = data_port.recv(tmp_buffer.data(), tmp_buffer.size())).ok && result.bytes_count > 0)
+    {
+        if (received == 0)
+        {
+            first_byte_time = std::chrono::steady_clock::now();
+            Trace::instant("first byte");
+        }
+        writer.write(tmp_buffer.data(), result.bytes_count);
+        if (digest != nullptr)
+            digest->update(tmp_buffer.data(), result.bytes_count);
+        received += result.bytes_count;
+    }
+
+    if (!result.ok)
+        throw tcp_exception(result.get_error_message());
+
+    return received;
+}
+
+// Sends the file with the zero-copy path of TCP (chunked copy when unavailable), through a buffer when hashing it
+void PlainDataEngine::send_from_file(TCP& data_port, VirtualFS::Reader& reader, Digest* digest)
+{
+    if (digest == nullptr)
+    {
+        data_port.ensure_send_file(reader.get_fd(), 0, reader.get_size());
+        return;
+    }
+    send_buffered(data_port, reader, digest);
+}
+
+// Reads the file chunk by chunk and sends each one, hashing it while it is still in the cache
+void PlainDataEngine::send_buffered(TCP& data_port, VirtualFS::Reader& reader, Digest* digest)
+{
+    std::vector<char> tmp_buffer(BUFFER_SIZE);
+    size_t count;
+    while ((count = reader.read(tmp_buffer.data(), tmp_buffer.size())) > 0)
+    {
+        if (digest != nullptr)
+            digest->update(tmp_buffer.data(), count);
+        data_port.ensure_send(tmp_buffer.data(), count);
+    }
+}
+
+// Sends the file through a buffer even when nothing hashes it
+void CopyDataEngine::send_from_file(TCP& data_port, VirtualFS::Reader& reader, Digest* digest)
+{
+    send_buffered(data_port, reader, digest);
+}
@@ -0,0 +1,491 @@
+#include "DirectoryListing.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include "utils.h"
+
+namespace
+{
+    constexpr long long SECONDS_PER_DAY = 86400;
+
+    // Helper function to count the days from 1970-01-01 to a date of the proleptic Gregorian calendar
+    long long days_from_civil(int year, int month, int day)
+    {
+        year -= month <= 2;
+        long long era = (year >= 0 ? year : year - 399) / 400;
+        long long year_of_era = year - era * 400;
+        long long day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        long long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+        return era * 146097 + day_of_era - 719468;
+    }
+
+    // Helper function for the inverse: the date of a day counted from 1970-01-01
+    void civil_from_days(long long days, int& year, int& month, int& day)
+    {
+        days += 719468;
+        long long era = (days >= 0 ? days : days - 146096) / 146097;
+        long long day_of_era = days - era * 146097;
+        long long year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+        long long day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+        long long mp = (5 * day_of_year + 2) / 153;
+        day = (int)(day_of_year - (153 * mp + 2) / 5 + 1);
+        month = (int)(mp < 10 ? mp + 3 : mp - 9);
+        year = (int)(year_of_era + era * 400 + (month <= 2));
+    }
+
+    // Helper function to convert a UTC date and time to seconds since 1970, -1 when a field is out of range
+    long long to_epoch(int year, int month, int day, int hour, int minute, int second)
+    {
+        if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+            return -1;
+        return days_from_civil(year, month, day) * SECONDS_PER_DAY + hour * 3600 + minute * 60 + second;
+    }
+
+    // Helper function to read exactly count digits, false if there are fewer
+    bool read_digits(const char*& it, const char* end, int count, int& value)
+    {
+        value = 0;
+        for (int i = 0; i < count; i++, it++)
+        {
+            if (it == end || *it < '0' || '9' < *it)
+                return false;
+            value = value * 10 + (*it - '0');
+        }
+        return true;
+    }
+
+    // Helper function to read a decimal size, -1 when [it, end) is not a number that fits
+    long long parse_size(const char* it, const char* end)
+    {
+        constexpr int MAX_DIGITS = 18;
+        if (it == end || end - it > MAX_DIGITS)
+            return -1;
+
+        long long value = 0;
+        for (; it < end; it++)
+        {
+            if (*it < '0' || '9' < *it)
+                return -1;
+            value = value * 10 + (*it - '0');
+        }
+        return value;
+    }
+
+    // Helper function to compare [it, end) with a lowercase word, ignoring case
+    bool equals_nocase(const char* it, const char* end, const char* word)
+    {
+        for (; it < end && *word != '\0'; it++, word++)
+        {
+            char c = *it;
+            if ('A' <= c && c <= 'Z')
+                c = (char)(c - 'A' + 'a');
+            if (c != *word)
+                return false;
+        }
+        return it == end && *word == '\0';
+    }
+
+    // Helper function to parse an MLSD "YYYYMMDDHHMMSS[.sss]" time, -1 when malformed
+    long long parse_mlsd_time(const char* it, const char* end)
+    {
+        int year, month, day, hour, minute, second;
+        if (!read_digits(it, end, 4, year) || !read_digits(it, end, 2, month) || !read_digits(it, end, 2, day)
+            || !read_digits(it, end, 2, hour) || !read_digits(it, end, 2, minute) || !read_digits(it, end, 2, second))
+            return -1;
+        return to_epoch(year, month, day, hour, minute, second);
+    }
+
+    // Helper function to get the month (1-12) of an ls month abbreviation, 0 for anything else
+    int month_number(const char* it, const char* end)
+    {
+        static const char* const MONTHS[] = { "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec" };
+        if (end - it != 3)
+            return 0;
+        for (int i = 0; i < 12; i++)
+        {
+            if (equals_nocase(it, end, MONTHS[i]))
+                return i + 1;
+        }
+        return 0;
+    }
+
+    struct Field
+    {
+        const char* start;
+        const char* end;
+    };
+}
+
+// Appends one entry
+void DirectoryListing::add(const char* name, size_t length, EntryType type, long long size, long long mtime)
+{
+    if (arena.size() + length > UINT32_MAX)
+        throw std::runtime_error("Listing too large: names exceed 4 GB");
+
+    arena.insert(arena.end(), name, name + length);
+    name_ends.push_back((uint32_t)arena.size());
+    sizes.push_back(size);
+    mtimes.push_back(mtime);
+    types.push_back(type);
+}
+
+// Removes every entry, keeping the allocated arrays
+void DirectoryListing::clear()
+{
+    arena.clear();
+    name_ends.clear();
+    sizes.clear();
+    mtimes.clear();
+    types.clear();
+}
+
+// Releases unused capacity
+void DirectoryListing::shrink_to_fit()
+{
+    arena.shrink_to_fit();
+    name_ends.shrink_to_fit();
+    sizes.shrink_to_fit();
+    mtimes.shrink_to_fit();
+    types.shrink_to_fit();
+}
+
+// Name of entry i, valid until the listing changes
+std::string_view DirectoryListing::name(size_t i) const
+{
+    uint32_t start = i == 0 ? 0 : name_ends[i - 1];
+    return std::string_view(arena.data() + start, name_ends[i] - start);
+}
+
+// Bytes allocated by the arrays
+size_t DirectoryListing::memory_usage() const
+{
+    return arena.capacity() + name_ends.capacity() * sizeof(uint32_t) + sizes.capacity() * sizeof(long long)
+        + mtimes.capacity() * sizeof(long long) + types.capacity() * sizeof(EntryType);
+}
+
+// Prints the entry like a line of a long listing
+void ListingEntry::print(std::ostream& o) const
+{
+    static const char TYPE_LETTERS[] = { '-', 'd', 'l', '?' };
+
+    char time_text[24] = "-";
+    if (mtime >= 0)
+    {
+        int year, month, day;
+        long long seconds = mtime % SECONDS_PER_DAY;
+        civil_from_days(mtime / SECONDS_PER_DAY, year, month, day);
+        snprintf(time_text, sizeof(time_text), "%04d-%02d-%02d %02lld:%02lld", year, month, day, seconds / 3600, seconds / 60 % 60);
+    }
+
+    char line[64];
+    snprintf(line, sizeof(line), "%c %14lld  %-16s  ", TYPE_LETTERS[(int)type], size, time_text);
+    o << line;
+    o.write(name.data(), name.size());
+    o << "\n";
+}
+
+// Formats a time the way MLSD, MDTM and MFMT write it
+std::string format_ftp_time(long long mtime)
+{
+    int year, month, day;
+    long long seconds = mtime % SECONDS_PER_DAY;
+    civil_from_days(mtime / SECONDS_PER_DAY, year, month, day);
+
+    char text[24];
+    snprintf(text, sizeof(text), "%04d%02d%02d%02lld%02lld%02lld", year, month, day, seconds / 3600, seconds / 60 % 60, seconds % 60);
+    return text;
+}
+
+// Prints the entries like a long listing
+void DirectoryListing::print(std::ostream& o) const
+{
+    for (size_t i = 0; i < count(); i++)
+        entry(i).print(o);
+}
+
+// Constructor for ListingParser
+ListingParser::ListingParser(ListingHandler on_entry, ListingFormat format, long long now)
+    : on_entry{ std::move(on_entry) }, format{ format }, now{ now >= 0 ? now : (long long)std::time(nullptr) }
+{
+    int month, day;
+    civil_from_days(this->now / SECONDS_PER_DAY, current_year, month, day);
+}
+
+// Constructor for ListingParser filling a DirectoryListing
+ListingParser::ListingParser(DirectoryListing& listing, ListingFormat format, long long now)
+    : ListingParser([&listing](const ListingEntry& entry) { listing.add(entry); return true; }, format, now) { }
+
+// Splits a chunk into lines (find_char scans 16 bytes at a time) and parses the complete ones
+bool ListingParser::feed(const char* data, size_t size)
+{
+    const char* end = data + size;
+
+    // Complete the line left over from the previous chunk
+    if (!partial.empty() || partial_too_long)
+    {
+        const char* lf = Utils::find_char(data, size, '\n');
+        size_t used = lf == nullptr ? size : lf - data;
+        if (partial.size() + used > MAX_LINE_SIZE)
+        {
+            partial.clear();
+            partial_too_long = true;
+        }
+        if (!partial_too_long)
+            partial.append(data, used);
+        if (lf == nullptr)
+            return !stopped;
+
+        if (partial_too_long)
+            skipped++;
+        else
+            parse_line(partial.data(), partial.data() + partial.size());
+        partial.clear();
+        partial_too_long = false;
+        data = lf + 1;
+    }
+
+    while (data < end && !stopped)
+    {
+        const char* lf = Utils::find_char(data, end - data, '\n');
+        if (lf == nullptr)
+        {
+            partial.assign(data, std::min<size_t>(end - data, MAX_LINE_SIZE));
+            partial_too_long = (size_t)(end - data) > MAX_LINE_SIZE;
+            break;
+        }
+        parse_line(data, lf);
+        data = lf + 1;
+    }
+    return !stopped;
+}
+
+// Parses the last line if the listing did not end with a line break
+void ListingParser::finish()
+{
+    if (partial_too_long)
+        skipped++;
+    else if (!partial.empty())
+        parse_line(partial.data(), partial.data() + partial.size());
+    partial.clear();
+    partial_too_long = false;
+}
+
+// Parses one line without its LF, in the format of the listing
+void ListingParser::parse_line(const char* line, const char* end)
+{
+    if (end > line && end[-1] == '\r')
+        end--;
+    if (end == line || stopped)
+        return;
+
+    bool parsed = format == ListingFormat::MLSD ? parse_mlsd(line, end)
+        : ('0' <= *line && *line <= '9') ? parse_dos(line, end)
+        : parse_unix(line, end);
+    if (!parsed)
+        skipped++;
+}
+
+// Hands an entry on unless it is "." or "..", skips names that are not a single path component
+void ListingParser::add(const char* name, const char* end, EntryType type, long long size, long long mtime)
+{
+    size_t length = end - name;
+    if ((length == 1 && name[0] == '.') || (length == 2 && name[0] == '.' && name[1] == '.'))
+        return;
+
+    // A name with a separator (or a NUL ending it early) would reach outside the listed directory once joined to its path
+    for (const char* it = name; it < end; it++)
+    {
+        if (*it == '/' || *it == '\\' || *it == '\0')
+        {
+            skipped++;
+            return;
+        }
+    }
+
+    entries++;
+    if (!on_entry(ListingEntry{ std::string_view(name, length), type, size, mtime }))
+        stopped = true;
+}
+
+// "type=file;size=1024;modify=20240101000000; name": facts up to the first space, then the name
+bool ListingParser::parse_mlsd(const char* line, const char* end)
+{
+    const char* space = Utils::find_char(line, end - line, ' ');
+    if (space == nullptr || space + 1 == end)
+        return false;
+
+    EntryType type = EntryType::OTHER;
+    long long size = -1, mtime = -1;
+    for (const char* fact = line; fact < space; )
+    {
+        const char* fact_end = Utils::find_char(fact, space - fact, ';');
+        if (fact_end == nullptr)
+            fact_end = space;
+        const char* equals = Utils::find_char(fact, fact_end - fact, '=');
+        if (equals != nullptr)
+        {
+            const char* value = equals + 1;
+            if (equals_nocase(fact, equals, "type"))
+            {
+                // The entries for the directory itself and its parent are not part of the listing
+                if (equals_nocase(value, fact_end, "cdir") || equals_nocase(value, fact_end, "pdir"))
+                    return true;
+                if (equals_nocase(value, fact_end, "file"))
+                    type = EntryType::REGULAR;
+                else if (equals_nocase(value, fact_end, "dir"))
+                    type = EntryType::DIRECTORY;
+                else if (fact_end - value >= 13 && equals_nocase(value, value + 13, "os.unix=slink"))
+                    type = EntryType::LINK;
+            }
+            else if (equals_nocase(fact, equals, "size"))
+                size = parse_size(value, fact_end);
+            else if (equals_nocase(fact, equals, "modify"))
+                mtime = parse_mlsd_time(value, fact_end);
+        }
+        fact = fact_end + 1;
+    }
+
+    add(space + 1, end, type, size, mtime);
+    return true;
+}
+
+// "drwxr-xr-x 2 owner group 4096 Jan 15 12:00 name" (or "Jan 15 2023"); the group may be missing, so the
+// date is found first and the size is the field before it
+bool ListingParser::parse_unix(const char* line, const char* end)
+{
+    constexpr int MAX_FIELDS = 9;
+    EntryType type;
+    switch (*line)
+    {
+    case '-': type = EntryType::REGULAR; break;
+    case 'd': type = EntryType::DIRECTORY; break;
+    case 'l': type = EntryType::LINK; break;
+    case 'b': case 'c': case 'p': case 's': type = EntryType::OTHER; break;
+    default: return false;
+    }
+
+    Field fields[MAX_FIELDS];
+    int count = 0;
+    const char* it = line;
+    while (count < MAX_FIELDS && it < end)
+    {
+        while (it < end && *it == ' ')
+            it++;
+        if (it == end)
+            return false;
+        const char* start = it;
+        while (it < end && *it != ' ')
+            it++;
+        fields[count++] = Field{ start, it };
+
+        // permissions, [links, owner, group,] size, month, day, time or year
+        if (count < 5)
+            continue;
+        const Field& month_field = fields[count - 3];
+        const Field& day_field = fields[count - 2];
+        const Field& time_field = fields[count - 1];
+        int month = month_number(month_field.start, month_field.end);
+        long long size = parse_size(fields[count - 4].start, fields[count - 4].end);
+        if (month == 0 || size < 0 || day_field.end - day_field.start > 2)
+            continue;
+
+        int day = 0, hour = 0, minute = 0, year = current_year;
+        const char* at = day_field.start;
+        if (!read_digits(at, day_field.end, (int)(day_field.end - day_field.start), day))
+            continue;
+
+        at = time_field.start;
+        size_t time_length = time_field.end - time_field.start;
+        bool recent = time_length == 5 && time_field.start[2] == ':';
+        if (recent)
+        {
+            if (!read_digits(at, time_field.end, 2, hour) || *at++ != ':' || !read_digits(at, time_field.end, 2, minute))
+                continue;
+        }
+        else if (time_length != 4 || !read_digits(at, time_field.end, 4, year))
+            continue;
+
+        long long mtime = to_epoch(year, month, day, hour, minute, 0);
+        // ls shows the time instead of the year for the last six months, so a date ahead of now is from last year
+        if (recent && mtime > now + SECONDS_PER_DAY)
+            mtime = to_epoch(year - 1, month, day, hour, minute, 0);
+
+        // One space separates the name, which may itself contain spaces
+        if (it + 1 >= end)
+            return false;
+        const char* name = it + 1;
+        const char* name_end = end;
+        if (type == EntryType::LINK)
+        {
+            for (const char* arrow = name; arrow + 4 <= end; arrow++)
+            {
+                if (memcmp(arrow, " -> ", 4) == 0)
+                {
+                    name_end = arrow;
+                    break;
+                }
+            }
+        }
+
+        add(name, name_end, type, size, mtime);
+        return true;
+    }
+    return false;
+}
+
+// "01-15-24  03:04PM       <DIR>          name" or "01-15-2024  15:04  12345 name"
+bool ListingParser::parse_dos(const char* line, const char* end)
+{
+    const char* it = line;
+    int month, day, year, hour, minute;
+    if (!read_digits(it, end, 2, month) || it == end || *it++ != '-' || !read_digits(it, end, 2, day) || it == end || *it++ != '-')
+        return false;
+
+    const char* year_start = it;
+    while (it < end && '0' <= *it && *it <= '9')
+        it++;
+    const char* year_end = it;
+    it = year_start;
+    if (year_end - year_start == 2 && read_digits(it, end, 2, year))
+        year += year < 70 ? 2000 : 1900;
+    else if (year_end - year_start != 4 || !read_digits(it, end, 4, year))
+        return false;
+
+    while (it < end && *it == ' ')
+        it++;
+    if (!read_digits(it, end, 2, hour) || it == end || *it++ != ':' || !read_digits(it, end, 2, minute))
+        return false;
+    if (end - it >= 2 && (it[1] == 'M' || it[1] == 'm'))
+    {
+        bool pm = it[0] == 'P' || it[0] == 'p';
+        if (hour == 12)
+            hour = 0;
+        if (pm)
+            hour += 12;
+        it += 2;
+    }
+
+    while (it < end && *it == ' ')
+        it++;
+    const char* field = it;
+    while (it < end && *it != ' ')
+        it++;
+
+    EntryType type = EntryType::REGULAR;
+    long long size = -1;
+    if (it - field == 5 && memcmp(field, "<DIR>", 5) == 0)
+        type = EntryType::DIRECTORY;
+    else if ((size = parse_size(field, it)) < 0)
+        return false;
+
+    while (it < end && *it == ' ')
+        it++;
+    if (it == end)
+        return false;
+
+    add(it, end, type, size, to_epoch(year, month, day, hour, minute, 0));
+    return true;
+}
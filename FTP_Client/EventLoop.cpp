@@ -0,0 +1,190 @@
+#include "EventLoop.h"
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <vector>
+#include "tcp_exception.h"
+#include "bout.h"
+
+// Constructor creates the epoll instance
+EventLoop::EventLoop()
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        throw tcp_exception(TCPResult::fail(errno).get_error_message());
+}
+
+// Registers a one-shot watch for the connection, re-arming its epoll entry if it already has one
+void EventLoop::watch(TCP& tcp, int events, Clock::time_point deadline, ReadyCallback callback)
+{
+    int fd = (int)tcp.get_native_handle();
+    if (fd < 0)
+        throw tcp_exception("Cannot watch a closed connection");
+
+    epoll_event ev{};
+    ev.events = EPOLLONESHOT;
+    if (events & READABLE) ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (events & WRITABLE) ev.events |= EPOLLOUT;
+    ev.data.fd = fd;
+
+    // A fired one-shot entry stays registered (disabled), so try MOD before ADD
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0)
+    {
+        if (errno != ENOENT || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            throw tcp_exception(TCPResult::fail(errno).get_error_message());
+    }
+
+    watches[fd] = Watch{ events, deadline, std::move(callback) };
+}
+
+// Drops the watch of a connection without running its callback
+void EventLoop::cancel(TCP& tcp)
+{
+    int fd = (int)tcp.get_native_handle();
+    if (fd < 0) return;
+
+    watches.erase(fd);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+// Sends what the socket accepts now and waits for writability to continue with the rest
+void EventLoop::continue_send(TCP& tcp, const char* buffer, size_t size, size_t sent, Clock::time_point deadline, Completion done)
+{
+    while (sent < size)
+    {
+        TCPResult result = tcp.send_some(buffer + sent, size - sent);
+        if (result.is_would_block())
+        {
+            watch(tcp, WRITABLE, deadline, [this, &tcp, buffer, size, sent, deadline, done](int events)
+            {
+                if (events == 0)
+                {
+                    done(TCPResult::timed_out());
+                    return;
+                }
+                continue_send(tcp, buffer, size, sent, deadline, done);
+            });
+            return;
+        }
+        if (!result.ok)
+        {
+            done(result);
+            return;
+        }
+        sent += result.bytes_count;
+    }
+    done(TCPResult::success((int)sent));
+}
+
+// Sends the whole buffer asynchronously
+void EventLoop::async_send(TCP& tcp, const void* buffer, size_t size, Clock::time_point deadline, Completion done)
+{
+    continue_send(tcp, static_cast<const char*>(buffer), size, 0, deadline, std::move(done));
+}
+
+// Receives the next available bytes asynchronously
+void EventLoop::async_recv(TCP& tcp, void* buffer, size_t size, Clock::time_point deadline, Completion done)
+{
+    TCPResult result = tcp.recv_some(buffer, size);
+    if (!result.is_would_block())
+    {
+        done(result);
+        return;
+    }
+
+    watch(tcp, READABLE, deadline, [this, &tcp, buffer, size, deadline, done](int events)
+    {
+        if (events == 0)
+        {
+            done(TCPResult::timed_out());
+            return;
+        }
+        async_recv(tcp, buffer, size, deadline, done);
+    });
+}
+
+// Runs the callbacks of every watch whose deadline has passed
+int EventLoop::expire_watches(Clock::time_point now)
+{
+    std::vector<int> expired;
+    for (const auto& [fd, w] : watches)
+    {
+        if (w.deadline <= now)
+            expired.push_back(fd);
+    }
+
+    for (int fd : expired)
+    {
+        auto it = watches.find(fd);
+        if (it == watches.end()) continue;
+
+        ReadyCallback callback = std::move(it->second.callback);
+        watches.erase(it);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        callback(0);
+    }
+    return (int)expired.size();
+}
+
+// Waits for readiness (bounded by the nearest deadline) and dispatches the callbacks
+int EventLoop::run_once(int timeout_ms)
+{
+    Clock::time_point now = Clock::now();
+
+    // Never sleep past the nearest deadline
+    for (const auto& [fd, w] : watches)
+    {
+        if (w.deadline == Clock::time_point::max()) continue;
+        long long left = std::chrono::duration_cast<std::chrono::milliseconds>(w.deadline - now).count() + 1;
+        if (left < 0) left = 0;
+        if (timeout_ms < 0 || left < timeout_ms) timeout_ms = (int)left;
+    }
+
+    epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (n < 0)
+    {
+        if (errno == EINTR) return 0;
+        throw tcp_exception(TCPResult::fail(errno).get_error_message());
+    }
+
+    int handled = 0;
+    for (int i = 0; i < n; i++)
+    {
+        auto it = watches.find(events[i].data.fd);
+        if (it == watches.end()) continue;
+
+        // Errors and hang-ups are reported as readiness so the next I/O call surfaces them
+        int ready = 0;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) ready |= READABLE;
+        if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) ready |= WRITABLE;
+        ready &= it->second.events;
+        if (ready == 0) ready = it->second.events;
+
+        ReadyCallback callback = std::move(it->second.callback);
+        watches.erase(it);
+        callback(ready);
+        handled++;
+    }
+
+    return handled + expire_watches(Clock::now());
+}
+
+// Runs until every watch has completed or expired
+void EventLoop::run()
+{
+    while (!watches.empty())
+        run_once(-1);
+}
+
+// Destructor closes the epoll instance
+EventLoop::~EventLoop()
+{
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+}
+
+#endif
@@ -1,10 +1,32 @@
 #include "FTPClient.h"
 #include <iostream>
+#include <thread>
+#include <future>
+#include <stdexcept>
 #include "utils.h"
 #include "bout.h"
+#include "tcp_exception.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "EventLoop.h"
+
+namespace
+{
+    // Helper function to check for the preliminary reply of a transfer command: 150 (opening the data connection)
+    // or 125 (data connection already open)
+    bool is_transfer_started(int code)
+    {
+        return code == 150 || code == 125;
+    }
+}
 
 // Constructor for FTPClient, initializes connection and filesystem
 FTPClient::FTPClient(const char* ip, int port, std::function<void(const char*)> print_line)
+    : FTPClient(ip, port, print_line, nullptr) { }
+
+// Constructor for FTPClient recording its connections (recorder may be nullptr)
+FTPClient::FTPClient(const char* ip, int port, std::function<void(const char*)> print_line, SessionRecorder* recorder)
+    : host{ ip }, port{ port }, data_port{ recorder != nullptr ? recorder->create_transport(false) : nullptr }, recorder{ recorder }
 {
     // Store the print_line callback
     this->print_line = print_line;
@@ -13,20 +35,44 @@ FTPClient::FTPClient(const char* ip, int port, std::function<void(const char*)>
     std::function<void(const char*)> line_rec_cb = std::bind(&FTPClient::line_received_callback, this, std::placeholders::_1);
 
     // Initialize TelNetClient for communication with server
-    telnet_client = new TelNetClient(ip, port, line_rec_cb);
+    if (recorder != nullptr)
+        telnet_client = new TelNetClient(recorder->create_transport(true), host.c_str(), port, line_rec_cb);
+    else
+        telnet_client = new TelNetClient(host.c_str(), port, line_rec_cb);
 
     // Set initial connection state
     connected = true;
 
     // Create VirtualFS object for file system operations
     filesystem = new VirtualFS("vfs_root");
+
+    // Data connections use the portable engine until another one is selected
+    engine = new PlainDataEngine();
+
+    // Listings are cached per client, open_session shares the cache with the new session
+    listing_cache = std::make_shared<ListingCache>();
 }
 
 // Callback for processing received lines from the server
 void FTPClient::line_received_callback(const char* line)
 {
     // Store the received line in a buffer
-    strncpy_s(line_buffer, line, sizeof(line_buffer));
+    snprintf(line_buffer, sizeof(line_buffer), "%s", line);
+
+    // Features are the indented lines of the FEAT reply, their first word is the name, parameters may follow
+    if (collecting_features && line[0] == ' ')
+    {
+        std::string name(line + 1, strcspn(line + 1, " \r\n"));
+        for (char& c : name)
+            c = (char)toupper((unsigned char)c);
+
+        const char* parameters = line + 1 + name.size();
+        parameters += strspn(parameters, " ");
+        features[name] = std::string(parameters, strcspn(parameters, "\r\n"));
+    }
+
+    // Replies to a background PASV would interleave with the prompt
+    if (quiet || speculating) return;
 
     // Print the received line with special formatting
     std::cout << Utils::Color::Yellow();
@@ -36,9 +82,18 @@ void FTPClient::line_received_callback(const char* line)
 
 // Wrapper function to send commands to the server and handle output
 int FTPClient::send_command_wrapper(const char* cmd)
+{
+    // The control connection may still be busy with a speculative PASV
+    finish_speculative_pasv();
+    return issue_command(cmd);
+}
+
+// Function to print and send a command, without waiting for a background PASV
+int FTPClient::issue_command(const char* cmd)
 {
     // Print the command to be sent with blue formatting
-    std::cout << Utils::Color::Blue() << cmd << Utils::Color::White() << "\n";
+    if (!quiet && !speculating)
+        std::cout << Utils::Color::Blue() << cmd << Utils::Color::White() << "\n";
 
     // Send the command through the TelNet client
     return telnet_client->send_command(cmd);
@@ -57,14 +112,21 @@ void FTPClient::login(const char* user, const char* pass)
     // Send USER command and check for 331 response (username okay)
     if (send_command_wrapper(bout() << "USER " << user << bfin) != 331)
     {
-        throw std::exception("login failed");
+        throw std::runtime_error("login failed");
     }
 
     // Send PASS command and check for 230 response (logged in)
     if (send_command_wrapper(bout() << "PASS " << pass << bfin) != 230)
     {
-        throw std::exception("login failed");
+        throw std::runtime_error("login failed");
     }
+
+    // Remember the credentials so extra sessions (segmented downloads) can log in too
+    this->user = user;
+    this->pass = pass;
+
+    // A new login starts in the server's default TYPE A
+    ascii = true;
 }
 
 // Function to log out from the FTP server
@@ -73,45 +135,150 @@ void FTPClient::logout()
     // Send QUIT command and check for 221 response (logged out)
     if (send_command_wrapper("QUIT") != 221)
     {
-        throw std::exception("logout failed");
+        throw std::runtime_error("logout failed");
     }
 
-    // Set connection state to false and close the TelNet client
+    // Set connection state to false, drop a pre-opened data connection and close the TelNet client
     connected = false;
+    data_port.close();
     telnet_client->close();
 }
 
 // Function to list files in the specified directory (or current directory if no path given)
-void FTPClient::list(const char* path)
+void FTPClient::list(const char* path, bool bypass_cache)
 {
-    // Send LIST command with the provided path (or just LIST for current directory)
-    int resp = path == nullptr ? send_command_wrapper("LIST") : send_command_wrapper(bout() << "LIST " << path << bfin);
+    // With the cache enabled the listing is kept anyway, without it nothing is
+    if (listing_cache->is_enabled())
+    {
+        std::shared_ptr<const DirectoryListing> listing = list_cached(path, bypass_cache);
+        if (!quiet)
+            listing->print(std::cout);
+        return;
+    }
 
-    // Check for 150 response (start of data transfer)
-    if (resp != 150)
-        throw std::exception("Failed");
+    // Print each entry as soon as it arrives
+    list_stream(path, [this](const ListingEntry& entry)
+    {
+        if (!quiet)
+            entry.print(std::cout);
+        return true;
+    });
+}
+
+// Function to get the entries of a remote directory, from the listing cache when possible
+std::shared_ptr<const DirectoryListing> FTPClient::list_cached(const char* path, bool bypass_cache)
+{
+    std::string key = ListingCache::normalize(path);
+    if (!bypass_cache)
+    {
+        std::shared_ptr<const DirectoryListing> cached = listing_cache->find(key);
+        if (cached != nullptr)
+            return cached;
+    }
+
+    std::shared_ptr<const DirectoryListing> listing = std::make_shared<const DirectoryListing>(list_entries(path));
+    listing_cache->store(key, listing);
+    return listing;
+}
+
+// Function to get the entries of a remote directory (or of the current directory if no path given)
+DirectoryListing FTPClient::list_entries(const char* path)
+{
+    DirectoryListing listing;
+    list_stream(path, [&listing](const ListingEntry& entry)
+    {
+        listing.add(entry);
+        return true;
+    });
+    listing.shrink_to_fit();
+    return listing;
+}
 
-    // Temporary buffer for receiving data
-    std::vector<char> tmp_buffer(1024);
-    std::vector<char> buffer;
-    int tmp_effective_size = 0;
+// Function to parse the listing of a remote directory while it arrives, handing on each entry
+unsigned long long FTPClient::list_stream(const char* path, const ListingHandler& on_entry)
+{
+    // MLSD has one machine-readable format, LIST lines look like the server's ls or dir
+    bool mlsd = has_feature("MLST");
+    const char* verb = mlsd ? "MLSD" : "LIST";
+
+    prepare_data_port();
+    int resp = path == nullptr ? send_command_wrapper(verb) : send_command_wrapper(bout() << verb << " " << path << bfin);
 
-    // Receive data from the server and store it in the buffer
-    while ((tmp_effective_size = data_port.recv(tmp_buffer.data(), tmp_buffer.size()).bytes_count) > 0)
+    // Check for 150/125 response (start of data transfer)
+    if (!is_transfer_started(resp))
     {
-        buffer.insert(buffer.end(), tmp_buffer.begin(), tmp_buffer.begin() + tmp_effective_size);
+        data_port.close();
+        throw std::runtime_error("Failed");
     }
 
-    // Close the data connection
+    ListingParser parser(on_entry, mlsd ? ListingFormat::MLSD : ListingFormat::LIST);
+    std::vector<char> tmp_buffer(DATA_BUFF_SIZE);
+    TCPResult result{};
+
+    // Parse each chunk as it arrives, a line split between two chunks waits in the parser;
+    // only the end of the stream completes a listing, an error or a timeout fails it
+    try
+    {
+        TraceSpan span("list data", verb);
+        while ((result = data_port.recv(tmp_buffer.data(), tmp_buffer.size())).ok && result.bytes_count > 0)
+        {
+            if (!parser.feed(tmp_buffer.data(), result.bytes_count))
+                break;
+        }
+        if (!result.ok)
+            throw tcp_exception(result.get_error_message());
+        parser.finish();
+    }
+    catch (const std::exception&)
+    {
+        // Closing the data connection ends the transfer on the server too, consume its reply
+        data_port.close();
+        telnet_client->recv_response();
+        throw;
+    }
+
+    // Close the data connection (early when the handler stopped the listing)
     data_port.close();
 
-    // Null-terminate and print the received data
-    buffer.push_back('\0');
-    printf(buffer.data());
+    // Check for 226 response (successful transfer); a stopped listing may also end with 426/451
+    int code = telnet_client->recv_response();
+    if (code != 226 && !parser.is_stopped())
+        throw std::runtime_error("Failed transfer");
 
-    // Check for 226 response (successful transfer)
-    if (telnet_client->recv_response() != 226)
-        throw std::exception("Failed transfer");
+    start_speculative_pasv();
+    return parser.get_entries();
+}
+
+// Function to check whether the server announces a feature, asking with FEAT the first time
+bool FTPClient::has_feature(const char* name)
+{
+    if (!features_known)
+    {
+        collecting_features = true;
+        try
+        {
+            // Servers without FEAT answer 500/502: no features
+            if (send_command_wrapper("FEAT") != 211)
+                features.clear();
+        }
+        catch (...)
+        {
+            collecting_features = false;
+            throw;
+        }
+        collecting_features = false;
+        features_known = true;
+    }
+
+    return features.count(name) > 0;
+}
+
+// Function to get the parameters of a feature the server announces
+std::string FTPClient::get_feature_parameters(const char* name)
+{
+    if (!has_feature(name))
+        return "";
+    return features[name];
 }
 
 // Function to set the transfer mode to binary
@@ -119,7 +286,8 @@ void FTPClient::mode_binary()
 {
     // Send TYPE I command for binary mode
     if (send_command_wrapper("TYPE I") != 200)
-        throw std::exception("Failed");
+        throw std::runtime_error("Failed");
+    ascii = false;
 }
 
 // Function to set the transfer mode to ASCII
@@ -127,136 +295,908 @@ void FTPClient::mode_ascii()
 {
     // Send TYPE A command for ASCII mode
     if (send_command_wrapper("TYPE A") != 200)
-        throw std::exception("Failed");
+        throw std::runtime_error("Failed");
+    ascii = true;
 }
 
 // Function to store (upload) a file to the server
-void FTPClient::stor(const char* path)
+unsigned long long FTPClient::stor(const char* path)
 {
-    std::vector<char> buffer;
+    Metrics& metrics = Metrics::instance();
+    Metrics::Clock::time_point started = Metrics::Clock::now();
+    unsigned long long sent = 0;
 
+    // The server stores the bytes of an ASCII upload with its own line endings, so only binary uploads are checked
+    std::unique_ptr<Digest> digest = ascii ? nullptr : Digest::create(verify);
     try
     {
-        // Read the file from the virtual file system
-        buffer = filesystem->read(path);
+        // Open the file in the virtual file system; its contents are never loaded into memory
+        VirtualFS::Reader reader = filesystem->open_reader(path);
+        sent = reader.get_size();
+
+        // Send STOR command to initiate file upload
+        if (!is_transfer_started(send_command_wrapper(bout() << "STOR " << path << bfin)))
+            throw std::runtime_error("Failed");
+
+        try
+        {
+            // Send the whole file through the data connection with the selected engine
+            TraceSpan span("stor data", engine->get_name());
+            engine->send_from_file(data_port, reader, digest.get());
+        }
+        catch (const std::exception&)
+        {
+            // Closing the data connection makes the server finish the transfer, consume its reply
+            data_port.close();
+            telnet_client->recv_response();
+            throw;
+        }
     }
-    catch (const std::exception& e)
+    catch (const std::exception&)
     {
+        // Even a failed upload may leave a partial file behind
         data_port.close();
-        throw e;
+        listing_cache->invalidate(path);
+        metrics.record_failed_transfer();
+        throw;
     }
 
-    // Send STOR command to initiate file upload
-    if (send_command_wrapper(bout() << "STOR " << path << bfin) != 150)
-        throw std::exception("Failed");
-
-    // Send the file data through the data connection
-    data_port.send(buffer.data(), buffer.size());
     data_port.close();
 
-    // Check for 226 response (successful transfer)
-    if (telnet_client->recv_response() != 226)
-        throw std::exception("Failed transfer");
+    // Check for 226 response (successful transfer); the listing of the directory is stale either way
+    int resp = telnet_client->recv_response();
+    listing_cache->invalidate(path);
+    if (resp != 226)
+    {
+        metrics.record_failed_transfer();
+        throw std::runtime_error("Failed transfer");
+    }
+
+    // A mismatch leaves the damaged remote file in place, the error says which one it is
+    if (digest)
+    {
+        try
+        {
+            check_digest(path, *digest);
+        }
+        catch (const std::exception&)
+        {
+            metrics.record_failed_transfer();
+            throw;
+        }
+    }
+
+    metrics.record_transfer(true, sent, Metrics::elapsed_us(started));
+
+    start_speculative_pasv();
+    return sent;
 }
 
 // Function to retrieve (download) a file from the server
-void FTPClient::retr(const char* path)
+unsigned long long FTPClient::retr(const char* path)
 {
-    // Send RETR command to retrieve the file
-    if (send_command_wrapper(bout() << "RETR " << path << bfin) != 150)
-        throw std::exception("Failed");
+    Metrics& metrics = Metrics::instance();
 
-    // Temporary buffer for receiving data
-    std::vector<char> tmp_buffer(1024);
-    std::vector<char> buffer;
-    int tmp_effective_size = 0;
+    // Open the file first so each received chunk can go straight to disk; it is written next to the target
+    // (".part") and only replaces it once the transfer is complete, so a failed download leaves a local copy intact
+    VirtualFS::Writer writer = filesystem->open_writer(path);
+    std::unique_ptr<Digest> digest = ascii ? nullptr : Digest::create(verify);
+
+    // Send RETR command to retrieve the file
+    Metrics::Clock::time_point started = Metrics::Clock::now();
+    if (!is_transfer_started(send_command_wrapper(bout() << "RETR " << path << bfin)))
+    {
+        writer.discard();
+        data_port.close();
+        metrics.record_failed_transfer();
+        throw std::runtime_error("Failed");
+    }
 
-    // Receive data from the server and store it in the buffer
-    while ((tmp_effective_size = data_port.recv(tmp_buffer.data(), tmp_buffer.size()).bytes_count) > 0)
+    try
+    {
+        // Receive data from the server and append it to the file as it arrives (fixed-size buffers in every engine)
+        TraceSpan span("retr data", engine->get_name());
+        engine->recv_to_file(data_port, writer, digest.get());
+    }
+    catch (const std::exception&)
     {
-        buffer.insert(buffer.end(), tmp_buffer.begin(), tmp_buffer.begin() + tmp_effective_size);
+        writer.discard();
+        data_port.close();
+        metrics.record_failed_transfer();
+        telnet_client->recv_response();
+        throw;
     }
 
     // Close the data connection
     data_port.close();
 
-    // Write the received data to the virtual file system
-    filesystem->write(path, buffer);
-
     // Check for 226 response (successful transfer)
     if (telnet_client->recv_response() != 226)
-        throw std::exception("Failed transfer");
+    {
+        writer.discard();
+        metrics.record_failed_transfer();
+        throw std::runtime_error("Failed transfer");
+    }
+
+    // A file whose digest does not match never replaces the target
+    try
+    {
+        if (digest)
+            check_digest(path, *digest);
+        writer.close();
+    }
+    catch (const std::exception&)
+    {
+        writer.discard();
+        metrics.record_failed_transfer();
+        throw;
+    }
+
+    if (writer.get_bytes_written() > 0)
+        metrics.record_first_byte((unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(engine->get_first_byte_time() - started).count());
+    metrics.record_transfer(false, writer.get_bytes_written(), Metrics::elapsed_us(started));
+
+    start_speculative_pasv();
+    return writer.get_bytes_written();
 }
 
 namespace
 {
-    // Helper function to parse PASV address response from server
-    void parse_pasv_addr(const char* buff, int a[6])
+    // Helper function to parse the size from a "213 <size>" reply
+    long long parse_size_reply(const char* line)
+    {
+        constexpr int MAX_DIGITS = 18;
+        const char* it = line + 4;
+        long long value = 0;
+        int digits = 0;
+        for (; '0' <= *it && *it <= '9'; it++)
+        {
+            if (++digits > MAX_DIGITS)
+                throw std::runtime_error("Failed to parse SIZE reply: value too large");
+            value = value * 10 + (*it - '0');
+        }
+        if (digits == 0)
+            throw std::runtime_error("Failed to parse SIZE reply: missing value");
+        return value;
+    }
+}
+
+// Function to delete a remote file
+void FTPClient::remove(const char* path)
+{
+    int resp = send_command_wrapper(bout() << "DELE " << path << bfin);
+    listing_cache->invalidate(path);
+    if (resp != 250)
+        throw std::runtime_error("Failed");
+}
+
+// Function to rename (or move) a remote file or directory
+void FTPClient::rename(const char* from, const char* to)
+{
+    if (send_command_wrapper(bout() << "RNFR " << from << bfin) != 350)
+        throw std::runtime_error("Failed");
+
+    int resp = send_command_wrapper(bout() << "RNTO " << to << bfin);
+    listing_cache->invalidate(from);
+    listing_cache->invalidate(to);
+    if (resp != 250)
+        throw std::runtime_error("Failed");
+}
+
+// Function to create a remote directory
+void FTPClient::make_directory(const char* path)
+{
+    int resp = send_command_wrapper(bout() << "MKD " << path << bfin);
+    listing_cache->invalidate(path);
+    if (resp != 257)
+        throw std::runtime_error("Failed");
+}
+
+// Function to remove an empty remote directory
+void FTPClient::remove_directory(const char* path)
+{
+    int resp = send_command_wrapper(bout() << "RMD " << path << bfin);
+    listing_cache->invalidate(path);
+    if (resp != 250)
+        throw std::runtime_error("Failed");
+}
+
+// Function to set the modification time of a remote file
+bool FTPClient::set_modified(const char* path, long long mtime)
+{
+    if (mtime < 0 || !has_feature("MFMT"))
+        return false;
+
+    int resp = send_command_wrapper(bout() << "MFMT " << format_ftp_time(mtime).c_str() << " " << path << bfin);
+    listing_cache->invalidate(path);
+    return resp == 213;
+}
+
+// Function to ask the server for the CRC32 of a remote file
+bool FTPClient::remote_crc32(const char* path, uint32_t& crc)
+{
+    if (!has_feature("XCRC"))
+        return false;
+    if (send_command_wrapper(bout() << "XCRC " << path << bfin) != 250)
+        return false;
+
+    // "250 1A2B3C4D", some servers put "0x" in front
+    char* end;
+    unsigned long value = strtoul(line_buffer + 4, &end, 16);
+    if (end == line_buffer + 4)
+        return false;
+    crc = (uint32_t)value;
+    return true;
+}
+
+// Function to ask the server for the digest of a remote file with the best command it offers for the algorithm
+bool FTPClient::remote_digest(const char* path, HashAlgorithm algorithm, std::string& hex)
+{
+    const char* name = hash_name(algorithm);
+    const char* reply = line_buffer + 4;
+    int word = 0;
+
+    // HASH lists its algorithms as "SHA-1;SHA-256*;MD5", the starred one is in use until OPTS HASH changes it
+    bool listed = false;
+    std::string algorithms = get_feature_parameters("HASH");
+    for (size_t start = 0; start < algorithms.size(); )
+    {
+        size_t end = algorithms.find(';', start);
+        if (end == std::string::npos)
+            end = algorithms.size();
+        std::string listed_name = algorithms.substr(start, end - start);
+        start = end + 1;
+
+        bool selected = !listed_name.empty() && listed_name.back() == '*';
+        if (selected)
+            listed_name.pop_back();
+        for (char& c : listed_name)
+            c = (char)toupper((unsigned char)c);
+
+        listed = listed || listed_name == name;
+        if (selected && hash_selected.empty())
+            hash_selected = listed_name;
+    }
+
+    if (listed)
+    {
+        if (hash_selected != name)
+        {
+            if (send_command_wrapper(bout() << "OPTS HASH " << name << bfin) != 200)
+                return false;
+            hash_selected = name;
+        }
+        // "213 SHA-256 0-1048575 <hex> <path>"
+        if (send_command_wrapper(bout() << "HASH " << path << bfin) != 213)
+            return false;
+        word = 2;
+    }
+    else if (algorithm == HashAlgorithm::CRC32)
+    {
+        uint32_t crc;
+        if (!remote_crc32(path, crc))
+            return false;
+        char text[9];
+        snprintf(text, sizeof(text), "%08X", (unsigned)crc);
+        hex = text;
+        return true;
+    }
+    else if (algorithm == HashAlgorithm::MD5 && has_feature("XMD5"))
+    {
+        // "250 <hex>"
+        if (send_command_wrapper(bout() << "XMD5 " << path << bfin) != 250)
+            return false;
+    }
+    else
+        return false;
+
+    for (; word > 0; word--)
+    {
+        reply += strcspn(reply, " ");
+        reply += strspn(reply, " ");
+    }
+    hex.assign(reply, strcspn(reply, " \r\n"));
+    if (hex.compare(0, 2, "0x") == 0 || hex.compare(0, 2, "0X") == 0)
+        hex.erase(0, 2);
+    for (char& c : hex)
+        c = (char)toupper((unsigned char)c);
+    return !hex.empty();
+}
+
+// Function to compare the digest computed during a transfer with the server's
+bool FTPClient::check_digest(const char* path, const Digest& digest)
+{
+    std::string local = digest.hex();
+    std::string remote;
+    if (!remote_digest(path, digest.get_algorithm(), remote))
+    {
+        if (!quiet)
+            printf("%s %s (the server cannot compute it, not checked)\n", hash_name(digest.get_algorithm()), local.c_str());
+        return false;
+    }
+
+    // CRCs may come without their leading zeros
+    if (remote.size() < local.size())
+        remote.insert(0, local.size() - remote.size(), '0');
+    if (remote != local)
+        throw std::runtime_error(bout() << hash_name(digest.get_algorithm()) << " mismatch for " << path << ": local " << local.c_str() << ", server " << remote.c_str() << bfin);
+
+    if (!quiet)
+        printf("%s %s verified\n", hash_name(digest.get_algorithm()), local.c_str());
+    return true;
+}
+
+// Function to query the size of a remote file, returns -1 if the server does not support SIZE
+long long FTPClient::size(const char* path)
+{
+    if (send_command_wrapper(bout() << "SIZE " << path << bfin) != 213)
+        return -1;
+    return parse_size_reply(line_buffer);
+}
+
+// Function to probe SIZE and MDTM of many files with pipelined commands
+std::vector<RemoteStat> FTPClient::stat_many(const std::vector<std::string>& paths)
+{
+    finish_speculative_pasv();
+
+    std::vector<RemoteStat> stats(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        RemoteStat& stat = stats[i];
+        telnet_client->queue_command(bout() << "SIZE " << paths[i].c_str() << bfin, [&stat](int code, const char* line)
+        {
+            if (code == 213)
+                stat.size = parse_size_reply(line);
+        });
+        telnet_client->queue_command(bout() << "MDTM " << paths[i].c_str() << bfin, [&stat](int code, const char* line)
+        {
+            // "213 YYYYMMDDHHMMSS", error replies (550 for directories, 502 when unsupported) leave it empty
+            if (code == 213)
+                stat.modified.assign(line + 4, strcspn(line + 4, "\r\n"));
+        });
+    }
+
+    // Hundreds of reply lines are not worth echoing one by one
+    bool was_quiet = quiet;
+    quiet = true;
+    try
+    {
+        telnet_client->flush_pipeline();
+    }
+    catch (...)
+    {
+        quiet = was_quiet;
+        throw;
+    }
+    quiet = was_quiet;
+
+    return stats;
+}
+
+// Function to set the restart offset of the next transfer
+bool FTPClient::rest(long long offset)
+{
+    return send_command_wrapper(bout() << "REST " << offset << bfin) == 350;
+}
+
+// Function to ask for the bytes of a file from offset on, over a new data connection
+void FTPClient::start_range(const char* path, long long offset)
+{
+    pasv();
+
+    if (!rest(offset))
+    {
+        data_port.close();
+        throw std::runtime_error("Server rejected REST");
+    }
+
+    if (!is_transfer_started(send_command_wrapper(bout() << "RETR " << path << bfin)))
     {
-        constexpr int maxStrLen = 4 * 6;
-        int i = 0, k = 0;
+        data_port.close();
+        throw std::runtime_error("Failed");
+    }
+}
+
+// Function to receive the data connections of several ranges, writing each chunk at its final position
+void FTPClient::recv_ranges(std::vector<RangeDownload>& ranges, VirtualFS::PositionalWriter& writer)
+{
+    TraceSpan span("segment data");
+    std::vector<std::vector<char>> buffers(ranges.size(), std::vector<char>(DATA_BUFF_SIZE));
 
-        // Parse the address string
-        for (; buff[k] != ')' && k < maxStrLen; k++)
+    // Receives what has arrived for one range, false once the range is complete, closed or failed
+    auto receive = [&ranges, &buffers, &writer](size_t i, bool blocking)
+    {
+        RangeDownload& range = ranges[i];
+        long long left = range.length - range.received;
+        size_t want = left < (long long)buffers[i].size() ? (size_t)left : buffers[i].size();
+
+        TCP& data_port = range.session->data_port;
+        TCPResult result = blocking ? data_port.recv(buffers[i].data(), want) : data_port.recv_some(buffers[i].data(), want);
+        if (result.is_would_block())
+            return true;
+        if (!result.ok)
+            throw tcp_exception(result.get_error_message());
+        // Closed early: finish_range reports the missing bytes
+        if (result.bytes_count == 0)
+            return false;
+
+        writer.write_at(range.offset + range.received, buffers[i].data(), result.bytes_count);
+        if (range.digest != nullptr)
+            range.digest->update(buffers[i].data(), result.bytes_count);
+        range.received += result.bytes_count;
+        return range.received < range.length;
+    };
+
+#ifdef __linux__
+    // One chunk per wake-up and connection, so a fast segment cannot starve the others
+    EventLoop loop;
+    std::function<void(size_t)> arm = [&](size_t i)
+    {
+        TCP& data_port = ranges[i].session->data_port;
+        loop.watch(data_port, EventLoop::READABLE, EventLoop::Clock::now() + std::chrono::seconds(SEGMENT_IDLE_SECONDS), [&, i](int events)
         {
-            if ('0' <= buff[k] && buff[k] <= '9')
+            try
             {
-                a[i] = a[i] * 10 + (buff[k] - '0');
-                continue;
+                if (events == 0)
+                    throw tcp_exception(TCPResult::timed_out().get_error_message());
+                if (receive(i, false))
+                    arm(i);
             }
-            if (buff[k] == ',')
+            catch (...)
             {
-                if (i >= 6)
-                    throw std::exception("Failed to parse PASV address: too many numbers");
-                i++;
+                ranges[i].error = std::current_exception();
+            }
+        });
+    };
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        if (ranges[i].length > 0)
+            arm(i);
+    }
+    loop.run();
+#else
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        workers.emplace_back([&ranges, &receive, i]()
+        {
+            try
+            {
+                while (ranges[i].received < ranges[i].length && receive(i, true))
+                    ;
+            }
+            catch (...)
+            {
+                ranges[i].error = std::current_exception();
+            }
+        });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+#endif
+}
+
+// Function to end the transfer of a range once its bytes are in
+void FTPClient::finish_range(const RangeDownload& range)
+{
+    // Closing early aborts the rest of the file: the server answers 226 or 426/451, both are fine here
+    data_port.close();
+    telnet_client->recv_response();
+
+    if (range.received != range.length)
+        throw std::runtime_error(bout() << "Segment at offset " << range.offset << " incomplete" << bfin);
+}
+
+// Function to download a file over several parallel sessions, each fetching its own byte range
+unsigned long long FTPClient::retr_segmented(const char* path)
+{
+    Metrics::Clock::time_point started = Metrics::Clock::now();
+    long long total = -1;
+
+    // Byte offsets only make sense in binary mode: an ASCII download keeps the user's mode and a single stream;
+    // so does a recorded session, whose segments would run on unrecorded sessions
+    if (segments > 1 && !ascii && recorder == nullptr)
+        total = size(path);
+
+    // Fall back to a single stream for small files or when the server cannot restart transfers
+    if (total < 2 * MIN_SEGMENT_SIZE || !rest(0))
+    {
+        prepare_data_port();
+        return retr(path);
+    }
+
+    int count = segments;
+    if (total / MIN_SEGMENT_SIZE < count)
+        count = (int)(total / MIN_SEGMENT_SIZE);
+
+    // Filled as "<path>.part" and renamed onto the file only once every segment arrived (and its digest matched)
+    VirtualFS::PositionalWriter writer = filesystem->open_positional_writer(path, total);
+
+    std::vector<RangeDownload> ranges(count);
+    long long segment_size = total / count;
+
+    // Segments arrive out of order: their CRCs are computed separately and combined, hashes read the file afterwards
+    std::vector<std::unique_ptr<Digest>> digests(count);
+    for (int i = 0; i < count; i++)
+    {
+        if (Digest::is_combinable(verify))
+            digests[i] = Digest::create(verify);
+        ranges[i].offset = i * segment_size;
+        ranges[i].length = i == count - 1 ? total - ranges[i].offset : segment_size;
+        ranges[i].digest = digests[i].get();
+    }
+
+    // Each segment logs in and asks for its range on its own control session, all of them at once
+    std::vector<std::thread> workers;
+    for (int i = 0; i < count; i++)
+    {
+        workers.emplace_back([this, path, i, &ranges]()
+        {
+            try
+            {
+                ranges[i].session = open_session();
+                ranges[i].session->start_range(path, ranges[i].offset);
+            }
+            catch (...)
+            {
+                ranges[i].error = std::current_exception();
+            }
+        });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    std::exception_ptr error;
+    for (const RangeDownload& range : ranges)
+    {
+        if (range.error && !error)
+            error = range.error;
+    }
+
+    if (!error)
+        recv_ranges(ranges, writer);
+
+    // A session that failed anywhere is dropped, the others end their transfer and log out
+    for (RangeDownload& range : ranges)
+    {
+        if (range.session == nullptr)
+            continue;
+
+        if (!range.error && !error)
+        {
+            try
+            {
+                range.session->finish_range(range);
+                close_session(range.session);
                 continue;
             }
-            throw std::exception(bout() << "Failed to parse PASV address: invalid character '0x" << bhex << buff[i] << "'" << bfin);
+            catch (...)
+            {
+                range.error = std::current_exception();
+            }
+        }
+        if (range.error && !error)
+            error = range.error;
+        delete range.session;
+    }
+
+    if (error)
+    {
+        writer.discard();
+        std::rethrow_exception(error);
+    }
+
+    try
+    {
+        if (verify != HashAlgorithm::NONE)
+        {
+            std::unique_ptr<Digest> digest = std::move(digests[0]);
+            if (digest)
+            {
+                for (int i = 1; i < count; i++)
+                    digest->append(*digests[i], ranges[i].length);
+            }
+            else
+            {
+                digest = Digest::create(verify);
+                std::vector<char> tmp_buffer(DATA_BUFF_SIZE);
+                size_t count_read;
+                for (long long offset = 0; (count_read = writer.read_at(offset, tmp_buffer.data(), tmp_buffer.size())) > 0; offset += count_read)
+                    digest->update(tmp_buffer.data(), count_read);
+            }
+            check_digest(path, *digest);
         }
+        writer.close();
+    }
+    catch (const std::exception&)
+    {
+        writer.discard();
+        Metrics::instance().record_failed_transfer();
+        throw;
+    }
+
+    Metrics::instance().record_transfer(false, total, Metrics::elapsed_us(started));
+    printf("Downloaded %lld bytes in %i segments.\n", total, count);
+    return total;
+}
+
+// Function to open another quiet, logged-in session to the same server, in the transfer mode of this one
+FTPClient* FTPClient::open_session() const
+{
+    if (user.empty())
+        throw std::runtime_error("Not logged in");
+
+    FTPClient* session = new FTPClient(host.c_str(), port);
+    try
+    {
+        session->quiet = true;
+        session->speculative = speculative;
+        session->listing_cache = listing_cache;
+        session->set_engine(engine->get_name());
+        session->verify = verify;
+        session->login(user.c_str(), pass.c_str());
 
-        // Ensure the correct number of values were parsed
-        if (buff[k] != ')')
-            throw std::exception("Failed to parse PASV address: input too long");
+        // mget/mput/mirror move files in the mode the user chose, as get/put do (segments only run in binary mode)
+        if (ascii)
+            session->mode_ascii();
         else
+            session->mode_binary();
+    }
+    catch (...)
+    {
+        delete session;
+        throw;
+    }
+    return session;
+}
+
+// Function to log out (best effort) and delete a session created by open_session
+void FTPClient::close_session(FTPClient* session)
+{
+    try { session->logout(); }
+    catch (const std::exception&) {}
+    delete session;
+}
+
+// Function to select the engine moving data connection bytes ("plain" or "uring")
+void FTPClient::set_engine(const char* name)
+{
+    // Other engines move the bytes with the socket handle, past the recording transport
+    if (recorder != nullptr && strcmp(name, "plain") != 0)
+        throw std::runtime_error("A recorded session can only use the plain engine");
+
+    DataEngine* selected = DataEngine::create(name);
+    delete engine;
+    engine = selected;
+}
+
+// Function to get the name of the engine in use
+const char* FTPClient::get_engine_name() const
+{
+    return engine->get_name();
+}
+
+// Function to list the names in a remote directory (NLST), one entry per line
+std::vector<std::string> FTPClient::nlst(const char* path)
+{
+    prepare_data_port();
+
+    int resp = path == nullptr ? send_command_wrapper("NLST") : send_command_wrapper(bout() << "NLST " << path << bfin);
+    if (!is_transfer_started(resp))
+    {
+        data_port.close();
+        throw std::runtime_error("Failed");
+    }
+
+    std::vector<char> tmp_buffer(DATA_BUFF_SIZE);
+    std::vector<std::string> names;
+    std::string pending;
+    TCPResult result{};
+
+    // Split the listing into lines as it arrives, a name may span two chunks
+    while ((result = data_port.recv(tmp_buffer.data(), tmp_buffer.size())).ok && result.bytes_count > 0)
+    {
+        pending.append(tmp_buffer.data(), result.bytes_count);
+
+        size_t start = 0, lf;
+        while ((lf = pending.find('\n', start)) != std::string::npos)
+        {
+            size_t end = lf > start && pending[lf - 1] == '\r' ? lf - 1 : lf;
+            if (end > start)
+                names.emplace_back(pending, start, end - start);
+            start = lf + 1;
+        }
+        pending.erase(0, start);
+    }
+
+    // A listing cut by an error or a timeout is not returned as complete
+    if (!result.ok)
+    {
+        // Closing the data connection ends the transfer on the server too, consume its reply
+        data_port.close();
+        telnet_client->recv_response();
+        throw tcp_exception(result.get_error_message());
+    }
+
+    if (!pending.empty())
+        names.push_back(pending);
+
+    data_port.close();
+
+    if (telnet_client->recv_response() != 226)
+        throw std::runtime_error("Failed transfer");
+
+    start_speculative_pasv();
+    return names;
+}
+
+// Function to set how many sessions mget/mput may use
+void FTPClient::set_pool_size(int count)
+{
+    if (count < 1 || count > MAX_POOL_SIZE)
+        throw std::runtime_error(bout() << "Pool size must be between 1 and " << MAX_POOL_SIZE << bfin);
+    pool_size = count;
+}
+
+// Function to get the configured mget/mput pool size
+int FTPClient::get_pool_size() const { return pool_size; }
+
+// Function to set how many parallel segments retr_segmented may use
+void FTPClient::set_segments(int count)
+{
+    if (count < 1 || count > MAX_SEGMENTS)
+        throw std::runtime_error(bout() << "Segment count must be between 1 and " << MAX_SEGMENTS << bfin);
+    segments = count;
+}
+
+// Function to get the configured segment count
+int FTPClient::get_segments() const { return segments; }
+
+// Function to parse the address of a PASV reply (the text after the opening parenthesis)
+void FTPClient::parse_pasv_addr(const char* buff, int a[6])
+{
+    constexpr int maxStrLen = 4 * 6;
+    int i = 0, k = 0;
+
+    // Parse the address string
+    for (; buff[k] != ')' && k < maxStrLen; k++)
+    {
+        if ('0' <= buff[k] && buff[k] <= '9')
+        {
+            a[i] = a[i] * 10 + (buff[k] - '0');
+            continue;
+        }
+        if (buff[k] == ',')
         {
             if (i >= 6)
-                throw std::exception("Failed to parse PASV address: too many numbers");
+                throw std::runtime_error("Failed to parse PASV address: too many numbers");
             i++;
+            continue;
         }
+        throw std::runtime_error(bout() << "Failed to parse PASV address: invalid character '0x" << bhex << buff[i] << "'" << bfin);
+    }
 
-        if (i < 6)
-            throw std::exception("Failed to parse PASV address: insufficient numbers");
+    // Ensure the correct number of values were parsed
+    if (buff[k] != ')')
+        throw std::runtime_error("Failed to parse PASV address: input too long");
+    else
+    {
+        if (i >= 6)
+            throw std::runtime_error("Failed to parse PASV address: too many numbers");
+        i++;
     }
+
+    if (i < 6)
+        throw std::runtime_error("Failed to parse PASV address: insufficient numbers");
 }
 
 // Function to enter passive mode for data transfer
 void FTPClient::pasv()
 {
+    // A new PASV replaces any data connection opened before
+    finish_speculative_pasv();
+    data_port.close();
+    open_data_port();
+}
+
+// Function to send PASV and connect to the announced address
+void FTPClient::open_data_port()
+{
+    TraceSpan span(speculating ? "pasv (speculative)" : "pasv");
+
     // Send PASV command and check for 227 response
-    if (send_command_wrapper("PASV") != 227)
-        throw std::exception("Entering passive mode failed");
+    if (issue_command("PASV") != 227)
+        throw std::runtime_error("Entering passive mode failed");
 
     // Extract the passive mode address from the response
     const char* line_pfx = "227 Entering Passive Mode (";
     if (strncmp(line_pfx, line_buffer, strlen(line_pfx)) != 0)
-        throw std::exception("Invalid passive response message");
+        throw std::runtime_error("Invalid passive response message");
     char* buff = line_buffer + strlen(line_pfx);
 
     int a[6]{};
     parse_pasv_addr(buff, a);
 
     // Build the IP address and port from the parsed data
-    const char* ip = bout() << a[0] << "." << a[1] << "." << a[2] << "." << a[3] << bfin;
+    bout ip_text;
+    const char* ip = ip_text << a[0] << "." << a[1] << "." << a[2] << "." << a[3] << bfin;
     int port = a[4] * 256 + a[5];
 
     // Connect to the data port
+    Metrics::Clock::time_point connect_started = Metrics::Clock::now();
     data_port.connect(ip, port);
-    printf("Opened data port on %s:%i.\n", (const char*)ip, port);
+    data_port_opened_at = std::chrono::steady_clock::now();
+    Metrics::instance().record_data_connect(Metrics::elapsed_us(connect_started));
+    if (!speculating && !quiet)
+        printf("Opened data port on %s:%i.\n", (const char*)ip, port);
+}
+
+// Function to get the data connection for the next transfer
+void FTPClient::prepare_data_port()
+{
+    finish_speculative_pasv();
+
+    // Servers drop idle data connections, so only a recent one that the server has not closed is reused
+    bool recent = std::chrono::steady_clock::now() - data_port_opened_at < std::chrono::seconds(SPECULATIVE_IDLE_SECONDS);
+    if (speculative && recent && data_port.is_idle())
+        return;
+
+    pasv();
+}
+
+// Function to issue the PASV for the next transfer in the background (speculative mode only)
+void FTPClient::start_speculative_pasv()
+{
+    if (!speculative || !connected || speculative_pasv.valid())
+        return;
+
+    speculating = true;
+    speculative_pasv = std::async(std::launch::async, [this]() { open_data_port(); });
+}
+
+// Function to wait for a background PASV; on failure the data port stays closed and the next transfer sends its own PASV
+void FTPClient::finish_speculative_pasv()
+{
+    if (!speculative_pasv.valid())
+        return;
+
+    try
+    {
+        speculative_pasv.get();
+    }
+    catch (const std::exception&)
+    {
+        data_port.close();
+    }
+    speculating = false;
+}
+
+// Function to enable or disable the background PASV after each transfer
+void FTPClient::set_speculative(bool enabled)
+{
+    finish_speculative_pasv();
+    speculative = enabled;
+    if (!speculative)
+        data_port.close();
+}
+
+// Function to check whether speculative PASV is enabled
+bool FTPClient::get_speculative() const
+{
+    return speculative;
 }
 
 // Destructor to clean up resources
 FTPClient::~FTPClient()
 {
+    // A background PASV still uses the control connection
+    if (speculative_pasv.valid())
+        speculative_pasv.wait();
+
     delete telnet_client;  // Delete the TelNet client
     delete filesystem;     // Delete the virtual file system
+    delete engine;         // Delete the data engine
 }
@@ -1,6 +1,17 @@
 #include "FTPCommandInterpreter.h"
 
 #include <functional>
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include "TransferScheduler.h"
+#include "Mirror.h"
+#include "TreeWalker.h"
+#include "FileIndex.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "utils.h"
 
 // Macro to bind commands to specific FTP methods via lambda functions.
 #define LAMBDA(ci, ftp, fname) ((std::function<void(const Parameter*)>)std::bind(fname, ci, ftp, std::placeholders::_1))
@@ -31,17 +42,40 @@ namespace
 	void cmd_list1(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
 	{
 		const char* path = pms[0].get_value_str();  // Get the path parameter
-		ftp->pasv();  // Enable passive mode for FTP
 		ftp->list(path);  // List files in the specified path
 	}
 
+	// Command implementation for 'list <path> fresh' command: lists from the server even when the listing is cached
+	void cmd_list_fresh(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		const char* path = pms[0].get_value_str();  // Get the path parameter
+		ftp->list(path, true);  // List and refresh the cached copy
+	}
+
 	// Command implementation for 'list0' command: lists files with no specific path (default)
 	void cmd_list0(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
 	{
-		ftp->pasv();  // Enable passive mode for FTP
 		ftp->list(nullptr);  // List files in the current directory
 	}
 
+	// Command implementation for 'list' command with a pattern: prints the matching entries while the listing arrives
+	void cmd_list_glob(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		const char* path = pms[0].get_value_str();  // Get the path parameter
+		std::string pattern = pms[1].get_value_str();  // Get the name pattern ('*' and '?')
+		unsigned long long matched = 0;
+		unsigned long long entries = ftp->list_stream(path, [&](const ListingEntry& entry)
+		{
+			if (Utils::glob_match(pattern, entry.name))
+			{
+				entry.print(std::cout);
+				matched++;
+			}
+			return true;
+		});
+		printf("%llu of %llu entries match.\n", matched, entries);
+	}
+
 	// Command implementation for 'pasv' command: enables passive mode for FTP
 	void cmd_pasv(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
 	{
@@ -52,7 +86,7 @@ namespace
 	void cmd_put(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
 	{
 		const char* path = pms[0].get_value_str();  // Get the path parameter (file to upload)
-		ftp->pasv();  // Enable passive mode for FTP
+		ftp->prepare_data_port();  // Passive data connection (reused when opened speculatively)
 		ftp->stor(path);  // Upload the specified file
 	}
 
@@ -60,10 +94,257 @@ namespace
 	void cmd_retr(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
 	{
 		const char* path = pms[0].get_value_str();  // Get the path parameter (file to download)
-		ftp->pasv();  // Enable passive mode for FTP
+		if (ftp->get_segments() > 1)
+		{
+			ftp->retr_segmented(path);  // Download over parallel sessions (falls back to a single stream)
+			return;
+		}
+		ftp->prepare_data_port();  // Passive data connection (reused when opened speculatively)
 		ftp->retr(path);  // Download the specified file
 	}
 
+	// Command implementation for 'segments' command: sets how many parallel sessions 'get' may use
+	void cmd_segments(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		ftp->set_segments(pms[0].get_value_int());  // 1 disables segmented downloads
+	}
+
+	// Helper function to run a batch of transfers on the session pool and print the summary
+	void run_batch(FTPClient* ftp, const std::vector<TransferJob>& jobs)
+	{
+		TransferScheduler scheduler(ftp, ftp->get_pool_size());
+		TransferReport report = scheduler.run(jobs);
+		report.print(std::cout);
+	}
+
+	// Command implementation for 'mget' command: downloads every file of a remote directory in parallel
+	void cmd_mget(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		std::string dir = pms[0].get_value_str();  // Get the remote directory
+		std::vector<TransferJob> jobs;
+		for (const auto& name : ftp->nlst(dir.c_str()))
+		{
+			// Some servers answer NLST with bare names, others with the directory prefix
+			std::string path = name.find('/') == std::string::npos ? dir + "/" + name : name;
+			jobs.push_back(TransferJob{ path, false });
+		}
+		run_batch(ftp, jobs);
+	}
+
+	// Command implementation for 'stat' command: size and modification time of every file in a remote directory
+	void cmd_stat(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		std::string dir = pms[0].get_value_str();  // Get the remote directory
+		std::vector<std::string> paths;
+		for (const auto& name : ftp->nlst(dir.c_str()))
+			paths.push_back(name.find('/') == std::string::npos ? dir + "/" + name : name);
+
+		std::vector<RemoteStat> stats = ftp->stat_many(paths);  // SIZE + MDTM for all files, pipelined
+		for (size_t i = 0; i < paths.size(); i++)
+			printf("%14lld  %-18s %s\n", stats[i].size, stats[i].modified.empty() ? "-" : stats[i].modified.c_str(), paths[i].c_str());
+	}
+
+	// Command implementation for 'mput' command: uploads every file of a local directory in parallel
+	void cmd_mput(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		const char* dir = pms[0].get_value_str();  // Get the local directory (inside vfs_root)
+		std::vector<TransferJob> jobs;
+		for (const auto& path : ftp->get_filesystem()->list_files(dir))
+			jobs.push_back(TransferJob{ path, true });
+		run_batch(ftp, jobs);
+	}
+
+	// Helper function to print every entry under a remote directory, walked on the session pool
+	void run_walk(FTPClient* ftp, const char* path, bool ordered)
+	{
+		TreeWalker walker(ftp, ftp->get_pool_size());
+		walker.set_ordered(ordered);
+		TreeWalkReport report = walker.walk(path, [](const std::string& directory, const ListingEntry& entry)
+		{
+			// The entry is printed under its path relative to the walked directory
+			std::string name = directory.empty() ? std::string(entry.name) : directory + "/" + std::string(entry.name);
+			ListingEntry named = entry;
+			named.name = name;
+			named.print(std::cout);
+			return true;
+		});
+		report.print(std::cout);
+	}
+
+	// Command implementation for 'walk' command: lists a remote tree, entries in the order they arrive
+	void cmd_walk(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		run_walk(ftp, pms[0].get_value_str(), false);
+	}
+
+	// Command implementation for 'walk <path> ordered' command: lists a remote tree breadth-first, in a fixed order
+	void cmd_walk_ordered(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		run_walk(ftp, pms[0].get_value_str(), true);
+	}
+
+	// Helper function to plan a mirror, print the plan and carry it out
+	void run_mirror(FTPClient* ftp, const char* path, bool upload, bool delete_extra)
+	{
+		Mirror mirror(ftp, upload, delete_extra);
+		MirrorPlan plan = mirror.plan(path);
+		plan.print(std::cout);
+
+		TransferReport report = mirror.run(plan);
+		report.print(std::cout);
+	}
+
+	// Command implementation for 'mirror' command: brings a local directory up to date with the remote one
+	void cmd_mirror(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		run_mirror(ftp, pms[0].get_value_str(), false, false);
+	}
+
+	// Command implementation for 'mirror <path> delete' command: also deletes local files the server no longer has
+	void cmd_mirror_delete(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		run_mirror(ftp, pms[0].get_value_str(), false, true);
+	}
+
+	// Command implementation for 'reverse-mirror' command: brings a remote directory up to date with the local one
+	void cmd_reverse_mirror(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		run_mirror(ftp, pms[0].get_value_str(), true, false);
+	}
+
+	// Command implementation for 'reverse-mirror <path> delete' command: also deletes remote files missing locally
+	void cmd_reverse_mirror_delete(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		run_mirror(ftp, pms[0].get_value_str(), true, true);
+	}
+
+	// Command implementation for 'pool' command: sets how many sessions mget/mput use
+	void cmd_pool(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		ftp->set_pool_size(pms[0].get_value_int());
+	}
+
+	// Command implementation for 'speculative' command: 1 opens the next data connection in the background after each transfer
+	void cmd_speculative(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		ftp->set_speculative(pms[0].get_value_int() != 0);
+	}
+
+	// Command implementation for 'engine' command: selects how data connection bytes are moved
+	void cmd_engine(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		ftp->set_engine(pms[0].get_value_str());
+		printf("Data engine: %s\n", ftp->get_engine_name());
+	}
+
+	// Command implementation for 'verify' command: selects the checksum or hash compared with the server after each transfer
+	void cmd_verify(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		HashAlgorithm algorithm;
+		if (!parse_hash_algorithm(pms[0].get_value_str(), algorithm))
+			throw std::runtime_error("Unknown algorithm (expected off, crc32, crc32c, md5 or sha256)");
+		ftp->set_verify(algorithm);
+		printf("Verify: %s%s\n", hash_name(algorithm),
+			algorithm == HashAlgorithm::CRC32C ? (Crc32c::has_hardware() ? " (SSE 4.2)" : " (tables)") : "");
+	}
+
+	// Command implementation for 'stats' command: prints the transfer metrics collected so far
+	void cmd_stats(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		Metrics::instance().print(std::cout);
+	}
+
+	// Command implementation for 'stats <file>' command: dumps the metrics as JSON (.json) or Prometheus text
+	void cmd_stats_dump(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		std::string path = pms[0].get_value_str();
+		std::ofstream file(path);
+		if (!file)
+			throw std::runtime_error("Cannot write " + path);
+
+		bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+		if (json)
+			Metrics::instance().write_json(file);
+		else
+			Metrics::instance().write_prometheus(file);
+		printf("Metrics written to %s.\n", path.c_str());
+	}
+
+	// Command implementation for 'stats reset' command
+	void cmd_stats_reset(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		Metrics::instance().reset();
+	}
+
+	// Command implementation for 'stats on' / 'stats off' commands
+	void cmd_stats_on(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms) { Metrics::instance().enabled = true; }
+	void cmd_stats_off(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms) { Metrics::instance().enabled = false; }
+
+	// Command implementation for 'trace on' / 'trace off' commands: start (dropping older events) or stop tracing
+	void cmd_trace_on(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms) { Trace::start(); }
+	void cmd_trace_off(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms) { Trace::stop(); }
+
+	// Command implementation for 'trace <file>' command: writes the recorded timeline as Chrome trace JSON
+	void cmd_trace_dump(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		std::string path = pms[0].get_value_str();
+		std::ofstream file(path);
+		if (!file)
+			throw std::runtime_error("Cannot write " + path);
+
+		Trace::write_json(file);
+		printf("Trace written to %s.\n", path.c_str());
+	}
+
+	// Command implementation for 'delete' command: deletes a remote file
+	void cmd_delete(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		ftp->remove(pms[0].get_value_str());
+	}
+
+	// Command implementation for 'rename' command: renames (or moves) a remote file or directory
+	void cmd_rename(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		ftp->rename(pms[0].get_value_str(), pms[1].get_value_str());
+	}
+
+	// Command implementation for 'cache' command: shows the state of the listing cache
+	void cmd_cache(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		const ListingCache& cache = ftp->get_listing_cache();
+		printf("Listing cache: ttl %i s, %zu directories, %llu hits, %llu misses, %llu invalidations.\n", cache.get_ttl(),
+			cache.size(), cache.get_hits(), cache.get_misses(), cache.get_invalidations());
+	}
+
+	// Command implementation for 'cache ttl <seconds>' command: 0 disables the listing cache
+	void cmd_cache_ttl(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		ftp->get_listing_cache().set_ttl(pms[0].get_value_int());
+	}
+
+	// Command implementation for 'cache clear' command: the next listings go to the server
+	void cmd_cache_clear(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		ftp->get_listing_cache().clear();
+	}
+
+	// Command implementation for 'index' command: shows the state of the local file index
+	void cmd_index(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		const FileIndex& index = ftp->get_filesystem()->get_index();
+		printf("Local index %s: %zu files, %zu with a CRC, %llu CRCs computed by reading files.\n", index.get_file().string().c_str(),
+			index.size(), index.count_with_crc(), index.get_crcs_computed());
+	}
+
+	// Command implementation for 'index check' command: compares the local index with the disk again and saves it
+	void cmd_index_check(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
+	{
+		FileIndex& index = ftp->get_filesystem()->get_index();
+		index.revalidate();
+		index.save();
+		cmd_index(ci, ftp, pms);
+	}
+
 	// Command implementation for 'binary' command: sets the FTP mode to binary
 	void cmd_binary(CommandInterpreter* ci, FTPClient* ftp, const Parameter* pms)
 	{
@@ -89,12 +370,60 @@ FTPCommandInterpreter::FTPCommandInterpreter(FTPClient* ftp) : ftp{ ftp }
 	register_command(LAMBDA(this, ftp, cmd_logout), "logout");
 	// Register 'list' command with a specific path parameter
 	register_command(LAMBDA(this, ftp, cmd_list1), "list", Param(0, "path", ParameterType::PATH));
+	// Register 'list <path> fresh' command, ahead of the pattern form so 'fresh' is not taken for a pattern
+	register_command(LAMBDA(this, ftp, cmd_list_fresh), "list", Param(0, "path", ParameterType::PATH), "fresh");
+	// Register 'list' command with a path and a name pattern
+	register_command(LAMBDA(this, ftp, cmd_list_glob), "list", Param(0, "path", ParameterType::PATH), Param(1, "pattern", ParameterType::STRING));
 	// Register 'list' command with no path (current directory)
 	register_command(LAMBDA(this, ftp, cmd_list0), "list");
 	// Register 'put' command for file upload with a path parameter
 	register_command(LAMBDA(this, ftp, cmd_put), "put", Param(0, "path", ParameterType::PATH));
 	// Register 'get' command for file download with a path parameter
 	register_command(LAMBDA(this, ftp, cmd_retr), "get", Param(0, "path", ParameterType::PATH));
+	// Register 'segments' command to configure segmented downloads
+	register_command(LAMBDA(this, ftp, cmd_segments), "segments", Param(0, "count", ParameterType::INTEGER));
+	// Register 'mget' command to download a remote directory on the session pool
+	register_command(LAMBDA(this, ftp, cmd_mget), "mget", Param(0, "path", ParameterType::PATH));
+	// Register 'mput' command to upload a local directory on the session pool
+	register_command(LAMBDA(this, ftp, cmd_mput), "mput", Param(0, "path", ParameterType::PATH));
+	// Register 'stat' command to probe sizes and modification times of a remote directory
+	register_command(LAMBDA(this, ftp, cmd_stat), "stat", Param(0, "path", ParameterType::PATH));
+	// Register 'walk' command to list a remote tree on the session pool
+	register_command(LAMBDA(this, ftp, cmd_walk), "walk", Param(0, "path", ParameterType::PATH));
+	register_command(LAMBDA(this, ftp, cmd_walk_ordered), "walk", Param(0, "path", ParameterType::PATH), "ordered");
+	// Register 'mirror' and 'reverse-mirror' commands to transfer only what changed, optionally deleting extra files
+	register_command(LAMBDA(this, ftp, cmd_mirror), "mirror", Param(0, "path", ParameterType::PATH));
+	register_command(LAMBDA(this, ftp, cmd_mirror_delete), "mirror", Param(0, "path", ParameterType::PATH), "delete");
+	register_command(LAMBDA(this, ftp, cmd_reverse_mirror), "reverse-mirror", Param(0, "path", ParameterType::PATH));
+	register_command(LAMBDA(this, ftp, cmd_reverse_mirror_delete), "reverse-mirror", Param(0, "path", ParameterType::PATH), "delete");
+	// Register 'pool' command to configure the number of mget/mput sessions
+	register_command(LAMBDA(this, ftp, cmd_pool), "pool", Param(0, "size", ParameterType::INTEGER));
+	// Register 'speculative' command to toggle the background PASV after transfers
+	register_command(LAMBDA(this, ftp, cmd_speculative), "speculative", Param(0, "enabled", ParameterType::INTEGER));
+	// Register 'engine' command to select the data transfer engine
+	register_command(LAMBDA(this, ftp, cmd_engine), "engine", Param(0, "name", ParameterType::STRING));
+	// Register 'verify' command to select the checksum compared with the server after each transfer
+	register_command(LAMBDA(this, ftp, cmd_verify), "verify", Param(0, "algorithm", ParameterType::STRING));
+	// Register 'stats' commands to show, dump, reset and toggle the transfer metrics
+	register_command(LAMBDA(this, ftp, cmd_stats), "stats");
+	register_command(LAMBDA(this, ftp, cmd_stats_reset), "stats", "reset");
+	register_command(LAMBDA(this, ftp, cmd_stats_on), "stats", "on");
+	register_command(LAMBDA(this, ftp, cmd_stats_off), "stats", "off");
+	register_command(LAMBDA(this, ftp, cmd_stats_dump), "stats", Param(0, "file", ParameterType::PATH));
+	// Register 'trace' commands to record a timeline and export it
+	register_command(LAMBDA(this, ftp, cmd_trace_on), "trace", "on");
+	register_command(LAMBDA(this, ftp, cmd_trace_off), "trace", "off");
+	register_command(LAMBDA(this, ftp, cmd_trace_dump), "trace", Param(0, "file", ParameterType::PATH));
+	// Register 'delete' and 'rename' commands to change remote files
+	register_command(LAMBDA(this, ftp, cmd_delete), "delete", Param(0, "path", ParameterType::PATH));
+	register_command(LAMBDA(this, ftp, cmd_rename), "rename", Param(0, "from", ParameterType::PATH), Param(1, "to", ParameterType::PATH));
+	// Register 'cache' commands to inspect and configure the listing cache
+	register_command(LAMBDA(this, ftp, cmd_cache), "cache");
+	register_command(LAMBDA(this, ftp, cmd_cache_ttl), "cache", "ttl", Param(0, "seconds", ParameterType::INTEGER));
+	register_command(LAMBDA(this, ftp, cmd_cache_clear), "cache", "clear");
+	// Register 'index' commands to inspect and revalidate the local file index
+	register_command(LAMBDA(this, ftp, cmd_index), "index");
+	register_command(LAMBDA(this, ftp, cmd_index_check), "index", "check");
 	// Register 'ascii' command to switch to ASCII mode
 	register_command(LAMBDA(this, ftp, cmd_ascii), "ascii");
 	// Register 'binary' command to switch to binary mode
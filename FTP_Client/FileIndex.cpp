@@ -0,0 +1,504 @@
+#include "FileIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "Checksum.h"
+#include "VirtualFS.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr size_t READ_BUFF_SIZE = 64 * 1024;
+
+    // Helper class mapping a whole file read-only, empty when the file cannot be mapped
+    class MappedFile
+    {
+    private:
+        const char* view = nullptr;
+        size_t length = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#endif
+    public:
+        MappedFile(const fs::path& path)
+        {
+#ifdef _WIN32
+            file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            LARGE_INTEGER size;
+            if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) || size.QuadPart == 0)
+                return;
+            mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping == nullptr)
+                return;
+            view = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            length = view != nullptr ? (size_t)size.QuadPart : 0;
+#else
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0)
+            {
+                void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped != MAP_FAILED)
+                {
+                    view = (const char*)mapped;
+                    length = (size_t)st.st_size;
+                }
+            }
+            ::close(fd);
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* data() const { return view; }
+        size_t size() const { return length; }
+
+        ~MappedFile()
+        {
+#ifdef _WIN32
+            if (view != nullptr)
+                UnmapViewOfFile(view);
+            if (mapping != nullptr)
+                CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE)
+                CloseHandle(file);
+#else
+            if (view != nullptr)
+                munmap((void*)view, length);
+#endif
+        }
+    };
+}
+
+// Constructor for FileIndex, the index of "vfs_root" lives in "vfs_root.index" next to it
+FileIndex::FileIndex(fs::path root) : root{ root }
+{
+    fs::path normalized = root.lexically_normal();
+    if (!normalized.has_filename())
+        normalized = normalized.parent_path();
+    file = normalized;
+    file += ".index";
+}
+
+// Opens the index of a root once per process: the VirtualFS of every session shares it
+std::shared_ptr<FileIndex> FileIndex::open(const fs::path& root)
+{
+    static std::mutex registry_mutex;
+    static std::map<std::string, std::weak_ptr<FileIndex>> registry;
+
+    std::error_code ec;
+    std::string key = fs::absolute(root, ec).lexically_normal().generic_string();
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::shared_ptr<FileIndex> index = registry[key].lock();
+    if (index != nullptr)
+        return index;
+
+    index = std::shared_ptr<FileIndex>(new FileIndex(root));
+    index->load();
+    index->revalidate();
+    index->save();
+    registry[key] = index;
+    return index;
+}
+
+// Path of a record, a view into the names
+std::string_view FileIndex::name_of(const Record& record) const
+{
+    return std::string_view(names.data() + record.name_offset, record.name_length);
+}
+
+// Binary search of the sorted records
+FileIndex::Record* FileIndex::find_record(std::string_view key)
+{
+    auto it = std::lower_bound(records.begin(), records.end(), key, [this](const Record& record, std::string_view value)
+    {
+        return name_of(record) < value;
+    });
+    if (it == records.end() || name_of(*it) != key)
+        return nullptr;
+    return &*it;
+}
+
+// Entry of a path in the records or among the files added since, nullptr if it is not indexed
+const FileIndex::Record* FileIndex::find_any(const std::string& key) const
+{
+    const Record* record = const_cast<FileIndex*>(this)->find_record(key);
+    if (record != nullptr)
+        return (record->flags & REMOVED) != 0 ? nullptr : record;
+
+    auto it = added.find(key);
+    return it == added.end() ? nullptr : &it->second;
+}
+
+// Records the state of a file, in place when it already has a record
+void FileIndex::store(const std::string& key, const Record& record)
+{
+    Record* existing = find_record(key);
+    if (existing != nullptr)
+    {
+        uint32_t name_offset = existing->name_offset;
+        uint32_t name_length = existing->name_length;
+        *existing = record;
+        existing->name_offset = name_offset;
+        existing->name_length = name_length;
+    }
+    else
+        added[key] = record;
+    dirty = true;
+}
+
+// Replaces the records with a list of files, sorted here
+void FileIndex::rebuild(std::vector<std::pair<std::string, Record>>& files)
+{
+    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    size_t names_size = 0;
+    for (const auto& item : files)
+        names_size += item.first.size();
+    if (names_size > UINT32_MAX || files.size() > UINT32_MAX)
+        throw std::runtime_error("The local index is limited to 4 GB of paths");
+
+    std::vector<Record> new_records;
+    std::vector<char> new_names;
+    new_records.reserve(files.size());
+    new_names.reserve(names_size);
+    for (const auto& item : files)
+    {
+        Record record = item.second;
+        record.name_offset = (uint32_t)new_names.size();
+        record.name_length = (uint32_t)item.first.size();
+        record.flags &= HAS_CRC;
+        new_names.insert(new_names.end(), item.first.begin(), item.first.end());
+        new_records.push_back(record);
+    }
+
+    records.swap(new_records);
+    names.swap(new_names);
+    added.clear();
+}
+
+// Reads the index file through a mapping, false (and an empty index) when it is missing or malformed
+bool FileIndex::load()
+{
+    MappedFile mapped(file);
+    if (mapped.data() == nullptr || mapped.size() < sizeof(Header))
+        return false;
+
+    Header header;
+    memcpy(&header, mapped.data(), sizeof(Header));
+    if (memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0
+        || mapped.size() != sizeof(Header) + (unsigned long long)header.count * sizeof(Record) + header.names_size)
+        return false;
+
+    std::vector<Record> loaded(header.count);
+    memcpy(loaded.data(), mapped.data() + sizeof(Header), loaded.size() * sizeof(Record));
+    for (const Record& record : loaded)
+    {
+        if ((unsigned long long)record.name_offset + record.name_length > header.names_size)
+            return false;
+    }
+
+    const char* names_start = mapped.data() + sizeof(Header) + loaded.size() * sizeof(Record);
+    records.swap(loaded);
+    names.assign(names_start, names_start + header.names_size);
+    added.clear();
+    return true;
+}
+
+// Stat of a regular file, false for anything else
+bool FileIndex::stat_file(const fs::path& path, Record& record)
+{
+    record = Record{};
+#ifdef _WIN32
+    // GetFileAttributesEx needs no handle and keeps the 100 ns write time, _wstat64 only whole seconds
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+        return false;
+    record.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    long long ticks = (long long)(((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime);
+    record.mtime_ns = (ticks - 116444736000000000LL) * 100;  // FILETIME counts 100 ns ticks from 1601
+#else
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    record.size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+    record.mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    record.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    record.inode = (uint64_t)st.st_ino;
+#endif
+    return true;
+}
+
+// Whether two stats describe the same, unchanged file
+bool FileIndex::same_file(const Record& a, const Record& b)
+{
+    return a.size == b.size && a.mtime_ns == b.mtime_ns && a.inode == b.inode;
+}
+
+// Compares the whole tree with the index, keeping the CRCs of the files whose stat did not change
+void FileIndex::revalidate()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<std::pair<std::string, Record>> files;
+    files.reserve(records.size() + added.size());
+    size_t unchanged = 0;
+
+    std::error_code ec;
+    fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+    {
+        // Half-written downloads are not files of the tree
+        Record now;
+        if (VirtualFS::is_part_file(it->path()) || !stat_file(it->path(), now))
+            continue;
+
+        std::string key = it->path().lexically_relative(root).generic_string();
+        const Record* old = find_any(key);
+        if (old != nullptr && same_file(*old, now))
+        {
+            now.crc = old->crc;
+            now.flags = old->flags & HAS_CRC;
+            unchanged++;
+        }
+        files.emplace_back(std::move(key), now);
+    }
+
+    bool changed = unchanged != files.size() || files.size() != records.size() || !added.empty();
+    rebuild(files);
+    dirty = dirty || changed;
+}
+
+// Re-stats one file after the VirtualFS changed it
+void FileIndex::update(const std::string& path, bool times_only)
+{
+    Record now;
+    bool exists = stat_file(root / path, now);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const Record* old = find_any(path);
+    if (!exists)
+    {
+        if (old != nullptr)
+        {
+            Record* record = find_record(path);
+            if (record != nullptr)
+                record->flags |= REMOVED;
+            added.erase(path);
+            dirty = true;
+        }
+        return;
+    }
+
+    if (old != nullptr && same_file(*old, now))
+        return;
+    if (old != nullptr && times_only && old->size == now.size && old->inode == now.inode)
+    {
+        now.crc = old->crc;
+        now.flags = old->flags & HAS_CRC;
+    }
+    store(path, now);
+}
+
+// Drops a path and, when it is a directory, everything under it
+void FileIndex::remove(const std::string& path)
+{
+    std::string prefix = path + "/";
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Sorted by path, the entries under a directory follow each other
+    auto first = std::lower_bound(records.begin(), records.end(), std::string_view(path), [this](const Record& record, std::string_view value)
+    {
+        return name_of(record) < value;
+    });
+    for (auto it = first; it != records.end(); ++it)
+    {
+        std::string_view name = name_of(*it);
+        if (name != path && name.compare(0, prefix.size(), prefix) != 0)
+        {
+            if (name > std::string_view(prefix))
+                break;
+            continue;
+        }
+        it->flags |= REMOVED;
+        dirty = true;
+    }
+
+    for (auto it = added.lower_bound(path); it != added.end(); )
+    {
+        if (it->first != path && it->first.compare(0, prefix.size(), prefix) != 0)
+        {
+            if (it->first > prefix)
+                break;
+            ++it;
+            continue;
+        }
+        it = added.erase(it);
+        dirty = true;
+    }
+}
+
+// Looks a file up without touching the disk
+bool FileIndex::find(const std::string& path, Entry& entry) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const Record* record = find_any(path);
+    if (record == nullptr)
+        return false;
+
+    entry.size = record->size;
+    entry.mtime_ns = record->mtime_ns;
+    entry.inode = record->inode;
+    entry.has_crc = (record->flags & HAS_CRC) != 0;
+    entry.crc = record->crc;
+    return true;
+}
+
+// CRC32 of a file, read only when the index has none for its current stat
+uint32_t FileIndex::crc32(const std::string& path)
+{
+    Record before;
+    if (!stat_file(root / path, before))
+        throw std::runtime_error("File not found: " + (root / path).string());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const Record* record = find_any(path);
+        if (record != nullptr && same_file(*record, before) && (record->flags & HAS_CRC) != 0)
+            return record->crc;
+    }
+
+    std::ifstream in(root / path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Unable to open file: " + (root / path).string());
+
+    Crc32 crc;
+    std::unique_ptr<char[]> buffer(new char[READ_BUFF_SIZE]);
+    while (in)
+    {
+        in.read(buffer.get(), READ_BUFF_SIZE);
+        crc.update(buffer.get(), (size_t)in.gcount());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    crcs_computed++;
+
+    // A file that changed while it was read keeps no CRC, the next write or revalidation records its new stat
+    Record after;
+    if (stat_file(root / path, after) && same_file(before, after))
+    {
+        after.crc = crc.value();
+        after.flags = HAS_CRC;
+        store(path, after);
+    }
+    return crc.value();
+}
+
+// Writes the index if it changed
+void FileIndex::save()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    save_locked();
+}
+
+// Merges the records and the files added since into a new index file, replacing the old one in one rename
+void FileIndex::save_locked()
+{
+    if (!dirty)
+        return;
+
+    std::vector<std::pair<std::string, Record>> files;
+    files.reserve(records.size() + added.size());
+    for (const Record& record : records)
+    {
+        if ((record.flags & REMOVED) == 0)
+            files.emplace_back(std::string(name_of(record)), record);
+    }
+    for (const auto& item : added)
+        files.push_back(item);
+    rebuild(files);
+
+    Header header{};
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.count = (uint32_t)records.size();
+    header.names_size = names.size();
+
+    fs::path temporary = file;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)records.data(), (std::streamsize)(records.size() * sizeof(Record)));
+        out.write(names.data(), (std::streamsize)names.size());
+        if (!out)
+            throw std::runtime_error("Unable to write " + temporary.string());
+    }
+
+    std::error_code ec;
+    fs::rename(temporary, file, ec);
+    if (ec)
+        throw std::runtime_error("Unable to replace " + file.string());
+    dirty = false;
+}
+
+// Number of indexed files
+size_t FileIndex::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = added.size();
+    for (const Record& record : records)
+        count += (record.flags & REMOVED) == 0 ? 1 : 0;
+    return count;
+}
+
+// Number of indexed files whose CRC is known
+size_t FileIndex::count_with_crc() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = 0;
+    for (const Record& record : records)
+        count += (record.flags & (HAS_CRC | REMOVED)) == HAS_CRC ? 1 : 0;
+    for (const auto& item : added)
+        count += (item.second.flags & HAS_CRC) != 0 ? 1 : 0;
+    return count;
+}
+
+// CRCs computed by reading files
+unsigned long long FileIndex::get_crcs_computed() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return crcs_computed;
+}
+
+// Destructor saves the changes, an index that cannot be written is rebuilt by the next revalidation
+FileIndex::~FileIndex()
+{
+    try
+    {
+        save();
+    }
+    catch (const std::exception&)
+    {
+    }
+}
@@ -0,0 +1,166 @@
+#include "ListingCache.h"
+
+#include <vector>
+#include "Metrics.h"
+
+// Normalizes a remote path into a cache key
+std::string ListingCache::normalize(const char* path)
+{
+    if (path == nullptr)
+        return "";
+
+    bool absolute = path[0] == '/';
+    std::vector<std::string> parts;
+    for (const char* it = path; *it != '\0'; )
+    {
+        const char* start = it;
+        while (*it != '\0' && *it != '/')
+            it++;
+        std::string part(start, it);
+        if (*it == '/')
+            it++;
+
+        if (part.empty() || part == ".")
+            continue;
+        // A relative path may climb above the current directory, so ".." is kept when there is nothing to remove
+        if (part == ".." && !parts.empty() && parts.back() != "..")
+            parts.pop_back();
+        else if (part != ".." || !absolute)
+            parts.push_back(part);
+    }
+
+    std::string key = absolute ? "/" : "";
+    for (size_t i = 0; i < parts.size(); i++)
+        key += (i == 0 ? "" : "/") + parts[i];
+    return key;
+}
+
+// Cache key of the directory that holds a normalized path
+std::string ListingCache::parent_of(const std::string& key)
+{
+    size_t slash = key.rfind('/');
+    if (slash == std::string::npos)
+        return "";
+    return slash == 0 ? "/" : key.substr(0, slash);
+}
+
+// Sets how long a listing stays valid
+void ListingCache::set_ttl(int seconds)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ttl = std::chrono::seconds(seconds < 0 ? 0 : seconds);
+    if (seconds <= 0)
+        directories.clear();
+}
+
+// Gets the time to live in seconds
+int ListingCache::get_ttl() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int)std::chrono::duration_cast<std::chrono::seconds>(ttl).count();
+}
+
+// Checks whether listings are kept at all
+bool ListingCache::is_enabled() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return ttl.count() > 0;
+}
+
+// Looks up a fresh listing
+std::shared_ptr<const DirectoryListing> ListingCache::find(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ttl.count() <= 0)
+        return nullptr;
+
+    auto it = directories.find(key);
+    if (it != directories.end() && Clock::now() - it->second.fetched >= ttl)
+    {
+        directories.erase(it);
+        it = directories.end();
+    }
+
+    bool hit = it != directories.end();
+    (hit ? hits : misses)++;
+    Metrics::instance().record_listing_cache(hit);
+    return hit ? it->second.listing : nullptr;
+}
+
+// Keeps a listing, dropping the oldest one when the cache is full
+void ListingCache::store(const std::string& key, std::shared_ptr<const DirectoryListing> listing)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ttl.count() <= 0)
+        return;
+
+    if (directories.size() >= MAX_DIRECTORIES && directories.count(key) == 0)
+    {
+        auto oldest = directories.begin();
+        for (auto it = directories.begin(); it != directories.end(); ++it)
+        {
+            if (it->second.fetched < oldest->second.fetched)
+                oldest = it;
+        }
+        directories.erase(oldest);
+    }
+    directories[key] = Cached{ std::move(listing), Clock::now() };
+}
+
+// Forgets every listing a change of path makes stale
+void ListingCache::invalidate(const char* path)
+{
+    std::string key = normalize(path);
+    std::string parent = parent_of(key);
+    std::string prefix = key.empty() || key == "/" ? key : key + "/";
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = directories.begin(); it != directories.end(); )
+    {
+        const std::string& cached = it->first;
+        bool stale = cached == parent || cached == key || cached.compare(0, prefix.size(), prefix) == 0;
+        if (stale)
+        {
+            it = directories.erase(it);
+            invalidations++;
+            Metrics::instance().record_listing_invalidation();
+        }
+        else
+            ++it;
+    }
+}
+
+// Forgets every listing
+void ListingCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    directories.clear();
+}
+
+// Number of cached directories
+size_t ListingCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return directories.size();
+}
+
+// Lookups answered from the cache
+unsigned long long ListingCache::get_hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+// Lookups that had to list the directory
+unsigned long long ListingCache::get_misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+// Listings dropped because this client changed their directory
+unsigned long long ListingCache::get_invalidations() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return invalidations;
+}
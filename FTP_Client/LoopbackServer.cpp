@@ -0,0 +1,829 @@
+#include "LoopbackServer.h"
+
+#ifdef _WIN32
+#define _WIN32_WINNT 0x601 // Define minimum Windows version (Windows 7 or later)
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#pragma comment(lib, "Ws2_32.lib") // Link against Winsock library
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <bout.h>
+
+namespace
+{
+#ifdef _WIN32
+    using socket_t = SOCKET;
+    const socket_t NO_SOCKET = INVALID_SOCKET;
+
+    void close_socket(socket_t s) { closesocket(s); }
+    void shutdown_socket(socket_t s) { shutdown(s, SD_BOTH); }
+    int last_error() { return WSAGetLastError(); }
+#else
+    using socket_t = int;
+    const socket_t NO_SOCKET = -1;
+
+    void close_socket(socket_t s) { ::close(s); }
+    void shutdown_socket(socket_t s) { shutdown(s, SHUT_RDWR); }
+    int last_error() { return errno; }
+#endif
+
+    using Clock = std::chrono::steady_clock;
+
+    constexpr size_t PATTERN_SIZE = 64 * 1024;      // bench/data files repeat a block of this size
+    constexpr int DATA_ACCEPT_TIMEOUT_MS = 10000;   // wait for the client to connect to the PASV port
+    constexpr int ACCEPT_POLL_MS = 100;             // how often the accept loop checks for stop()
+    constexpr int TREE_DEPTH = 3;                   // levels of subdirectories under bench/tree/<F>
+
+    // Helper function to wait until a socket has something to read (a listener: a connection), false on timeout
+    bool wait_readable(socket_t s, int timeout_ms)
+    {
+#ifdef _WIN32
+        fd_set set;
+        FD_ZERO(&set);
+        FD_SET(s, &set);
+        timeval timeout{ timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+        return select(0, &set, NULL, NULL, &timeout) > 0;
+#else
+        pollfd pfd{ s, POLLIN, 0 };
+        int n;
+        do { n = ::poll(&pfd, 1, timeout_ms); } while (n < 0 && errno == EINTR);
+        return n > 0;
+#endif
+    }
+
+    // Helper function to wait for either of two sockets (NO_SOCKET to skip one), returns 1 and/or 2 for the ready ones
+    int wait_either(socket_t first, socket_t second, int timeout_ms)
+    {
+        if (first == NO_SOCKET && second == NO_SOCKET)
+        {
+            if (timeout_ms > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+            return 0;
+        }
+
+#ifdef _WIN32
+        fd_set set;
+        FD_ZERO(&set);
+        if (first != NO_SOCKET) FD_SET(first, &set);
+        if (second != NO_SOCKET) FD_SET(second, &set);
+        timeval timeout{ timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+        if (select(0, &set, NULL, NULL, timeout_ms < 0 ? NULL : &timeout) <= 0)
+            return 0;
+        return (first != NO_SOCKET && FD_ISSET(first, &set) ? 1 : 0) | (second != NO_SOCKET && FD_ISSET(second, &set) ? 2 : 0);
+#else
+        pollfd pfds[2]{ { first, POLLIN, 0 }, { second, POLLIN, 0 } };
+        int n;
+        do { n = ::poll(pfds, 2, timeout_ms); } while (n < 0 && errno == EINTR);
+        if (n <= 0)
+            return 0;
+        return (pfds[0].revents ? 1 : 0) | (pfds[1].revents ? 2 : 0);
+#endif
+    }
+
+    // Helper function to open a listening socket on 127.0.0.1 with a port chosen by the system
+    socket_t listen_loopback(int& port)
+    {
+        socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (s == NO_SOCKET)
+            throw std::runtime_error(bout() << "socket failed with error: " << last_error() << bfin);
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        socklen_t length = sizeof(address);
+        if (bind(s, (sockaddr*)&address, sizeof(address)) != 0 || listen(s, 64) != 0
+            || getsockname(s, (sockaddr*)&address, &length) != 0)
+        {
+            int error = last_error();
+            close_socket(s);
+            throw std::runtime_error(bout() << "listen failed with error: " << error << bfin);
+        }
+
+        port = ntohs(address.sin_port);
+        return s;
+    }
+
+    // Helper function to send a whole buffer, false when the peer is gone
+    bool send_all(socket_t s, const char* data, size_t size)
+    {
+        while (size > 0)
+        {
+            int chunk = size > INT_MAX ? INT_MAX : (int)size;
+#ifdef _WIN32
+            int n = ::send(s, data, chunk, 0);
+#else
+            int n = (int)::send(s, data, chunk, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+#endif
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    // Helper function to get the block bench/data files are made of
+    const char* pattern_block()
+    {
+        static const std::vector<char> block = []()
+        {
+            std::vector<char> bytes(PATTERN_SIZE);
+            for (size_t i = 0; i < bytes.size(); i++)
+                bytes[i] = (char)LoopbackServer::pattern_byte(i);
+            return bytes;
+        }();
+        return block.data();
+    }
+
+    // Helper function to match "<prefix><N>" (a leading '/' is ignored) and extract N
+    bool parse_generated(const char* path, const char* prefix, unsigned long long& n)
+    {
+        if (*path == '/')
+            path++;
+
+        size_t length = strlen(prefix);
+        if (strncmp(path, prefix, length) != 0 || path[length] < '0' || path[length] > '9')
+            return false;
+
+        char* end = nullptr;
+        n = strtoull(path + length, &end, 10);
+        return *end == '\0';
+    }
+
+    // Helper function to match "bench/tree/<F>[/<dir>...]" and extract F and how many directories deep the path goes
+    bool parse_tree(const char* path, unsigned long long& fanout, int& depth)
+    {
+        if (*path == '/')
+            path++;
+
+        const char* prefix = "bench/tree/";
+        size_t length = strlen(prefix);
+        if (strncmp(path, prefix, length) != 0 || path[length] < '0' || path[length] > '9')
+            return false;
+
+        char* end = nullptr;
+        fanout = strtoull(path + length, &end, 10);
+        if (*end != '\0' && *end != '/')
+            return false;
+
+        depth = 0;
+        for (const char* it = end; *it != '\0'; it++)
+        {
+            if (*it != '/' && (it == end || it[-1] == '/'))
+                depth++;
+        }
+        return true;
+    }
+
+    // Keeps a data connection under the bandwidth of the link: sleeps while the bytes moved so far are ahead of it
+    class Pacer
+    {
+    private:
+        long long bandwidth;
+        Clock::time_point started = Clock::now();
+        unsigned long long bytes = 0;
+    public:
+        Pacer(long long bandwidth) : bandwidth{ bandwidth } { }
+
+        void pace(size_t count)
+        {
+            if (bandwidth <= 0)
+                return;
+            bytes += count;
+            std::this_thread::sleep_until(started + std::chrono::microseconds((long long)(bytes * 1e6 / bandwidth)));
+        }
+    };
+
+    // One control connection: reads command lines and answers them in order
+    class Session
+    {
+    private:
+        // Bytes received from the client and the time they reach the server on the emulated link
+        struct Segment
+        {
+            Clock::time_point arrival;
+            std::string bytes;
+        };
+
+        socket_t control;
+        LinkProfile link;
+        std::mt19937 random;
+        socket_t passive = NO_SOCKET;       // listener opened by the last PASV
+        socket_t pending = NO_SOCKET;       // connection to it, accepted as soon as the client connects
+        Clock::time_point data_ready;       // when that connection is usable on the emulated link
+        unsigned long long restart = 0;     // REST offset for the next RETR
+        std::deque<Segment> in_flight;      // received, not yet arrived
+        Clock::time_point last_arrival;
+        bool control_closed = false;
+        std::string received;               // arrived bytes past the last complete line
+        std::vector<char> buffer = std::vector<char>(PATTERN_SIZE);
+
+        Clock::duration round_trip() const { return std::chrono::milliseconds(2 * link.delay_ms); }
+
+        // When a segment received now reaches the server, never before the previous one
+        Clock::time_point arrival_time()
+        {
+            int jitter = link.jitter_ms > 0 ? std::uniform_int_distribution<int>(0, link.jitter_ms)(random) : 0;
+            last_arrival = std::max(last_arrival, Clock::now() + round_trip() + std::chrono::milliseconds(jitter));
+            return last_arrival;
+        }
+
+        bool reply(const char* text)
+        {
+            bout line;
+            line << text << "\r\n";
+            return send_all(control, line.data(), line.size());
+        }
+
+        // Reads the next command line without its CRLF, false when the client is gone
+        bool read_line(std::string& line)
+        {
+            while (true)
+            {
+                // Segments whose arrival time has passed join the command text
+                Clock::time_point now = Clock::now();
+                while (!in_flight.empty() && in_flight.front().arrival <= now)
+                {
+                    received += in_flight.front().bytes;
+                    in_flight.pop_front();
+                }
+
+                size_t end = received.find('\n');
+                if (end != std::string::npos)
+                {
+                    line.assign(received, 0, end);
+                    if (!line.empty() && line.back() == '\r')
+                        line.pop_back();
+                    received.erase(0, end + 1);
+                    return true;
+                }
+
+                if (control_closed && in_flight.empty())
+                    return false;
+
+                // Wait for the next arrival, more bytes from the client or a connection to the PASV port
+                int timeout_ms = -1;
+                if (!in_flight.empty())
+                    timeout_ms = (int)std::chrono::ceil<std::chrono::milliseconds>(in_flight.front().arrival - now).count();
+                int ready = wait_either(control_closed ? NO_SOCKET : control, pending == NO_SOCKET ? passive : NO_SOCKET, timeout_ms);
+
+                if (ready & 2)
+                    accept_pending_data();
+                if (ready & 1)
+                {
+                    int n = ::recv(control, buffer.data(), (int)buffer.size(), 0);
+                    if (n <= 0)
+                        control_closed = true;
+                    else
+                        in_flight.push_back(Segment{ arrival_time(), std::string(buffer.data(), n) });
+                }
+            }
+        }
+
+        // Accepts the connection to the PASV port: it is usable after its handshake and the command it serves
+        void accept_pending_data()
+        {
+            pending = accept(passive, nullptr, nullptr);
+            data_ready = Clock::now() + 2 * round_trip();
+            close_socket(passive);
+            passive = NO_SOCKET;
+        }
+
+        // Takes the data connection of the last PASV, waiting for the client to connect if it has not yet
+        socket_t accept_data()
+        {
+            if (pending == NO_SOCKET && passive != NO_SOCKET && wait_readable(passive, DATA_ACCEPT_TIMEOUT_MS))
+                accept_pending_data();
+            if (passive != NO_SOCKET)
+            {
+                close_socket(passive);
+                passive = NO_SOCKET;
+            }
+
+            std::this_thread::sleep_until(data_ready);
+            socket_t accepted = pending;
+            pending = NO_SOCKET;
+            return accepted;
+        }
+
+        bool pasv()
+        {
+            if (passive != NO_SOCKET)
+                close_socket(passive);
+            if (pending != NO_SOCKET)
+            {
+                close_socket(pending);
+                pending = NO_SOCKET;
+            }
+
+            int data_port = 0;
+            try
+            {
+                passive = listen_loopback(data_port);
+            }
+            catch (const std::exception&)
+            {
+                passive = NO_SOCKET;
+                return reply("425 Cannot open data connection");
+            }
+            return reply(bout() << "227 Entering Passive Mode (127,0,0,1," << data_port / 256 << "," << data_port % 256 << ")" << bfin);
+        }
+
+        // LIST (unix ls -l lines), MLSD (facts) or NLST (names only) of bench/list/<N> or a bench/tree directory
+        bool list(const char* path, const std::string& verb)
+        {
+            unsigned long long entries = 0;
+            unsigned long long directories = 0;
+            int depth = 0;
+            if (*path != '\0' && !parse_generated(path, "bench/list/", entries))
+            {
+                if (!parse_tree(path, entries, depth))
+                    return reply("550 No such directory");
+                directories = depth < TREE_DEPTH ? entries : 0;
+            }
+
+            if (!reply("150 Here comes the directory listing"))
+                return false;
+            socket_t data = accept_data();
+            if (data == NO_SOCKET)
+                return reply("425 No data connection");
+
+            Pacer pacer(link.bandwidth);
+            std::string batch;
+            bool ok = true;
+            for (unsigned long long i = 0; i < directories + entries && ok; i++)
+            {
+                char entry[96];
+                int length;
+                if (i < directories)
+                {
+                    length = verb == "NLST"
+                        ? snprintf(entry, sizeof(entry), "dir%06llu\r\n", i)
+                        : verb == "MLSD"
+                        ? snprintf(entry, sizeof(entry), "type=dir;modify=20240101000000; dir%06llu\r\n", i)
+                        : snprintf(entry, sizeof(entry), "drwxr-xr-x 1 ftp ftp %12d Jan 01 00:00 dir%06llu\r\n", 4096, i);
+                }
+                else
+                {
+                    unsigned long long file = i - directories;
+                    length = verb == "NLST"
+                        ? snprintf(entry, sizeof(entry), "file%07llu\r\n", file)
+                        : verb == "MLSD"
+                        ? snprintf(entry, sizeof(entry), "type=file;size=%llu;modify=20240101000000; file%07llu\r\n", (file + 1) * 1024, file)
+                        : snprintf(entry, sizeof(entry), "-rw-r--r-- 1 ftp ftp %12llu Jan 01 00:00 file%07llu\r\n", (file + 1) * 1024, file);
+                }
+                batch.append(entry, length);
+
+                if (batch.size() >= PATTERN_SIZE)
+                {
+                    ok = send_all(data, batch.data(), batch.size());
+                    pacer.pace(batch.size());
+                    batch.clear();
+                }
+            }
+            if (ok)
+                ok = send_all(data, batch.data(), batch.size());
+
+            close_socket(data);
+            return reply(ok ? "226 Directory send OK" : "426 Connection closed; transfer aborted");
+        }
+
+        // RETR of bench/data/<N>, starting at the REST offset
+        bool retr(const char* path)
+        {
+            unsigned long long size = 0;
+            unsigned long long offset = restart;
+            restart = 0;
+            if (!parse_generated(path, "bench/data/", size))
+                return reply("550 No such file");
+
+            if (!reply("150 Opening BINARY mode data connection"))
+                return false;
+            socket_t data = accept_data();
+            if (data == NO_SOCKET)
+                return reply("425 No data connection");
+
+            const char* block = pattern_block();
+            Pacer pacer(link.bandwidth);
+            bool ok = true;
+            for (unsigned long long at = offset; at < size && ok; )
+            {
+                size_t start = (size_t)(at % PATTERN_SIZE);
+                size_t chunk = (size_t)std::min<unsigned long long>(PATTERN_SIZE - start, size - at);
+                ok = send_all(data, block + start, chunk);
+                pacer.pace(chunk);
+                at += chunk;
+            }
+
+            close_socket(data);
+            return reply(ok ? "226 Transfer complete" : "426 Connection closed; transfer aborted");
+        }
+
+        // STOR to any path: the data is read until the client closes and dropped
+        bool stor()
+        {
+            restart = 0;
+            if (!reply("150 Ok to send data"))
+                return false;
+            socket_t data = accept_data();
+            if (data == NO_SOCKET)
+                return reply("425 No data connection");
+
+            Pacer pacer(link.bandwidth);
+            int n;
+            while ((n = ::recv(data, buffer.data(), (int)buffer.size(), 0)) > 0)
+                pacer.pace(n);
+
+            close_socket(data);
+            return reply(n == 0 ? "226 Transfer complete" : "426 Connection closed; transfer aborted");
+        }
+
+        // Answers one command line, false once the session is over
+        bool handle(const std::string& line)
+        {
+            size_t space = line.find(' ');
+            std::string verb = line.substr(0, space);
+            for (char& c : verb)
+                c = (char)toupper((unsigned char)c);
+            const char* argument = space == std::string::npos ? "" : line.c_str() + space + 1;
+
+            if (verb == "USER") return reply("331 Please specify the password");
+            if (verb == "PASS") return reply("230 Login successful");
+            if (verb == "SYST") return reply("215 UNIX Type: L8");
+            if (verb == "TYPE") return reply("200 Type set");
+            if (verb == "NOOP") return reply("200 NOOP ok");
+            if (verb == "PWD") return reply("257 \"/\" is the current directory");
+            if (verb == "CWD") return reply("250 Directory successfully changed");
+            if (verb == "PASV") return pasv();
+            if (verb == "FEAT") return reply("211-Features:\r\n MLST type*;size*;modify*;\r\n MDTM\r\n SIZE\r\n REST STREAM\r\n211 End");
+            if (verb == "LIST" || verb == "NLST" || verb == "MLSD") return list(argument, verb);
+            if (verb == "RETR") return retr(argument);
+            if (verb == "STOR") return stor();
+
+            if (verb == "REST")
+            {
+                restart = strtoull(argument, nullptr, 10);
+                return reply(bout() << "350 Restart position accepted (" << restart << ")" << bfin);
+            }
+
+            if (verb == "SIZE" || verb == "MDTM")
+            {
+                unsigned long long size = 0;
+                if (!parse_generated(argument, "bench/data/", size))
+                    return reply("550 Could not get file information");
+                return verb == "SIZE" ? reply(bout() << "213 " << size << bfin) : reply("213 20240101000000");
+            }
+
+            if (verb == "QUIT")
+            {
+                reply("221 Goodbye");
+                return false;
+            }
+
+            return reply("502 Command not implemented");
+        }
+
+    public:
+        Session(socket_t control, const LinkProfile& link) : control{ control }, link{ link }, random{ std::random_device{}() } { }
+
+        void run()
+        {
+            // The greeting follows the handshake
+            std::this_thread::sleep_for(2 * round_trip());
+            if (reply("220 Loopback stand-in server ready"))
+            {
+                std::string line;
+                while (read_line(line) && handle(line));
+            }
+
+            if (passive != NO_SOCKET)
+                close_socket(passive);
+            if (pending != NO_SOCKET)
+                close_socket(pending);
+        }
+    };
+}
+
+namespace
+{
+    // Plays the server side of a capture back: waits for the bytes the client sent in the capture, then sends
+    // what it received there, keeping the delays measured from the client's last action. PASV replies are
+    // pointed at a local listener, where the data connections of the capture are accepted.
+    class ReplaySession
+    {
+    private:
+        socket_t control;
+        const std::vector<CaptureEvent>& events;
+        unsigned control_channel = 0;
+        socket_t passive = NO_SOCKET;
+        std::map<unsigned, socket_t> data;      // data connections by capture channel
+        Clock::time_point anchor;               // the client's last action in this replay
+        unsigned long long anchor_us = 0;       // and in the capture
+        std::vector<char> buffer = std::vector<char>(PATTERN_SIZE);
+
+        socket_t channel_socket(unsigned channel)
+        {
+            if (channel == control_channel)
+                return control;
+            auto it = data.find(channel);
+            return it == data.end() ? NO_SOCKET : it->second;
+        }
+
+        void set_anchor(const CaptureEvent& event)
+        {
+            anchor = Clock::now();
+            anchor_us = event.time_us;
+        }
+
+        // Reads and drops exactly size bytes, false when the client went away
+        bool receive_exactly(socket_t s, size_t size)
+        {
+            while (size > 0)
+            {
+                int n = ::recv(s, buffer.data(), (int)std::min(size, buffer.size()), 0);
+                if (n <= 0)
+                    return false;
+                size -= n;
+            }
+            return true;
+        }
+
+        // Points the address of a 227 reply at a new local listener
+        std::string rewrite_pasv(std::string bytes)
+        {
+            for (size_t line = 0; line < bytes.size(); )
+            {
+                size_t end = bytes.find('\n', line);
+                if (end == std::string::npos)
+                    end = bytes.size();
+
+                size_t open_at = bytes.find('(', line);
+                size_t close_at = bytes.find(')', line);
+                if (bytes.compare(line, 4, "227 ") == 0 && open_at < close_at && close_at < end)
+                {
+                    if (passive != NO_SOCKET)
+                        close_socket(passive);
+                    int port = 0;
+                    passive = listen_loopback(port);
+
+                    bout address;
+                    address << "127,0,0,1," << port / 256 << "," << port % 256;
+                    bytes.replace(open_at + 1, close_at - open_at - 1, address.data(), address.size());
+                    end = std::min(bytes.find('\n', line), bytes.size());
+                }
+                line = end + 1;
+            }
+            return bytes;
+        }
+
+        // Ends a data connection the client closed: our side closes first so a download sees its end
+        void close_data(unsigned channel)
+        {
+            socket_t s = channel_socket(channel);
+            if (s == NO_SOCKET)
+                return;
+
+            shutdown(s, 1);
+            while (::recv(s, buffer.data(), (int)buffer.size(), 0) > 0);
+            close_socket(s);
+            data.erase(channel);
+        }
+
+        // Plays one event, false when the replay cannot go on
+        bool play(const CaptureEvent& event)
+        {
+            switch (event.kind)
+            {
+            case CaptureEvent::CONNECT:
+            {
+                // Another control connection would be another session
+                if (event.bytes != "D" || passive == NO_SOCKET || !wait_readable(passive, DATA_ACCEPT_TIMEOUT_MS))
+                    return false;
+                socket_t accepted = accept(passive, nullptr, nullptr);
+                close_socket(passive);
+                passive = NO_SOCKET;
+                if (accepted == NO_SOCKET)
+                    return false;
+                data[event.channel] = accepted;
+                set_anchor(event);
+                return true;
+            }
+            case CaptureEvent::SENT:
+            {
+                socket_t s = channel_socket(event.channel);
+                if (s == NO_SOCKET || !receive_exactly(s, event.bytes.size()))
+                    return false;
+                set_anchor(event);
+                return true;
+            }
+            case CaptureEvent::RECEIVED:
+            {
+                socket_t s = channel_socket(event.channel);
+                if (s == NO_SOCKET)
+                    return false;
+                std::this_thread::sleep_until(anchor + std::chrono::microseconds(event.time_us - anchor_us));
+                if (s != control)
+                    return send_all(s, event.bytes.data(), event.bytes.size());
+                std::string reply = rewrite_pasv(event.bytes);
+                return send_all(s, reply.data(), reply.size());
+            }
+            case CaptureEvent::CLOSE:
+                if (event.channel == control_channel)
+                    return false;
+                close_data(event.channel);
+                set_anchor(event);
+                return true;
+            }
+            return false;
+        }
+
+    public:
+        ReplaySession(socket_t control, const std::vector<CaptureEvent>& events) : control{ control }, events{ events } { }
+
+        void run()
+        {
+            if (events.empty() || events[0].kind != CaptureEvent::CONNECT)
+                return;
+
+            control_channel = events[0].channel;
+            set_anchor(events[0]);
+            for (size_t i = 1; i < events.size() && play(events[i]); i++);
+
+            for (auto& channel : data)
+                close_socket(channel.second);
+            if (passive != NO_SOCKET)
+                close_socket(passive);
+        }
+    };
+}
+
+// Private class holding the listener and the session threads
+class LoopbackServer::__privates__
+{
+private:
+    socket_t listener = NO_SOCKET;
+    int port = 0;
+    std::atomic<bool> running{ false };
+    LinkProfile link;
+    std::vector<CaptureEvent> replay;
+    std::thread accept_thread;
+    std::mutex sessions_mutex;
+    std::vector<std::thread> session_threads;
+    std::vector<socket_t> session_sockets;  // open control connections, shut down by stop()
+
+    // Accepts control connections until stop(), one thread per session
+    void accept_loop()
+    {
+        while (running.load())
+        {
+            if (!wait_readable(listener, ACCEPT_POLL_MS))
+                continue;
+
+            socket_t control = accept(listener, nullptr, nullptr);
+            if (control == NO_SOCKET)
+                continue;
+
+            int one = 1;
+            setsockopt(control, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            session_sockets.push_back(control);
+            session_threads.emplace_back(&__privates__::run_session, this, control, link);
+        }
+    }
+
+    // Serves one client, then forgets and closes its control connection
+    void run_session(socket_t control, LinkProfile session_link)
+    {
+        if (!replay.empty())
+            ReplaySession(control, replay).run();
+        else
+            Session(control, session_link).run();
+
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+        session_sockets.erase(std::find(session_sockets.begin(), session_sockets.end(), control));
+        close_socket(control);
+    }
+
+public:
+    // Constructor initializes Winsock on Windows
+    __privates__()
+    {
+#ifdef _WIN32
+        WSADATA wsaData;
+        int iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
+        if (iResult != 0)
+            throw std::runtime_error(bout() << "WSAStartup failed with error:" << iResult << bfin);
+#endif
+    }
+
+    void start()
+    {
+        if (running.load())
+            return;
+
+        listener = listen_loopback(port);
+        running = true;
+        accept_thread = std::thread(&__privates__::accept_loop, this);
+    }
+
+    int get_port() const { return port; }
+
+    void set_link(const LinkProfile& profile)
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+        link = profile;
+    }
+
+    void set_replay(std::vector<CaptureEvent> events)
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+        replay = std::move(events);
+    }
+
+    void stop()
+    {
+        if (!running.exchange(false))
+            return;
+
+        accept_thread.join();
+        close_socket(listener);
+        listener = NO_SOCKET;
+
+        // Wake sessions waiting for a command, then wait for all of them outside the lock they need to finish
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            for (socket_t control : session_sockets)
+                shutdown_socket(control);
+            threads.swap(session_threads);
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    // Destructor stops the server
+    ~__privates__()
+    {
+        stop();
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+};
+
+// Byte at the given offset of every bench/data file (repeats every 64 KiB)
+unsigned char LoopbackServer::pattern_byte(unsigned long long offset)
+{
+    return (unsigned char)(offset * 31 + offset / 256);
+}
+
+// LoopbackServer class constructor
+LoopbackServer::LoopbackServer() { privates = new __privates__(); }
+
+// Start listening on an ephemeral port of 127.0.0.1
+void LoopbackServer::start() { privates->start(); }
+
+// Get the port the server listens on
+int LoopbackServer::get_port() const { return privates->get_port(); }
+
+// Set the network conditions emulated for new sessions
+void LoopbackServer::set_link(const LinkProfile& link) { privates->set_link(link); }
+
+// Switch to replaying a captured session
+void LoopbackServer::set_replay(std::vector<CaptureEvent> events) { privates->set_replay(std::move(events)); }
+
+// Stop accepting sessions and close the open ones
+void LoopbackServer::stop() { privates->stop(); }
+
+// Destructor stops the server and releases the private object
+LoopbackServer::~LoopbackServer() { delete privates; }
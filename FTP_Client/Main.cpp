@@ -1,5 +1,7 @@
 #include <iostream>
-#include <exception>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
 
 #include "FTPClient.h"
 #include "FTPCommandInterpreter.h"
@@ -8,14 +10,19 @@
 #include "tcp_exception.h"
 #include "utils.h"
 #include "ArgsParser.h"
+#include "BatchRunner.h"
+#include "Benchmark.h"
+#include "LoopbackServer.h"
+#include "MicroBenchmark.h"
+#include "SessionCapture.h"
 
 using namespace std;
 
-// Function that runs the FTP client and handles user input for commands
-void run_client(const char* ip, int port)
+// Function that runs the FTP client and handles user input for commands (recorded when a recorder is given)
+void run_client(const char* ip, int port, SessionRecorder* recorder)
 {
     // Create an instance of FTPClient and initialize with IP and port
-    FTPClient ftp_client(ip, port, printf);
+    FTPClient ftp_client(ip, port, printf, recorder);
 
     // Create an instance of FTPCommandInterpreter to process FTP commands
     FTPCommandInterpreter ci(&ftp_client);
@@ -24,7 +31,8 @@ void run_client(const char* ip, int port)
     while (1)  // Infinite loop to continuously accept user input
     {
         std::cout << ">> ";  // Prompt for user input
-        std::getline(cin, cmd);  // Read a line of input from the user
+        if (!std::getline(cin, cmd))  // Read a line of input from the user
+            break;  // End of input (e.g. commands piped from a file)
 
         try
         {
@@ -38,7 +46,92 @@ void run_client(const char* ip, int port)
         }
     }
 
-    return;  // End of client loop (though it will never be reached due to infinite loop)
+    return;  // End of client loop, reached when the input ends
+}
+
+// Function that runs a command script (file or "-" for stdin) without prompts or colors; returns the process exit code
+int run_batch(const char* ip, int port, const char* script_path, SessionRecorder* recorder)
+{
+    Utils::Color::enabled = false;
+
+    std::ifstream file;
+    if (strcmp(script_path, "-") != 0)
+    {
+        file.open(script_path);
+        if (!file)
+            throw std::runtime_error(std::string("Cannot open script ") + script_path);
+    }
+    std::istream& script = file.is_open() ? static_cast<std::istream&>(file) : cin;
+
+    FTPClient ftp_client(ip, port, printf, recorder);
+    FTPCommandInterpreter ci(&ftp_client);
+
+    // Parse everything first: nothing runs if the script has an invalid line
+    BatchRunner runner(&ftp_client, &ci);
+    runner.load(script);
+
+    BatchReport report = runner.run();
+    report.print_json(cout);
+    return report.failed == 0 ? 0 : 1;
+}
+
+// Function that writes benchmark results as JSON to a file ("-" for stdout)
+template<typename Results>
+void write_results(const Results& results, const char* output_path)
+{
+    if (strcmp(output_path, "-") == 0)
+    {
+        results.write_json(cout);
+        return;
+    }
+
+    std::ofstream file(output_path);
+    if (!file)
+        throw std::runtime_error(std::string("Cannot write ") + output_path);
+    results.write_json(file);
+}
+
+// Function that benchmarks the client against an in-process loopback server, writing the results as JSON ("-" for stdout)
+int run_benchmarks(const char* output_path, bool full, const LinkProfile& link, int max_iterations)
+{
+    LoopbackServer server;
+    server.set_link(link);
+    server.start();
+
+    Benchmark benchmark("127.0.0.1", server.get_port(), full);
+    benchmark.set_link(link);
+    benchmark.set_max_iterations(max_iterations);
+    benchmark.run();
+    server.stop();
+
+    benchmark.print(cout);
+    write_results(benchmark, output_path);
+    return 0;
+}
+
+// Function that runs the protocol microbenchmarks (no network), writing the results as JSON ("-" for stdout)
+int run_microbenchmarks(const char* output_path)
+{
+    MicroBenchmark benchmark;
+    benchmark.run();
+
+    benchmark.print(cout);
+    write_results(benchmark, output_path);
+    return 0;
+}
+
+// Function that plays a capture back on a loopback port until Enter is pressed (or the input ends)
+int run_replay(const char* capture_path)
+{
+    LoopbackServer server;
+    server.set_replay(SessionRecorder::load(capture_path));
+    server.start();
+
+    cout << "Replaying " << capture_path << " on 127.0.0.1 " << server.get_port() << ", press Enter to stop\n";
+    std::string line;
+    std::getline(cin, line);
+    server.stop();
+    return 0;
 }
 
 // Main function where the program starts
@@ -49,20 +142,63 @@ int main(int argc, const char** argv)
         // Parse command-line arguments using ArgsParser
         ArgsParser args(argc, argv);
 
+        // "--bench-micro <results.json>" times the protocol code alone, on replayed server replies
+        const char* micro_output = args.get_option("--bench-micro");
+        if (micro_output != nullptr)
+            return run_microbenchmarks(micro_output);
+
+        // "--replay <capture>" serves a recorded session to a client repeating it
+        const char* capture = args.get_option("--replay");
+        if (capture != nullptr)
+            return run_replay(capture);
+
+        // "--bench <results.json>" needs no server: it starts its own on loopback ("--bench-full" adds the long cases),
+        // "--delay <ms>", "--jitter <ms>" and "--bandwidth <KB/s>" make its connections behave like a distant site
+        const char* bench_output = args.get_option("--bench");
+        if (bench_output != nullptr)
+        {
+            LinkProfile link;
+            const char* option = nullptr;
+            if ((option = args.get_option("--delay")) != nullptr)
+                link.delay_ms = Utils::my_atoi(option);
+            if ((option = args.get_option("--jitter")) != nullptr)
+                link.jitter_ms = Utils::my_atoi(option);
+            if ((option = args.get_option("--bandwidth")) != nullptr)
+                link.bandwidth = Utils::my_atoi(option) * 1024LL;
+
+            option = args.get_option("--bench-iterations");
+            int max_iterations = option != nullptr ? Utils::my_atoi(option) : 0;
+
+            return run_benchmarks(bench_output, args.has_option("--bench-full"), link, max_iterations);
+        }
+
         // Get the IP address and port from the command-line arguments (default to "127.0.0.1" and port 21)
         const char* ip = args.get_arg<const char*>(1, "127.0.0.1");
         int port = args.get_arg(2, 21);
 
         // Validate the IP address (ensure it is a valid length)
         if (Utils::get_str_bound(ip, 20) < 0)
-            throw std::exception("Invalid IP");  // Throw exception if the IP is invalid
+            throw std::runtime_error("Invalid IP");  // Throw exception if the IP is invalid
+
+        // "--record <capture>" writes everything the session sends and receives to a capture file
+        SessionRecorder recorder;
+        if ((capture = args.get_option("--record")) != nullptr)
+            recorder.open(capture);
+        SessionRecorder* recording = recorder.is_open() ? &recorder : nullptr;
+
+        // "--batch <script>" runs a script non-interactively, otherwise start the interactive client
+        const char* script = args.get_option("--batch");
+        if (script != nullptr)
+            return run_batch(ip, port, script, recording);
 
         // Call run_client to start the FTP client with the specified IP and port
-        run_client(ip, port);
+        run_client(ip, port, recording);
     }
     catch (exception& e)
     {
         // Catch and display any exceptions that occur during setup or execution
         cout << e.what() << "\n";
+        return 1;
     }
+    return 0;
 }
@@ -0,0 +1,53 @@
+#include "MemoryTransport.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+// Constructor for MemoryTransport, the stream is replayed from its first byte on each connect
+MemoryTransport::MemoryTransport(std::string input, size_t segment_size)
+    : input{ std::move(input) }, segment_size{ segment_size > 0 ? segment_size : DEFAULT_SEGMENT_SIZE } { }
+
+// "Connects" by rewinding the stream; host and port are ignored
+void MemoryTransport::connect(const char*, int)
+{
+    rewind();
+    connected = true;
+}
+
+// Accepts every byte without storing it
+int MemoryTransport::send(const char*, size_t size)
+{
+    if (!connected)
+        return -1;
+    bytes_sent += size;
+    return (int)size;
+}
+
+// Hands out the next segment of the stream, 0 once it is over (the peer closed the connection)
+int MemoryTransport::recv(char* buffer, size_t size)
+{
+    if (!connected)
+        return -1;
+
+    size_t count = std::min(std::min(size, segment_size), remaining());
+    memcpy(buffer, input.data() + position, count);
+    position += count;
+    return (int)count;
+}
+
+// Counts the file region as sent without reading it
+unsigned long long MemoryTransport::send_file(int, unsigned long long, unsigned long long size)
+{
+    if (!connected)
+        return 0;
+    bytes_sent += size;
+    return size;
+}
+
+// The only failure is using the transport while it is closed
+int MemoryTransport::last_error() const
+{
+    return ENOTCONN;
+}
@@ -0,0 +1,367 @@
+#include "Metrics.h"
+
+#include <cmath>
+#include <cstdio>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Index of the bucket holding value: the number of significant bits
+int Histogram::bucket_of(unsigned long long value)
+{
+    if (value == 0) return 0;
+
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    int bits = (int)index + 1;
+#else
+    int bits = 64 - __builtin_clzll(value);
+#endif
+    return bits < BUCKETS ? bits : BUCKETS - 1;
+}
+
+// Adds one value (relaxed atomics: the counters are independent statistics)
+void Histogram::record(unsigned long long value)
+{
+    buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+
+    unsigned long long seen = max.load(std::memory_order_relaxed);
+    while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed));
+}
+
+// Approximates a percentile by the upper bound of its bucket
+unsigned long long Histogram::percentile(double p) const
+{
+    unsigned long long total = get_count();
+    if (total == 0) return 0;
+
+    unsigned long long target = (unsigned long long)std::ceil(p * total);
+    if (target == 0) target = 1;
+
+    unsigned long long seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += get_bucket(i);
+        if (seen >= target)
+            return bucket_limit(i) < get_max() ? bucket_limit(i) : get_max();
+    }
+    return get_max();
+}
+
+// Clears every bucket
+void Histogram::reset()
+{
+    for (auto& bucket : buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+// The process-wide registry
+Metrics& Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+// Microseconds since a time point
+unsigned long long Metrics::elapsed_us(Clock::time_point since)
+{
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - since).count();
+}
+
+// Packs the verb (first word, upper-cased, at most 4 letters) of a command into a non-zero key
+uint32_t Metrics::pack_verb(const char* command)
+{
+    uint32_t key = 0;
+    for (int i = 0; i < 4 && command[i] != '\0' && command[i] != ' '; i++)
+    {
+        char c = command[i];
+        if ('a' <= c && c <= 'z') c -= 'a' - 'A';
+        key |= (uint32_t)(unsigned char)c << (8 * i);
+    }
+    return key != 0 ? key : (uint32_t)'?';
+}
+
+// Writes the '\0'-terminated verb of a key
+void Metrics::unpack_verb(uint32_t key, char* verb)
+{
+    int n = 0;
+    for (; n < 4 && (key >> (8 * n)) != 0; n++)
+        verb[n] = (char)((key >> (8 * n)) & 0xFF);
+    verb[n] = '\0';
+}
+
+// Records a control command round trip; a new verb claims a free slot with a compare-exchange
+void Metrics::record_command(const char* command, unsigned long long us)
+{
+    if (!enabled.load(std::memory_order_relaxed)) return;
+
+    uint32_t key = pack_verb(command);
+    for (int probe = 0; probe < MAX_VERBS; probe++)
+    {
+        int slot = (int)((key * 2654435761u + probe) % MAX_VERBS);
+        uint32_t current = verb_keys[slot].load(std::memory_order_acquire);
+        if (current == 0)
+        {
+            if (verb_keys[slot].compare_exchange_strong(current, key, std::memory_order_acq_rel) || current == key)
+            {
+                verb_rtt[slot].record(us);
+                return;
+            }
+        }
+        if (current == key)
+        {
+            verb_rtt[slot].record(us);
+            return;
+        }
+    }
+    // More distinct verbs than slots: not worth tracking
+}
+
+// Counts a reply code
+void Metrics::record_reply(int code)
+{
+    if (!enabled.load(std::memory_order_relaxed)) return;
+    if (0 <= code && code < MAX_REPLY_CODE)
+        replies[code].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Records how long connecting the data connection took
+void Metrics::record_data_connect(unsigned long long us)
+{
+    if (enabled.load(std::memory_order_relaxed))
+        data_connect.record(us);
+}
+
+// Records the delay between RETR and the first data byte
+void Metrics::record_first_byte(unsigned long long us)
+{
+    if (enabled.load(std::memory_order_relaxed))
+        first_byte.record(us);
+}
+
+// Counts a transfer that did not complete
+void Metrics::record_failed_transfer()
+{
+    if (enabled.load(std::memory_order_relaxed))
+        failed_transfers.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Records bytes, duration and throughput of a finished transfer
+void Metrics::record_transfer(bool upload, unsigned long long bytes, unsigned long long us)
+{
+    if (!enabled.load(std::memory_order_relaxed)) return;
+
+    (upload ? bytes_sent : bytes_received).fetch_add(bytes, std::memory_order_relaxed);
+    transfers.fetch_add(1, std::memory_order_relaxed);
+    transfer_time.record(us);
+    if (us > 0)
+        throughput.record((unsigned long long)(bytes / 1024.0 / (us / 1e6)));
+}
+
+// Counts a listing served from (or missing in) a ListingCache
+void Metrics::record_listing_cache(bool hit)
+{
+    if (enabled.load(std::memory_order_relaxed))
+        (hit ? listing_cache_hits : listing_cache_misses).fetch_add(1, std::memory_order_relaxed);
+}
+
+// Counts a cached listing dropped after a change to its directory
+void Metrics::record_listing_invalidation()
+{
+    if (enabled.load(std::memory_order_relaxed))
+        listing_invalidations.fetch_add(1, std::memory_order_relaxed);
+}
+
+namespace
+{
+    // Helper function to print one histogram row of the stats table, times converted to ms
+    void print_row(std::ostream& o, const char* name, const Histogram& h, double scale)
+    {
+        char row[160];
+        snprintf(row, sizeof(row), "%-16s %8llu %12.3f %12.3f %12.3f %12.3f\n", name, h.get_count(),
+            h.get_count() ? h.get_sum() / scale / h.get_count() : 0.0,
+            h.percentile(0.5) / scale, h.percentile(0.99) / scale, h.get_max() / scale);
+        o << row;
+    }
+
+    // Helper function to write a histogram in Prometheus text format (seconds, cumulative buckets)
+    void write_prometheus_histogram(std::ostream& o, const char* name, const char* labels, const Histogram& h, double scale)
+    {
+        int last = 0;
+        for (int i = 0; i < Histogram::BUCKETS; i++)
+        {
+            if (h.get_bucket(i) != 0) last = i;
+        }
+
+        const char* sep = labels[0] ? "," : "";
+        unsigned long long cumulative = 0;
+        for (int i = 0; i <= last && h.get_count() != 0; i++)
+        {
+            cumulative += h.get_bucket(i);
+            o << name << "_bucket{" << labels << sep << "le=\"" << (Histogram::bucket_limit(i) + 1) / scale << "\"} " << cumulative << "\n";
+        }
+        o << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << h.get_count() << "\n";
+        o << name << "_sum{" << labels << "} " << h.get_sum() / scale << "\n";
+        o << name << "_count{" << labels << "} " << h.get_count() << "\n";
+    }
+
+    // Helper function to write a histogram summary as a JSON object
+    void write_json_histogram(std::ostream& o, const Histogram& h)
+    {
+        o << "{\"count\":" << h.get_count() << ",\"sum\":" << h.get_sum()
+          << ",\"p50\":" << h.percentile(0.5) << ",\"p90\":" << h.percentile(0.9)
+          << ",\"p99\":" << h.percentile(0.99) << ",\"max\":" << h.get_max() << "}";
+    }
+}
+
+// Prints a human readable summary (used by the 'stats' command)
+void Metrics::print(std::ostream& o) const
+{
+    char header[160];
+    snprintf(header, sizeof(header), "%-16s %8s %12s %12s %12s %12s\n", "", "count", "avg ms", "p50 ms", "p99 ms", "max ms");
+    o << header;
+
+    char verb[5];
+    for (int i = 0; i < MAX_VERBS; i++)
+    {
+        uint32_t key = verb_keys[i].load(std::memory_order_acquire);
+        if (key == 0) continue;
+        unpack_verb(key, verb);
+        print_row(o, verb, verb_rtt[i], 1000.0);
+    }
+    print_row(o, "data connect", data_connect, 1000.0);
+    print_row(o, "first byte", first_byte, 1000.0);
+    print_row(o, "transfer", transfer_time, 1000.0);
+
+    snprintf(header, sizeof(header), "%-16s %8s %12s %12s %12s %12s\n", "", "count", "avg KiB/s", "p50 KiB/s", "p99 KiB/s", "max KiB/s");
+    o << header;
+    print_row(o, "throughput", throughput, 1.0);
+
+    o << "transfers: " << transfers.load() << " (" << failed_transfers.load() << " failed), received "
+      << bytes_received.load() << " bytes, sent " << bytes_sent.load() << " bytes\n";
+    o << "listing cache: " << listing_cache_hits.load() << " hits, " << listing_cache_misses.load() << " misses, "
+      << listing_invalidations.load() << " invalidations\n";
+
+    o << "replies:";
+    for (int code = 0; code < MAX_REPLY_CODE; code++)
+    {
+        unsigned long long n = replies[code].load(std::memory_order_relaxed);
+        if (n != 0) o << " " << code << "=" << n;
+    }
+    o << "\n";
+}
+
+// Writes every metric in the Prometheus text exposition format
+void Metrics::write_prometheus(std::ostream& o) const
+{
+    o << "# TYPE ftp_command_rtt_seconds histogram\n";
+    char verb[5];
+    char labels[32];
+    for (int i = 0; i < MAX_VERBS; i++)
+    {
+        uint32_t key = verb_keys[i].load(std::memory_order_acquire);
+        if (key == 0) continue;
+        unpack_verb(key, verb);
+        snprintf(labels, sizeof(labels), "verb=\"%s\"", verb);
+        write_prometheus_histogram(o, "ftp_command_rtt_seconds", labels, verb_rtt[i], 1e6);
+    }
+
+    o << "# TYPE ftp_data_connect_seconds histogram\n";
+    write_prometheus_histogram(o, "ftp_data_connect_seconds", "", data_connect, 1e6);
+    o << "# TYPE ftp_first_byte_seconds histogram\n";
+    write_prometheus_histogram(o, "ftp_first_byte_seconds", "", first_byte, 1e6);
+    o << "# TYPE ftp_transfer_seconds histogram\n";
+    write_prometheus_histogram(o, "ftp_transfer_seconds", "", transfer_time, 1e6);
+    o << "# TYPE ftp_transfer_throughput_kibps histogram\n";
+    write_prometheus_histogram(o, "ftp_transfer_throughput_kibps", "", throughput, 1.0);
+
+    o << "# TYPE ftp_bytes_total counter\n";
+    o << "ftp_bytes_total{direction=\"received\"} " << bytes_received.load() << "\n";
+    o << "ftp_bytes_total{direction=\"sent\"} " << bytes_sent.load() << "\n";
+    o << "# TYPE ftp_transfers_total counter\n";
+    o << "ftp_transfers_total " << transfers.load() << "\n";
+    o << "# TYPE ftp_failed_transfers_total counter\n";
+    o << "ftp_failed_transfers_total " << failed_transfers.load() << "\n";
+    o << "# TYPE ftp_listing_cache_lookups_total counter\n";
+    o << "ftp_listing_cache_lookups_total{result=\"hit\"} " << listing_cache_hits.load() << "\n";
+    o << "ftp_listing_cache_lookups_total{result=\"miss\"} " << listing_cache_misses.load() << "\n";
+    o << "# TYPE ftp_listing_cache_invalidations_total counter\n";
+    o << "ftp_listing_cache_invalidations_total " << listing_invalidations.load() << "\n";
+
+    o << "# TYPE ftp_replies_total counter\n";
+    for (int code = 0; code < MAX_REPLY_CODE; code++)
+    {
+        unsigned long long n = replies[code].load(std::memory_order_relaxed);
+        if (n != 0) o << "ftp_replies_total{code=\"" << code << "\"} " << n << "\n";
+    }
+}
+
+// Writes every metric as one JSON object (times in microseconds)
+void Metrics::write_json(std::ostream& o) const
+{
+    o << "{\"commands\":{";
+    char verb[5];
+    bool first = true;
+    for (int i = 0; i < MAX_VERBS; i++)
+    {
+        uint32_t key = verb_keys[i].load(std::memory_order_acquire);
+        if (key == 0) continue;
+        unpack_verb(key, verb);
+        o << (first ? "" : ",") << "\"" << verb << "\":";
+        write_json_histogram(o, verb_rtt[i]);
+        first = false;
+    }
+
+    o << "},\"data_connect_us\":";
+    write_json_histogram(o, data_connect);
+    o << ",\"first_byte_us\":";
+    write_json_histogram(o, first_byte);
+    o << ",\"transfer_us\":";
+    write_json_histogram(o, transfer_time);
+    o << ",\"throughput_kibps\":";
+    write_json_histogram(o, throughput);
+
+    o << ",\"bytes_received\":" << bytes_received.load()
+      << ",\"bytes_sent\":" << bytes_sent.load()
+      << ",\"transfers\":" << transfers.load()
+      << ",\"failed_transfers\":" << failed_transfers.load()
+      << ",\"listing_cache_hits\":" << listing_cache_hits.load()
+      << ",\"listing_cache_misses\":" << listing_cache_misses.load()
+      << ",\"listing_invalidations\":" << listing_invalidations.load()
+      << ",\"replies\":{";
+
+    first = true;
+    for (int code = 0; code < MAX_REPLY_CODE; code++)
+    {
+        unsigned long long n = replies[code].load(std::memory_order_relaxed);
+        if (n == 0) continue;
+        o << (first ? "" : ",") << "\"" << code << "\":" << n;
+        first = false;
+    }
+    o << "}}\n";
+}
+
+// Clears every metric (the verb slots stay claimed)
+void Metrics::reset()
+{
+    for (auto& h : verb_rtt) h.reset();
+    for (auto& n : replies) n.store(0, std::memory_order_relaxed);
+    data_connect.reset();
+    first_byte.reset();
+    transfer_time.reset();
+    throughput.reset();
+    bytes_received = 0;
+    bytes_sent = 0;
+    transfers = 0;
+    failed_transfers = 0;
+    listing_cache_hits = 0;
+    listing_cache_misses = 0;
+    listing_invalidations = 0;
+}
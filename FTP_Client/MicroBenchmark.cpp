@@ -0,0 +1,274 @@
+#include "MicroBenchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include "CommandInterpreter.h"
+#include "FTPClient.h"
+#include "MemoryTransport.h"
+#include "TelNetClient.h"
+#include "utils.h"
+
+namespace
+{
+    // Heap allocations made by the current thread, counted by the operator new below
+    thread_local unsigned long long allocation_count = 0;
+
+    // Helper function to repeat a server reply after the greeting of a replayed session
+    std::string replayed_session(const std::string& reply, unsigned long long count)
+    {
+        std::string session = "220 Service ready\r\n";
+        session.reserve(session.size() + reply.size() * count);
+        for (unsigned long long i = 0; i < count; i++)
+            session += reply;
+        return session;
+    }
+
+    // Keeps the optimizer from dropping a computed value
+    volatile int sink = 0;
+}
+
+// Counting replacement of the global allocation functions (the array forms use these)
+void* operator new(std::size_t size)
+{
+    allocation_count++;
+    if (void* block = std::malloc(size > 0 ? size : 1))
+        return block;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* block) noexcept { std::free(block); }
+
+void operator delete(void* block, std::size_t) noexcept { std::free(block); }
+
+// Operations per second of the timed run
+double MicroResult::ops_per_second() const
+{
+    return seconds > 0 ? operations / seconds : 0;
+}
+
+// Average time of one operation
+double MicroResult::ns_per_op() const
+{
+    return operations > 0 ? seconds * 1e9 / operations : 0;
+}
+
+// Average heap allocations of one operation
+double MicroResult::allocations_per_op() const
+{
+    return operations > 0 ? (double)allocations / operations : 0;
+}
+
+// Runs a warm-up, then times the operations and counts the allocations they make
+void MicroBenchmark::measure(const std::string& name, unsigned long long operations, const std::function<void(unsigned long long)>& body)
+{
+    using Clock = std::chrono::steady_clock;
+
+    body(operations / 10);
+
+    MicroResult result;
+    result.name = name;
+    result.operations = operations;
+
+    unsigned long long allocations_before = allocation_count;
+    Clock::time_point started = Clock::now();
+    body(operations);
+    result.seconds = std::chrono::duration<double>(Clock::now() - started).count();
+    result.allocations = allocation_count - allocations_before;
+
+    results.push_back(result);
+}
+
+// TelNetClient::recv_response over a replayed stream of one kind of reply
+void MicroBenchmark::bench_recv_response(const char* name, const std::string& reply, unsigned long long replies)
+{
+    TelNetClient client(new MemoryTransport(replayed_session(reply, replies + replies / 10)), "memory", 0);
+
+    measure(name, replies, [&](unsigned long long count)
+    {
+        for (unsigned long long i = 0; i < count; i++)
+            sink = client.recv_response();
+    });
+}
+
+// TelNetClient::send_command: formatting, sending and reading the reply
+void MicroBenchmark::bench_send_command(unsigned long long commands)
+{
+    TelNetClient client(new MemoryTransport(replayed_session("200 NOOP ok\r\n", commands + commands / 10)), "memory", 0);
+
+    measure("send_command", commands, [&](unsigned long long count)
+    {
+        for (unsigned long long i = 0; i < count; i++)
+            sink = client.send_command("NOOP");
+    });
+}
+
+// FTPClient::parse_pasv_addr on a typical address
+void MicroBenchmark::bench_parse_pasv(unsigned long long parses)
+{
+    measure("parse_pasv_addr", parses, [](unsigned long long count)
+    {
+        for (unsigned long long i = 0; i < count; i++)
+        {
+            int a[6]{};
+            FTPClient::parse_pasv_addr("192,168,100,20,195,80)", a);
+            sink = a[5];
+        }
+    });
+}
+
+// CommandInterpreter::execute of a command with a parameter, among commands sharing its first word
+void MicroBenchmark::bench_interpreter(unsigned long long commands)
+{
+    CommandInterpreter ci;
+    std::function<void(const Parameter*)> action = [](const Parameter* p) { sink = p[0].get_value_str()[0]; };
+    std::function<void(const Parameter*)> none = [](const Parameter*) { };
+    ci.register_command(none, "list");
+    ci.register_command(action, "list", Param(0, "path", ParameterType::PATH));
+    ci.register_command(action, "get", Param(0, "path", ParameterType::PATH));
+    ci.register_command(action, "put", Param(0, "path", ParameterType::PATH));
+    ci.register_command(none, "segments", Param(0, "count", ParameterType::INTEGER));
+
+    measure("interpreter_execute", commands, [&](unsigned long long count)
+    {
+        for (unsigned long long i = 0; i < count; i++)
+            ci.execute("get dir/file.bin");
+    });
+}
+
+// CommandInterpreter::execute cycling through every command of a large command set, matched by the trie or by
+// scanning the commands in registration order
+void MicroBenchmark::bench_dispatch(int registered, bool linear, unsigned long long commands)
+{
+    // The interpreter keeps pointers to the literals
+    std::vector<std::string> names;
+    std::vector<std::string> lines;
+    for (int i = 0; i < registered; i++)
+    {
+        names.push_back("command" + std::to_string(i));
+        lines.push_back(names.back() + " dir/file.bin");
+    }
+
+    CommandInterpreter ci;
+    ci.set_linear_dispatch(linear);
+    std::function<void(const Parameter*)> action = [](const Parameter* p) { sink = p[0].get_value_str()[0]; };
+    for (const std::string& name : names)
+        ci.register_command(action, name.c_str(), Param(0, "path", ParameterType::PATH));
+
+    measure("dispatch_" + std::to_string(registered) + (linear ? "_linear" : "_trie"), commands, [&](unsigned long long count)
+    {
+        for (unsigned long long i = 0; i < count; i++)
+            ci.execute(lines[i % lines.size()].c_str());
+    });
+}
+
+// Utils::my_atoi of a 7-digit number
+void MicroBenchmark::bench_atoi(unsigned long long conversions)
+{
+    measure("my_atoi", conversions, [](unsigned long long count)
+    {
+        for (unsigned long long i = 0; i < count; i++)
+            sink = Utils::my_atoi("1234567");
+    });
+}
+
+// ListingParser over a generated listing (one operation per entry), fed in the chunks a data connection delivers
+void MicroBenchmark::bench_parse_listing(const char* name, ListingFormat format, const char* line_format, unsigned long long entries)
+{
+    constexpr unsigned long long ENTRIES_PER_LISTING = 10000;
+
+    std::string text;
+    for (unsigned long long i = 0; i < ENTRIES_PER_LISTING; i++)
+    {
+        char line[128];
+        int length = snprintf(line, sizeof(line), line_format, (i + 1) * 1024, i);
+        text.append(line, length);
+    }
+
+    DirectoryListing listing;
+    measure(name, entries, [&](unsigned long long count)
+    {
+        for (unsigned long long parsed = 0; parsed < count; parsed += ENTRIES_PER_LISTING)
+        {
+            listing.clear();
+            ListingParser parser(listing, format, 0);
+            for (size_t at = 0; at < text.size(); at += FTPClient::DATA_BUFF_SIZE)
+                parser.feed(text.data() + at, std::min<size_t>(FTPClient::DATA_BUFF_SIZE, text.size() - at));
+            parser.finish();
+            sink = (int)listing.count();
+        }
+    });
+}
+
+// Digest::update over data connection sized chunks (one operation per chunk: 1 GB/s is one chunk every 65.5 us)
+void MicroBenchmark::bench_digest(const char* name, HashAlgorithm algorithm, unsigned long long chunks)
+{
+    std::vector<char> chunk(FTPClient::DATA_BUFF_SIZE);
+    for (size_t i = 0; i < chunk.size(); i++)
+        chunk[i] = (char)(i * 131);
+
+    measure(name, chunks, [&](unsigned long long count)
+    {
+        std::unique_ptr<Digest> digest = Digest::create(algorithm);
+        for (unsigned long long i = 0; i < count; i++)
+            digest->update(chunk.data(), chunk.size());
+        sink = (int)digest->hex().size();
+    });
+}
+
+// Runs every case in a fixed order
+void MicroBenchmark::run()
+{
+    results.clear();
+
+    bench_recv_response("recv_response", "213 1048576\r\n", 1000000);
+    bench_recv_response("recv_response_multiline", "211-Features:\r\n MDTM\r\n SIZE\r\n REST STREAM\r\n211 End\r\n", 500000);
+    bench_send_command(1000000);
+    bench_parse_pasv(5000000);
+    bench_interpreter(1000000);
+    bench_dispatch(64, false, 1000000);
+    bench_dispatch(64, true, 1000000);
+    bench_atoi(10000000);
+    bench_parse_listing("parse_mlsd", ListingFormat::MLSD, "type=file;size=%llu;modify=20240101000000; file%07llu\r\n", 5000000);
+    bench_parse_listing("parse_list_unix", ListingFormat::LIST, "-rw-r--r--    1 ftp      ftp      %12llu Jan 01 00:00 file%07llu\r\n", 5000000);
+    bench_parse_listing("parse_list_dos", ListingFormat::LIST, "01-01-24  12:00AM      %12llu file%07llu\r\n", 5000000);
+    bench_digest("digest_crc32", HashAlgorithm::CRC32, 20000);
+    bench_digest("digest_crc32c", HashAlgorithm::CRC32C, 100000);
+    bench_digest("digest_md5", HashAlgorithm::MD5, 5000);
+    bench_digest("digest_sha256", HashAlgorithm::SHA256, 5000);
+}
+
+// Prints one aligned line per case
+void MicroBenchmark::print(std::ostream& o) const
+{
+    char line[160];
+    snprintf(line, sizeof(line), "%-24s %12s %14s %10s %10s\n", "case", "operations", "ops/s", "ns/op", "allocs/op");
+    o << line;
+    for (const MicroResult& result : results)
+    {
+        snprintf(line, sizeof(line), "%-24s %12llu %14.0f %10.1f %10.3f\n", result.name.c_str(), result.operations,
+            result.ops_per_second(), result.ns_per_op(), result.allocations_per_op());
+        o << line;
+    }
+}
+
+// Writes the results as JSON
+void MicroBenchmark::write_json(std::ostream& o) const
+{
+    o << "{\"microbenchmarks\":[\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const MicroResult& result = results[i];
+        o << "{\"name\":\"" << result.name << "\""
+          << ",\"operations\":" << result.operations
+          << ",\"seconds\":" << result.seconds
+          << ",\"ops_per_sec\":" << result.ops_per_second()
+          << ",\"ns_per_op\":" << result.ns_per_op()
+          << ",\"allocs_per_op\":" << result.allocations_per_op()
+          << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    o << "]}\n";
+}
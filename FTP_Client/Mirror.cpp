@@ -0,0 +1,262 @@
+#include "Mirror.h"
+
+#include <filesystem>
+#include <stdexcept>
+#include "ListingCache.h"
+#include "TreeWalker.h"
+
+// Prints what a mirror run is about to do
+void MirrorPlan::print(std::ostream& o) const
+{
+    o << (upload ? "Reverse mirror of " : "Mirror of ") << (root.empty() ? "." : root) << ": "
+      << compared << " files compared, " << unchanged << " unchanged (" << checksummed << " by CRC), "
+      << transfers.size() << " to transfer (" << bytes / (1024.0 * 1024.0) << " MB), "
+      << directories.size() << " directories to create, " << deletions.size() << " to delete";
+    if (skipped > 0)
+        o << ", " << skipped << " links or special files skipped";
+    o << "\n";
+}
+
+// Constructor for Mirror
+Mirror::Mirror(FTPClient* ftp, bool upload, bool delete_extra)
+    : ftp{ ftp }, upload{ upload }, delete_extra{ delete_extra } { }
+
+// Helper function to build the path of an entry of the mirrored directory
+std::string Mirror::join(const std::string& root, const std::string& relative)
+{
+    if (root.empty())
+        return relative;
+    return root == "/" ? root + relative : root + "/" + relative;
+}
+
+// Helper function to check that a path relative to the mirrored directory stays inside it once normalized
+bool Mirror::is_inside(const std::string& relative)
+{
+    std::filesystem::path normal = std::filesystem::path(relative).lexically_normal();
+    return !normal.empty() && !normal.has_root_name() && !normal.has_root_directory()
+        && *normal.begin() != ".." && normal != ".";
+}
+
+// Lists a remote directory and everything under it, on the session pool
+bool Mirror::walk_remote(const std::string& root, Tree& tree, MirrorPlan& plan, bool allow_missing)
+{
+    std::string unsafe;
+    TreeWalker walker(ftp, ftp->get_pool_size());
+    TreeWalkReport report = walker.walk(root.c_str(), [&](const std::string& directory, const ListingEntry& entry)
+    {
+        if (entry.type != EntryType::REGULAR && entry.type != EntryType::DIRECTORY)
+        {
+            plan.skipped++;
+            return true;
+        }
+
+        std::string path = directory.empty() ? std::string(entry.name) : directory + "/" + std::string(entry.name);
+        if (!is_inside(path))
+        {
+            unsafe = path;
+            return false;
+        }
+        bool directory_entry = entry.type == EntryType::DIRECTORY;
+        tree[path] = FileState{ directory_entry, directory_entry ? 0 : entry.size, entry.mtime };
+        return true;
+    });
+
+    if (!unsafe.empty())
+        throw std::runtime_error("The server listed a path outside the mirrored directory: " + unsafe);
+
+    // Only a root that could not be listed at all counts as missing
+    if (report.failed > 0 && report.directories == 0 && allow_missing)
+        return false;
+
+    // Planning from a partial tree would transfer or delete the wrong files
+    if (report.failed > 0)
+        throw std::runtime_error(report.errors.front());
+    return true;
+}
+
+// Lists a local directory and everything under it
+void Mirror::walk_local(const std::string& root, Tree& tree)
+{
+    for (const VirtualFS::FileInfo& info : ftp->get_filesystem()->list_tree(root.empty() ? "." : root))
+    {
+        if (!is_inside(info.path))
+            throw std::runtime_error("Local path outside the mirrored directory: " + info.path);
+        tree[info.path] = FileState{ info.directory, info.directory ? 0 : (long long)info.size, info.mtime };
+    }
+}
+
+// Compares a local file with its remote copy by CRC32, checked is false when the server cannot tell its CRC
+bool Mirror::same_contents(const std::string& path, bool& checked)
+{
+    uint32_t remote_crc;
+    checked = ftp->remote_crc32(path.c_str(), remote_crc);
+    if (!checked)
+        return false;
+
+    // The local index remembers the CRC of every file that has not changed since it was last read
+    return ftp->get_filesystem()->content_crc32(path) == remote_crc;
+}
+
+// Walks both trees and works out the smallest set of changes that makes the destination equal to the source
+MirrorPlan Mirror::plan(const char* path)
+{
+    MirrorPlan plan;
+    plan.root = ListingCache::normalize(path);
+    plan.upload = upload;
+
+    // A missing destination root is created, a missing source root is an error
+    Tree remote, local;
+    bool destination_exists = walk_remote(plan.root, remote, plan, upload);
+    try
+    {
+        walk_local(plan.root, local);
+    }
+    catch (const std::exception&)
+    {
+        if (upload)
+            throw;
+        destination_exists = false;
+    }
+    if (!destination_exists && !plan.root.empty() && plan.root != "/")
+        plan.directories.push_back(plan.root);
+
+    const Tree& source = upload ? local : remote;
+    const Tree& destination = upload ? remote : local;
+
+    // Both maps are sorted, so a directory always comes before what it holds
+    for (const auto& item : source)
+    {
+        const FileState& from = item.second;
+        std::string full_path = join(plan.root, item.first);
+        auto found = destination.find(item.first);
+
+        if (from.directory)
+        {
+            if (found == destination.end() || !found->second.directory)
+                plan.directories.push_back(full_path);
+            continue;
+        }
+
+        bool transfer = found == destination.end() || found->second.directory;
+        if (!transfer)
+        {
+            const FileState& to = found->second;
+            plan.compared++;
+
+            bool sizes_known = from.size >= 0 && to.size >= 0;
+            bool times_known = from.mtime >= 0 && to.mtime >= 0;
+            bool newer = times_known && from.mtime > to.mtime + TIME_TOLERANCE_SECONDS;
+
+            if (sizes_known && from.size != to.size)
+                transfer = true;
+            else if (newer || !times_known)
+            {
+                // Same size but a newer source (or no times to go by): the CRCs tell whether the contents changed
+                bool checked;
+                bool same = same_contents(full_path, checked);
+                if (checked)
+                    plan.checksummed++;
+                if (checked && same && from.mtime >= 0)
+                    plan.retimes.push_back(TransferJob{ full_path, upload, from.mtime });
+                transfer = checked ? !same : newer || !sizes_known;
+            }
+        }
+
+        if (transfer)
+        {
+            plan.transfers.push_back(TransferJob{ full_path, upload, from.mtime });
+            plan.bytes += from.size > 0 ? (unsigned long long)from.size : 0;
+        }
+        else
+            plan.unchanged++;
+    }
+
+    if (delete_extra)
+    {
+        // Reverse order puts "a/b" before "a": a directory is emptied before it is removed
+        for (auto it = destination.rbegin(); it != destination.rend(); ++it)
+        {
+            if (source.count(it->first) == 0)
+            {
+                plan.deletions.push_back(join(plan.root, it->first));
+                plan.deletion_is_directory.push_back(it->second.directory);
+            }
+        }
+    }
+    return plan;
+}
+
+// Applies a plan: directories, transfers on the session pool, times, then deletions
+TransferReport Mirror::run(const MirrorPlan& plan)
+{
+    VirtualFS* filesystem = ftp->get_filesystem();
+    TransferReport report;
+
+    auto attempt = [&report](const std::string& path, const std::function<void()>& action)
+    {
+        try
+        {
+            action();
+        }
+        catch (const std::exception& e)
+        {
+            report.failed++;
+            report.errors.push_back(TransferReport::Error{ -1, path + ": " + e.what() });
+        }
+    };
+
+    for (const std::string& path : plan.directories)
+    {
+        attempt(path, [&]()
+        {
+            if (upload)
+                ftp->make_directory(path.c_str());
+            else
+                filesystem->make_directory(path);
+        });
+    }
+
+    if (!plan.transfers.empty())
+    {
+        TransferScheduler scheduler(ftp, ftp->get_pool_size());
+        TransferReport transfers = scheduler.run(plan.transfers);
+        report.succeeded = transfers.succeeded;
+        report.failed += transfers.failed;
+        report.bytes = transfers.bytes;
+        report.seconds = transfers.seconds;
+        report.errors.insert(report.errors.end(), transfers.errors.begin(), transfers.errors.end());
+        report.warnings.insert(report.warnings.end(), transfers.warnings.begin(), transfers.warnings.end());
+    }
+
+    // The contents already match, a time that cannot be set is only reported
+    for (const TransferJob& job : plan.retimes)
+    {
+        try
+        {
+            if (upload)
+                ftp->set_modified(job.path.c_str(), job.mtime);
+            else
+                filesystem->set_mtime(job.path, job.mtime);
+        }
+        catch (const std::exception& e)
+        {
+            report.warnings.push_back(job.path + ": modification time not set: " + e.what());
+        }
+    }
+
+    for (size_t i = 0; i < plan.deletions.size(); i++)
+    {
+        const std::string& path = plan.deletions[i];
+        bool directory = plan.deletion_is_directory[i];
+        attempt(path, [&]()
+        {
+            if (!upload)
+                filesystem->remove(path);
+            else if (directory)
+                ftp->remove_directory(path.c_str());
+            else
+                ftp->remove(path.c_str());
+        });
+    }
+    return report;
+}
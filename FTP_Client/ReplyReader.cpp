@@ -0,0 +1,81 @@
+#include "ReplyReader.h"
+
+#include <cstring>
+#include "tcp_exception.h"
+#include "utils.h"
+
+// Puts back the byte that was replaced by the terminator of the previously returned line
+void ReplyReader::restore_terminator()
+{
+    if (!has_saved) return;
+    buffer[saved_pos] = saved_char;
+    has_saved = false;
+}
+
+// Receives the next chunk from the socket, compacting the unread bytes to the front if needed
+void ReplyReader::fill(TCP& tcp)
+{
+    if (begin == end)
+    {
+        // Everything was consumed, start over at the beginning of the buffer
+        begin = end = scanned = 0;
+    }
+    else if (end == BUFFER_SIZE)
+    {
+        // A single line filling the whole buffer can never be completed
+        if (begin == 0)
+            throw tcp_exception("Reply line too long");
+
+        size_t pending = end - begin;
+        memmove(buffer, buffer + begin, pending);
+        scanned -= begin;
+        end = pending;
+        begin = 0;
+    }
+
+    TCPResult result = tcp.recv(buffer + end, BUFFER_SIZE - end);
+    if (!result.ok)
+        throw tcp_exception(result.get_error_message());
+    if (result.bytes_count == 0)
+        throw tcp_exception("Connection interrupted during recv");
+
+    end += result.bytes_count;
+}
+
+// Returns the next complete line, receiving more data only when the buffer holds no full line
+std::string_view ReplyReader::read_line(TCP& tcp)
+{
+    restore_terminator();
+
+    while (true)
+    {
+        const char* lf = Utils::find_char(buffer + scanned, end - scanned, '\n');
+        if (lf != nullptr)
+        {
+            size_t line_end = (size_t)(lf - buffer) + 1;
+            std::string_view line{ buffer + begin, line_end - begin };
+
+            // Terminate the line in place; the overwritten byte belongs to the next reply
+            if (line_end < end)
+            {
+                saved_pos = line_end;
+                saved_char = buffer[line_end];
+                has_saved = true;
+            }
+            buffer[line_end] = '\0';
+
+            begin = scanned = line_end;
+            return line;
+        }
+
+        scanned = end;
+        fill(tcp);
+    }
+}
+
+// Drops all buffered bytes
+void ReplyReader::reset()
+{
+    begin = end = scanned = 0;
+    has_saved = false;
+}
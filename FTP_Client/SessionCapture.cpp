@@ -0,0 +1,206 @@
+#include "SessionCapture.h"
+
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include "bout.h"
+
+namespace
+{
+    // Helper function to read one LEB128 varint, false at the end of the file
+    bool read_varint(std::istream& in, unsigned long long& value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            int byte = in.get();
+            if (byte == EOF)
+                return false;
+            value |= (unsigned long long)(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+        throw std::runtime_error("Malformed capture: varint too long");
+    }
+}
+
+// Opens (truncates) the capture file and writes its header
+void SessionRecorder::open(const char* path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        throw std::runtime_error(bout() << "Cannot write capture " << path << bfin);
+
+    file.write(MAGIC, strlen(MAGIC));
+    started = last_event = std::chrono::steady_clock::now();
+    next_channel = 0;
+}
+
+// Flushes and closes the capture file
+void SessionRecorder::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file.is_open())
+        file.close();
+}
+
+// Creates a socket transport whose traffic is recorded here
+Transport* SessionRecorder::create_transport(bool control)
+{
+    return new RecordingTransport(Transport::create_socket(), this, control);
+}
+
+// Writes a value as a LEB128 varint (7 bits per byte, high bit set on all but the last)
+void SessionRecorder::write_varint(unsigned long long value)
+{
+    char bytes[10];
+    int n = 0;
+    do
+    {
+        bytes[n] = (char)(value & 0x7F);
+        value >>= 7;
+        if (value != 0)
+            bytes[n] |= (char)0x80;
+        n++;
+    } while (value != 0);
+    file.write(bytes, n);
+}
+
+// Assigns the next channel and records its connection
+unsigned SessionRecorder::open_channel(bool control)
+{
+    unsigned channel;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        channel = next_channel++;
+    }
+    record(CaptureEvent::CONNECT, channel, control ? "C" : "D", 1);
+    return channel;
+}
+
+// Appends one event, timed against the previous one
+void SessionRecorder::record(CaptureEvent::Kind kind, unsigned channel, const char* data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open())
+        return;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    unsigned long long delta_us = (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(now - last_event).count();
+    last_event = now;
+
+    file.put((char)kind);
+    write_varint(channel);
+    write_varint(delta_us);
+    write_varint(size);
+    file.write(data, size);
+}
+
+// Reads every event of a capture file
+std::vector<CaptureEvent> SessionRecorder::load(const char* path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error(bout() << "Cannot open capture " << path << bfin);
+
+    char magic[8] = {};
+    in.read(magic, sizeof(magic));
+    if (!in || memcmp(magic, MAGIC, sizeof(magic)) != 0)
+        throw std::runtime_error(bout() << path << " is not a session capture" << bfin);
+
+    std::vector<CaptureEvent> events;
+    unsigned long long time_us = 0;
+    while (true)
+    {
+        int kind = in.get();
+        if (kind == EOF)
+            break;
+        if (kind > CaptureEvent::CLOSE)
+            throw std::runtime_error("Malformed capture: unknown event");
+
+        unsigned long long channel = 0, delta_us = 0, size = 0;
+        if (!read_varint(in, channel) || !read_varint(in, delta_us) || !read_varint(in, size))
+            throw std::runtime_error("Malformed capture: truncated event");
+
+        time_us += delta_us;
+        CaptureEvent event{ (CaptureEvent::Kind)kind, (unsigned)channel, time_us, std::string((size_t)size, '\0') };
+        in.read(&event.bytes[0], (std::streamsize)size);
+        if ((unsigned long long)in.gcount() != size)
+            throw std::runtime_error("Malformed capture: truncated payload");
+
+        events.push_back(std::move(event));
+    }
+    return events;
+}
+
+// Constructor for RecordingTransport
+RecordingTransport::RecordingTransport(Transport* inner, SessionRecorder* recorder, bool control)
+    : inner{ inner }, recorder{ recorder }, control{ control } { }
+
+// Records what a successful send/recv moved and passes its result on (failures keep last_error intact)
+int RecordingTransport::record(CaptureEvent::Kind kind, int result, const char* data)
+{
+    if (result <= 0)
+        return result;
+
+    if (control && kind == CaptureEvent::SENT)
+    {
+        std::string bytes(data, (size_t)result);
+        redact(bytes);
+        recorder->record(kind, channel, bytes.data(), bytes.size());
+    }
+    else
+        recorder->record(kind, channel, data, (size_t)result);
+    return result;
+}
+
+// Masks passwords in sent control bytes; the replay only counts the bytes a client sends, so the length is kept
+void RecordingTransport::redact(std::string& bytes)
+{
+    static constexpr const char* PASS_VERB = "PASS ";
+    static constexpr size_t PASS_VERB_LENGTH = 5;
+
+    for (char& c : bytes)
+    {
+        if (c == '\r' || c == '\n')
+        {
+            hiding = false;
+            line_head.clear();
+        }
+        else if (hiding)
+            c = '*';
+        else if (line_head.size() < PASS_VERB_LENGTH)
+        {
+            line_head += (char)toupper((unsigned char)c);
+            hiding = line_head == PASS_VERB;
+        }
+    }
+}
+
+// Connects and starts a new channel in the capture
+void RecordingTransport::connect(const char* host, int port)
+{
+    inner->connect(host, port);
+    channel = recorder->open_channel(control);
+    connected = true;
+}
+
+// Records the end of the channel and closes it
+void RecordingTransport::close()
+{
+    if (connected)
+    {
+        recorder->record(CaptureEvent::CLOSE, channel, nullptr, 0);
+        connected = false;
+    }
+    inner->close();
+}
+
+// Destructor closes the connection and deletes the wrapped transport
+RecordingTransport::~RecordingTransport()
+{
+    close();
+    delete inner;
+}
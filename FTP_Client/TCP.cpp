@@ -1,25 +1,52 @@
 // Include necessary headers for networking and system functionality
 #include "TCP.h"
 
+#ifdef _WIN32
 #define _WIN32_WINNT 0x601 // Define minimum Windows version (Windows 7 or later)
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 
 #include <winsock2.h>
 #include <ws2tcpip.h>
-#include <sys/types.h>
-#include <exception>
-#include <string>
+#include <mswsock.h>
+#include <io.h>
 
 #pragma comment(lib, "Ws2_32.lib") // Link against Winsock library
 #pragma comment(lib, "Mswsock.lib") // Link against Windows socket extensions
 #pragma comment(lib, "AdvApi32.lib") // Link against Advanced Windows API library
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <chrono>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif
+
+#include <sys/types.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <climits>
 
 #include "bufferf.h"
 #include "tcp_exception.h"
+#include "Trace.h"
 #include <bout.h>
 
-// Private class for handling the internal socket connection
-class TCP::__privates__ {
+// Value returned by send_some/recv_some when the operation would block
+static constexpr int SOCKET_WOULD_BLOCK = Transport::WOULD_BLOCK;
+
+#ifdef _WIN32
+// Transport over a socket connection (blocking Winsock sockets)
+class SocketTransport final : public Transport {
 private:
     SOCKET sockd = INVALID_SOCKET; // Socket descriptor (initialized to invalid)
     addrinfo* server = nullptr;    // Pointer to server address information
@@ -28,23 +55,23 @@ private:
 
 public:
     // Constructor initializes Winsock
-    __privates__() {
+    SocketTransport() {
         WSADATA wsaData;
         int iResult = WSAStartup(MAKEWORD(2, 2), &wsaData); // Initialize Winsock
         if (iResult != 0) {
-            throw std::exception(bout() << "WSAStartup failed with error:" << iResult << bfin);
+            throw std::runtime_error(bout() << "WSAStartup failed with error:" << iResult << bfin);
         }
     }
 
     // Set socket timeout in seconds
-    void set_timeout(int seconds) {
+    void set_timeout(int seconds) override {
         DWORD timeout = seconds * 1000; // Convert seconds to milliseconds
         setsockopt(sockd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout)); // Set receive timeout
         setsockopt(sockd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout)); // Set send timeout
     }
 
     // Establish connection to the given host and port
-    void connect(const char* host, int port) {
+    void connect(const char* host, int port) override {
         close(); // Close any existing connection
         sockd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP); // Create a TCP socket
         addrinfo hints{};
@@ -54,14 +81,14 @@ public:
 
         char port_str[20] = { 0 };
         if (_itoa_s(port, port_str, 10) != 0) {
-            throw std::exception(bout() << "Failed to convert port number to string: " << port << bfin);
+            throw std::runtime_error(bout() << "Failed to convert port number to string: " << port << bfin);
         }
 
         addrinfo* result = nullptr;
         int iResult = getaddrinfo(host, port_str, &hints, &result); // Get address info for the host and port
         if (iResult != 0) {
             WSACleanup(); // Cleanup Winsock
-            throw std::exception(bout() << "getaddrinfo failed with error:" << iResult << bfin);
+            throw std::runtime_error(bout() << "getaddrinfo failed with error:" << iResult << bfin);
         }
 
         // Iterate through possible results to find a valid connection
@@ -70,7 +97,7 @@ public:
             sockd = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol); // Create socket
             if (sockd == INVALID_SOCKET) {
                 WSACleanup(); // Cleanup Winsock
-                throw std::exception("socket failed with error: %ld\n", WSAGetLastError());
+                throw std::runtime_error(bout() << "socket failed with error: " << WSAGetLastError() << bfin);
             }
 
             // Attempt to connect to the server
@@ -97,25 +124,89 @@ public:
             return; // Successfully connected
         }
 
-        throw std::exception("Connection failed"); // Throw exception if connection attempt fails
+        throw std::runtime_error("Connection failed"); // Throw exception if connection attempt fails
     }
 
     // Getters for IP and port
-    int get_port() const { return port; }
-    const char* get_ip() const { return ip; }
+    int get_port() const override { return port; }
+    const char* get_ip() const override { return ip; }
+    long long get_native_handle() const override { return (long long)sockd; }
+
+    // Error code of the last failed socket call
+    int last_error() const override { return WSAGetLastError(); }
 
     // Send data through the socket
-    int send(const char* buffer, size_t size) {
+    int send(const char* buffer, size_t size) override {
         return ::send(sockd, buffer, (int)size, 0); // Send data to the server
     }
 
     // Receive data from the socket
-    int recv(char* buffer, size_t size) {
+    int recv(char* buffer, size_t size) override {
         return ::recv(sockd, buffer, (int)size, 0); // Receive data from the server
     }
 
+    // Check without waiting whether the socket is ready for reading or writing
+    bool is_ready(bool for_write) {
+        fd_set set;
+        FD_ZERO(&set);
+        FD_SET(sockd, &set);
+        timeval no_wait{};
+        int n = for_write ? select(0, NULL, &set, NULL, &no_wait) : select(0, &set, NULL, NULL, &no_wait);
+        return n > 0;
+    }
+
+    // Single send/recv attempt that reports SOCKET_WOULD_BLOCK instead of waiting
+    int send_some(const char* buffer, size_t size) override { return is_ready(true) ? send(buffer, size) : SOCKET_WOULD_BLOCK; }
+    int recv_some(char* buffer, size_t size) override { return is_ready(false) ? recv(buffer, size) : SOCKET_WOULD_BLOCK; }
+
+    // Connected with nothing to read: a closed or reset connection reports readable
+    bool is_idle() override { return sockd != INVALID_SOCKET && !is_ready(false); }
+
+    // Send a file region straight from the kernel page cache (TransmitFile) without copying it through user space
+    // Returns the number of bytes sent; stops early and returns what was sent if the call is not supported
+    unsigned long long send_file(int fd, unsigned long long offset, unsigned long long size) override {
+        HANDLE file = (HANDLE)_get_osfhandle(fd);
+        if (file == INVALID_HANDLE_VALUE) return 0;
+
+        unsigned long long sent = 0;
+        while (sent < size) {
+            // TransmitFile sends at most INT_MAX - 1 bytes per call
+            unsigned long long left = size - sent;
+            DWORD chunk = left > INT_MAX - 1 ? INT_MAX - 1 : (DWORD)left;
+
+            OVERLAPPED position{};
+            position.Offset = (DWORD)((offset + sent) & 0xFFFFFFFF);
+            position.OffsetHigh = (DWORD)((offset + sent) >> 32);
+            position.hEvent = WSACreateEvent();
+
+            BOOL done = TransmitFile(sockd, file, chunk, 0, &position, NULL, 0);
+            if (!done && WSAGetLastError() != ERROR_IO_PENDING) {
+                int error = WSAGetLastError();
+                WSACloseEvent(position.hEvent);
+                if (sent == 0 && error == WSAEOPNOTSUPP) return 0; // zero-copy not available, let the caller copy
+                throw tcp_exception(TCPResult::fail(error).get_error_message());
+            }
+
+            DWORD transferred = 0, flags = 0;
+            BOOL ok = WSAGetOverlappedResult(sockd, &position, &transferred, TRUE, &flags);
+            int error = WSAGetLastError();
+            WSACloseEvent(position.hEvent);
+            if (!ok)
+                throw tcp_exception(TCPResult::fail(error).get_error_message());
+
+            sent += transferred;
+        }
+        return sent;
+    }
+
+    // Read a file region at the given offset, used by the copying fallback of send_file
+    static int read_file(int fd, unsigned long long offset, char* buffer, int size) {
+        if (_lseeki64(fd, (long long)offset, SEEK_SET) < 0) return -1;
+        return _read(fd, buffer, (unsigned int)size);
+    }
+
     // Close the socket connection
-    void close() {
+    void close() override {
         if (sockd != INVALID_SOCKET) {
             closesocket(sockd); // Close socket
             sockd = INVALID_SOCKET; // Mark socket as invalid
@@ -123,35 +214,292 @@ public:
     }
 
     // Destructor ensures that the socket is closed when the object is destroyed
-    ~__privates__() { close(); }
+    ~SocketTransport() override { close(); }
+};
+#else
+// Transport over a socket connection (non-blocking POSIX sockets).
+// The blocking calls wait for readiness with poll() and honour the timeout set with set_timeout.
+class SocketTransport final : public Transport {
+private:
+    int sockd = -1;                // Socket descriptor (-1 when closed)
+    int port = 0;                  // Local port number
+    char ip[100] = {};             // Local IP address as a string
+    int timeout_ms = -1;           // Deadline for each blocking operation, -1 waits forever
+
+    // Put a descriptor in non-blocking mode
+    static bool set_nonblocking(int fd) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+
+    // Wait until the socket is ready for the given poll events, false on timeout (errno = ETIMEDOUT)
+    bool wait(short events) {
+        pollfd pfd{ sockd, events, 0 };
+        while (true) {
+            int n = ::poll(&pfd, 1, timeout_ms);
+            if (n > 0) return true;
+            if (n == 0) { errno = ETIMEDOUT; return false; }
+            if (errno != EINTR) return false;
+        }
+    }
+
+public:
+    // Constructor: a peer closing the connection must surface as EPIPE, not kill the process
+    SocketTransport() {
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    // Set the timeout in seconds for each blocking operation (0 or less waits forever)
+    void set_timeout(int seconds) override { timeout_ms = seconds > 0 ? seconds * 1000 : -1; }
+
+    // Establish connection to the given host and port without blocking past the timeout
+    void connect(const char* host, int port) override {
+        close(); // Close any existing connection
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+
+        std::string port_str = std::to_string(port);
+        addrinfo* result = nullptr;
+        int iResult = getaddrinfo(host, port_str.c_str(), &hints, &result); // Get address info for the host and port
+        if (iResult != 0) {
+            throw std::runtime_error(bout() << "getaddrinfo failed with error:" << gai_strerror(iResult) << bfin);
+        }
+
+        // Iterate through possible results to find a valid connection
+        for (addrinfo* ptr = result; ptr != NULL; ptr = ptr->ai_next) {
+            sockd = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol); // Create socket
+            if (sockd < 0) {
+                freeaddrinfo(result);
+                throw std::runtime_error(bout() << "socket failed with error: " << errno << bfin);
+            }
+            fcntl(sockd, F_SETFD, FD_CLOEXEC);
+
+            if (!set_nonblocking(sockd)) {
+                ::close(sockd);
+                sockd = -1;
+                continue;
+            }
+
+            // Non-blocking connect: wait for writability, then read the outcome from SO_ERROR
+            int iResult = ::connect(sockd, ptr->ai_addr, ptr->ai_addrlen);
+            if (iResult < 0 && errno == EINPROGRESS && wait(POLLOUT)) {
+                int error = 0;
+                socklen_t len = sizeof(error);
+                getsockopt(sockd, SOL_SOCKET, SO_ERROR, &error, &len);
+                iResult = error == 0 ? 0 : -1;
+            }
+            if (iResult < 0) {
+                ::close(sockd);
+                sockd = -1;
+                continue; // Try next address
+            }
+
+            int one = 1;
+            setsockopt(sockd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            sockaddr_storage struc_{};
+            socklen_t struc_len = sizeof(struc_);
+            if (getsockname(sockd, (sockaddr*)&struc_, &struc_len) == 0) {
+                // Retrieve local IP address and port number
+                if (struc_.ss_family == AF_INET) {
+                    inet_ntop(AF_INET, &((sockaddr_in*)&struc_)->sin_addr, ip, sizeof(ip));
+                    this->port = ntohs(((sockaddr_in*)&struc_)->sin_port);
+                }
+                else {
+                    inet_ntop(AF_INET6, &((sockaddr_in6*)&struc_)->sin6_addr, ip, sizeof(ip));
+                    this->port = ntohs(((sockaddr_in6*)&struc_)->sin6_port);
+                }
+            }
+
+            freeaddrinfo(result);
+            return; // Successfully connected
+        }
+
+        freeaddrinfo(result);
+        throw std::runtime_error("Connection failed"); // Throw exception if connection attempt fails
+    }
+
+    // Getters for IP and port
+    int get_port() const override { return port; }
+    const char* get_ip() const override { return ip; }
+    long long get_native_handle() const override { return sockd; }
+
+    // Connected with nothing to read: data, end of stream and errors all wake poll up
+    bool is_idle() override {
+        if (sockd < 0) return false;
+        pollfd pfd{ sockd, POLLIN, 0 };
+        return ::poll(&pfd, 1, 0) == 0;
+    }
+
+    // Error code of the last failed socket call
+    int last_error() const override { return errno; }
+
+    // Single send attempt, SOCKET_WOULD_BLOCK if the socket buffer is full
+    int send_some(const char* buffer, size_t size) override {
+        while (true) {
+            ssize_t n = ::send(sockd, buffer, size, MSG_NOSIGNAL);
+            if (n >= 0) return (int)n;
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? SOCKET_WOULD_BLOCK : -1;
+        }
+    }
+
+    // Single recv attempt, SOCKET_WOULD_BLOCK if nothing has arrived yet
+    int recv_some(char* buffer, size_t size) override {
+        while (true) {
+            ssize_t n = ::recv(sockd, buffer, size, 0);
+            if (n >= 0) return (int)n;
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? SOCKET_WOULD_BLOCK : -1;
+        }
+    }
+
+    // Blocking send: waits for buffer space until every byte is handed to the kernel
+    int send(const char* buffer, size_t size) override {
+        size_t sent = 0;
+        while (sent < size) {
+            int n = send_some(buffer + sent, size - sent);
+            if (n == SOCKET_WOULD_BLOCK) {
+                if (!wait(POLLOUT)) return sent > 0 ? (int)sent : -1;
+                continue;
+            }
+            if (n < 0) return sent > 0 ? (int)sent : -1;
+            sent += n;
+        }
+        return (int)sent;
+    }
+
+    // Blocking recv: waits until at least one byte (or end of stream) is available
+    int recv(char* buffer, size_t size) override {
+        while (true) {
+            int n = recv_some(buffer, size);
+            if (n != SOCKET_WOULD_BLOCK) return n;
+            if (!wait(POLLIN)) return -1;
+        }
+    }
+
+    // Send a file region with sendfile (Linux), waiting for buffer space as needed
+    // Returns the number of bytes sent; 0 when zero-copy is not available so the caller copies instead
+    unsigned long long send_file(int fd, unsigned long long offset, unsigned long long size) override {
+#ifdef __linux__
+        unsigned long long sent = 0;
+        while (sent < size) {
+            off_t position = (off_t)(offset + sent);
+            ssize_t n = ::sendfile(sockd, fd, &position, (size_t)(size - sent));
+            if (n > 0) { sent += n; continue; }
+            if (n == 0) break; // file shorter than expected, let the copy loop report it
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                if (!wait(POLLOUT))
+                    throw tcp_exception(TCPResult::fail(errno).get_error_message());
+                continue;
+            }
+            if (sent == 0 && (errno == EINVAL || errno == ENOSYS)) return 0;
+            throw tcp_exception(TCPResult::fail(errno).get_error_message());
+        }
+        return sent;
+#else
+        return 0;
+#endif
+    }
+
+    // Read a file region at the given offset, used by the copying fallback of send_file
+    static int read_file(int fd, unsigned long long offset, char* buffer, int size) {
+        return (int)pread(fd, buffer, (size_t)size, (off_t)offset);
+    }
+
+    // Close the socket connection
+    void close() override {
+        if (sockd >= 0) {
+            ::close(sockd);
+            sockd = -1;
+        }
+    }
+
+    // Destructor ensures that the socket is closed when the object is destroyed
+    ~SocketTransport() override { close(); }
 };
+#endif
+
+// Create the default transport, a socket
+Transport* Transport::create_socket() { return new SocketTransport(); }
 
-// TCP class constructor
-TCP::TCP() { privates = new __privates__(); }
+// TCP class constructor, on a socket
+TCP::TCP() { transport = new SocketTransport(); }
+
+// TCP class constructor on another transport, owned from now on (nullptr: a socket)
+TCP::TCP(Transport* transport) : transport{ transport != nullptr ? transport : new SocketTransport() } { }
 
 // Connect to a host and port
-void TCP::connect(const char* host, int port) { privates->connect(host, port); }
+void TCP::connect(const char* host, int port) {
+    TraceSpan span("connect");
+    transport->connect(host, port);
+}
 
 // Send data and return a TCPResult object indicating success or failure
 TCPResult TCP::send(const void* buffer, size_t size) {
-    int sent_result = privates->send(static_cast<const char*>(buffer), size); // Send the data
-    if (sent_result < 0) return TCPResult::fail(WSAGetLastError()); // Return failure if error
+    int sent_result = transport->send(static_cast<const char*>(buffer), size); // Send the data
+    if (sent_result < 0) return TCPResult::fail(transport->last_error()); // Return failure if error
     return TCPResult::success(sent_result); // Return success with sent bytes count
 }
 
 // Receive data and return a TCPResult object indicating success or failure
 TCPResult TCP::recv(void* buffer, size_t size) {
-    int recv_result = privates->recv(static_cast<char*>(buffer), size); // Receive the data
-    if (recv_result < 0) return TCPResult::fail(WSAGetLastError()); // Return failure if error
+    int recv_result = transport->recv(static_cast<char*>(buffer), size); // Receive the data
+    if (recv_result < 0) return TCPResult::fail(transport->last_error()); // Return failure if error
     return TCPResult::success(recv_result); // Return success with received bytes count
 }
 
+// Single non-blocking send attempt; TCPResult::is_would_block() tells that nothing could be sent yet
+TCPResult TCP::send_some(const void* buffer, size_t size) {
+    int sent_result = transport->send_some(static_cast<const char*>(buffer), size);
+    if (sent_result == SOCKET_WOULD_BLOCK) return TCPResult::would_block();
+    if (sent_result < 0) return TCPResult::fail(transport->last_error());
+    return TCPResult::success(sent_result);
+}
+
+// Single non-blocking recv attempt; bytes_count 0 with ok set means the peer closed the connection
+TCPResult TCP::recv_some(void* buffer, size_t size) {
+    int recv_result = transport->recv_some(static_cast<char*>(buffer), size);
+    if (recv_result == SOCKET_WOULD_BLOCK) return TCPResult::would_block();
+    if (recv_result < 0) return TCPResult::fail(transport->last_error());
+    return TCPResult::success(recv_result);
+}
+
 // Ensure the data is sent successfully
 void TCP::ensure_send(void* buffer, size_t size) { send(buffer, size).validate_send(size); }
 
 // Ensure the data is received successfully
 void TCP::ensure_recv(void* buffer, size_t size) { recv(buffer, size).validate_recv(size); }
 
+// Send 'size' bytes of the file 'fd' starting at 'offset', looping until everything is sent
+// Uses the zero-copy path first and falls back to a chunked read/send loop for whatever it did not send
+void TCP::ensure_send_file(int fd, unsigned long long offset, unsigned long long size) {
+    unsigned long long sent = transport->send_file(fd, offset, size);
+    if (sent == size) return;
+
+    std::vector<char> chunk(SEND_FILE_CHUNK_SIZE);
+    while (sent < size) {
+        unsigned long long left = size - sent;
+        int want = left > chunk.size() ? (int)chunk.size() : (int)left;
+        int got = SocketTransport::read_file(fd, offset + sent, chunk.data(), want);
+        if (got <= 0)
+            throw tcp_exception(bout() << "File read failed after " << (long long)sent << " bytes" << bfin);
+
+        // send() may accept fewer bytes than requested, keep going until the chunk is out
+        for (int k = 0; k < got; ) {
+            TCPResult result = send(chunk.data() + k, got - k);
+            if (!result.ok || result.bytes_count == 0)
+                throw tcp_exception(result.get_error_message());
+            k += result.bytes_count;
+        }
+        sent += got;
+    }
+}
+
 // Send an integer as a 32-bit value
 TCPResult TCP::send_i32(int n) {
     int x = htonl(n); // Convert to network byte order (big-endian)
@@ -186,16 +534,22 @@ TCPResponse<char> TCP::recv_i8() {
 }
 
 // Set the timeout for socket operations
-void TCP::set_timeout(int seconds) { privates->set_timeout(seconds); }
+void TCP::set_timeout(int seconds) { transport->set_timeout(seconds); }
 
 // Get the port number
-int TCP::get_port() const { return privates->get_port(); }
+int TCP::get_port() const { return transport->get_port(); }
 
 // Get the IP address
-const char* TCP::get_ip() const { return privates->get_ip(); }
+const char* TCP::get_ip() const { return transport->get_ip(); }
+
+// Get the OS socket handle (used to register the socket with an event loop)
+long long TCP::get_native_handle() const { return transport->get_native_handle(); }
+
+// Check whether the connection is open and the peer has sent nothing (not even a close)
+bool TCP::is_idle() const { return transport->is_idle(); }
 
 // Close the socket connection
-void TCP::close() { privates->close(); }
+void TCP::close() { transport->close(); }
 
-// Destructor ensures that the private connection object is cleaned up
-TCP::~TCP() { delete privates; }
+// Destructor ensures that the transport is cleaned up
+TCP::~TCP() { delete transport; }
@@ -1,11 +1,21 @@
 #include "TCPResult.h"
+#ifdef _WIN32
 #include <winsock.h>
+#else
+#include <cstring>
+#endif
 #include "tcp_exception.h"
 #include <bout.h>
 
 // Method to retrieve the error message for a socket error, using the error code from the system
-const char* TCPResult::get_error_message()
+std::string TCPResult::get_error_message()
 {
+    if (error_code == WOULD_BLOCK)
+        return "Socket error: operation would block";
+    if (error_code == TIMED_OUT)
+        return "Socket error: operation timed out";
+
+#ifdef _WIN32
     wchar_t msgbuf[256]{};  // Buffer to hold the error message (wide characters)
     msgbuf[0] = '\0';  // Initialize the buffer to empty string
 
@@ -20,6 +30,10 @@ const char* TCPResult::get_error_message()
 
     // Return the formatted error message, appending the error code to the message
     return bout() << "Socket error " << error_code << ": " << msgbuf << bfin;
+#else
+    // Return the system error message, appending the error code to the message
+    return bout() << "Socket error " << error_code << ": " << strerror(error_code) << bfin;
+#endif
 }
 
 // Method to validate the result of a send operation
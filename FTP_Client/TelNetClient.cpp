@@ -1,9 +1,13 @@
 #include "TelNetClient.h"
+#include <algorithm>
 #include <exception>
 #include <bout.h>
+#include "tcp_exception.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 // Constructor to initialize the TelNetClient with the server IP, port, and a callback function for line reception
-TelNetClient::TelNetClient(const char* ip, int port, std::function<void(char*)> line_received_callback)
+TelNetClient::TelNetClient(const char* ip, int port, std::function<void(const char*)> line_received_callback)
     : line_received_callback{ line_received_callback }, ip{ ip }, port{ port }
 {
     try
@@ -18,13 +22,22 @@ TelNetClient::TelNetClient(const char* ip, int port, std::function<void(char*)>
         // Receive the server greeting response
         recv_response();
     }
-    catch (std::exception& e)
+    catch (std::exception&)
     {
         // If an exception occurs during connection, propagate the exception
-        throw e;
+        throw;
     }
 }
 
+// Constructor for a control connection running on the given transport instead of a socket
+TelNetClient::TelNetClient(Transport* transport, const char* ip, int port, std::function<void(const char*)> line_received_callback)
+    : tcp{ transport }, line_received_callback{ line_received_callback }, ip{ ip }, port{ port }
+{
+    tcp.connect(ip, port);
+    tcp.set_timeout(3);
+    recv_response();
+}
+
 // Reconnect method to handle reconnection to the server
 void TelNetClient::reconnect()
 {
@@ -34,7 +47,8 @@ void TelNetClient::reconnect()
     if (is_connected)
         close();
 
-    // Reconnect to the server
+    // Reconnect to the server, dropping anything left over from the previous connection
+    reader.reset();
     tcp.connect(ip, port);
 
     // Receive the server greeting again after reconnection
@@ -47,33 +61,26 @@ void TelNetClient::close()
 {
     is_connected = false;
     tcp.close();
+    reader.reset();
 }
 
 // Send a command to the server and receive the response
 int TelNetClient::send_command(const char* command)
 {
-    // Format the command by appending carriage return and newline
-    command = bout() << command << "\r\n" << bfin;
+    TraceSpan span("send_command", command);
 
-    size_t len = strlen(command);  // Get the length of the command string
+    // Format the command by appending carriage return and newline (on the stack, no allocation)
+    bout line;
+    line << command << "\r\n";
 
     // Send the command to the server over TCP
-    tcp.send(command, len);
+    Metrics::Clock::time_point sent_at = Metrics::Clock::now();
+    tcp.send(line.data(), line.size());
 
-    // Receive and return the server's response code
-    return recv_response();
-}
-
-namespace
-{
-    // Helper function to read a line from the TCP connection
-    void read_line(TCP& tcp, char* buffer)
-    {
-        char* c = buffer;
-        // Read characters from the TCP connection until a newline character is encountered
-        for (; (*c = tcp.recv_i8()) != 0x0A; c++);
-        *(++c) = '\0';  // Null-terminate the string after the newline
-    }
+    // Receive and return the server's response code, timing the round trip per verb
+    int code = recv_response();
+    Metrics::instance().record_command(command, Metrics::elapsed_us(sent_at));
+    return code;
 }
 
 namespace
@@ -83,33 +90,114 @@ namespace
     {
         return (code[0] - '0') * 100 + (code[1] - '0') * 10 + (code[2] - '0');
     }
+
+    // Helper function to reject lines too short to carry a response code
+    void validate_reply_line(std::string_view line)
+    {
+        if (line.size() < 4)
+            throw tcp_exception("Malformed server reply");
+    }
 }
 
 // Method to receive a response from the server, including handling multi-line responses
 int TelNetClient::recv_response()
 {
-    char first_line[2048] = { 0 };  // Buffer to store the first line of the response
-    char buffer[2048] = { 0 };      // Buffer to store subsequent lines
+    TraceSpan span("recv_response");
 
-    // Read the first line of the response from the server
-    read_line(tcp, first_line);
+    // Read the first line of the response from the buffered reader
+    std::string_view line = reader.read_line(tcp);
+    validate_reply_line(line);
 
     // Invoke the callback function with the first line
-    line_received_callback(first_line);
+    line_received_callback(line.data());
+
+    // The line view is only valid until the next read, so keep a copy (its capacity is reused between replies)
+    first_line.assign(line.data(), line.size());
+    const char* code = first_line.c_str();
 
     // If the first line contains a response code (3 digits followed by a space), return the response code
-    if (first_line[3] == ' ') return response_code_to_int(first_line);
+    if (first_line[3] == ' ')
+    {
+        Metrics::instance().record_reply(response_code_to_int(code));
+        return response_code_to_int(code);
+    }
 
-    // If the first line doesn't contain a response code, keep reading lines until we find one
-    while (buffer[0] != first_line[0] || buffer[1] != first_line[1] || buffer[2] != first_line[2] || buffer[3] != ' ')
+    // Otherwise keep reading lines until the one starting with the same code followed by a space;
+    // bytes after it stay buffered for the next response
+    while (true)
     {
         // Read the next line of the response
-        read_line(tcp, buffer);
+        line = reader.read_line(tcp);
 
         // Invoke the callback function with the new line
-        line_received_callback(buffer);
+        line_received_callback(line.data());
+
+        if (line.size() >= 4 && line[0] == code[0] && line[1] == code[1] && line[2] == code[2] && line[3] == ' ')
+            break;
     }
 
     // Return the response code from the first line
-    return response_code_to_int(first_line);
+    Metrics::instance().record_reply(response_code_to_int(code));
+    return response_code_to_int(code);
+}
+
+// Queue a command for the next flush_pipeline; on_reply runs once its reply has been read
+void TelNetClient::queue_command(const char* command, ReplyHandler on_reply)
+{
+    pipeline.push_back(PipelinedCommand{ command, std::move(on_reply) });
+}
+
+// Send the queued commands through a sliding window and match the replies to them in order (RFC 959 replies
+// come in command order): the window is refilled while the replies to earlier commands are still arriving
+void TelNetClient::flush_pipeline()
+{
+    TraceSpan span("flush_pipeline");
+
+    std::vector<PipelinedCommand> commands;
+    commands.swap(pipeline);
+
+    std::vector<Metrics::Clock::time_point> sent_at(commands.size());
+    std::string batch;
+    std::exception_ptr handler_error;
+    size_t next = 0;            // first command not written yet
+    size_t outstanding = 0;     // bytes written whose reply has not been read
+
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        // Top the window up once half of it has been answered (always at least one command in flight)
+        if (next < commands.size() && (next == i || outstanding <= PIPELINE_WINDOW_BYTES / 2))
+        {
+            size_t written = next;
+            batch.clear();
+            while (next < commands.size() && (next == i || outstanding + batch.size() + commands[next].command.size() + 2 <= PIPELINE_WINDOW_BYTES))
+            {
+                batch += commands[next].command;
+                batch += "\r\n";
+                next++;
+            }
+            if (!batch.empty())
+            {
+                std::fill(sent_at.begin() + written, sent_at.begin() + next, Metrics::Clock::now());
+                tcp.ensure_send(batch.data(), batch.size());
+                outstanding += batch.size();
+            }
+        }
+
+        // Every reply must be consumed even when a handler fails, or the next command would read a stale reply
+        int code = recv_response();
+        outstanding -= commands[i].command.size() + 2;
+        Metrics::instance().record_command(commands[i].command.c_str(), Metrics::elapsed_us(sent_at[i]));
+        try
+        {
+            commands[i].on_reply(code, first_line.c_str());
+        }
+        catch (...)
+        {
+            if (!handler_error)
+                handler_error = std::current_exception();
+        }
+    }
+
+    if (handler_error)
+        std::rethrow_exception(handler_error);
 }
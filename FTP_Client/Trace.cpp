@@ -0,0 +1,157 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char* name;
+        long long timestamp_us;
+        char phase;
+        char detail[Trace::DETAIL_SIZE];
+    };
+
+    // Events of one thread at a time; only the owning thread writes them and head, head is published with release
+    struct ThreadRing
+    {
+        int thread_id = 0;
+        std::atomic<unsigned long long> head{ 0 };
+        std::atomic<unsigned long long> first{ 0 };    // head when the current session started (set by Trace::start)
+        TraceEvent events[Trace::RING_SIZE];
+    };
+
+    // Rings outlive their threads so the events of finished pool workers can still be exported; the ring of a
+    // finished thread goes to the next new one, so there are only as many rings as threads ever ran at once
+    std::mutex rings_lock;
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+    std::vector<ThreadRing*> free_rings;
+
+    // Gives the ring of an exiting thread back to free_rings
+    struct RingOwner
+    {
+        ThreadRing* ring = nullptr;
+
+        ~RingOwner()
+        {
+            if (ring == nullptr)
+                return;
+            std::lock_guard<std::mutex> guard(rings_lock);
+            free_rings.push_back(ring);
+        }
+    };
+
+    const std::chrono::steady_clock::time_point trace_epoch = std::chrono::steady_clock::now();
+
+    // Helper function to get the ring of the calling thread, taking a free one or registering a new one on first use
+    ThreadRing* current_ring()
+    {
+        thread_local RingOwner owner;
+        if (owner.ring == nullptr)
+        {
+            std::lock_guard<std::mutex> guard(rings_lock);
+            if (!free_rings.empty())
+            {
+                owner.ring = free_rings.back();
+                free_rings.pop_back();
+            }
+            else
+            {
+                rings.push_back(std::make_unique<ThreadRing>());
+                owner.ring = rings.back().get();
+                owner.ring->thread_id = (int)rings.size();
+            }
+        }
+        return owner.ring;
+    }
+
+    // Helper function to write a string as JSON, dropping control characters
+    void write_json_string(std::ostream& o, const char* s)
+    {
+        o << '"';
+        for (; *s; s++)
+        {
+            if (*s == '"' || *s == '\\') o << '\\' << *s;
+            else if ((unsigned char)*s >= 0x20) o << *s;
+        }
+        o << '"';
+    }
+}
+
+// Appends an event to the calling thread's ring
+void Trace::record(char phase, const char* name, const char* detail)
+{
+    ThreadRing* ring = current_ring();
+    unsigned long long head = ring->head.load(std::memory_order_relaxed);
+
+    TraceEvent& event = ring->events[head % RING_SIZE];
+    event.name = name;
+    event.phase = phase;
+    event.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - trace_epoch).count();
+
+    // Keep the first word only (e.g. the verb of a command, never a password)
+    int n = 0;
+    if (detail != nullptr)
+    {
+        for (; n < DETAIL_SIZE - 1 && detail[n] != '\0' && detail[n] != ' ' && detail[n] != '\r'; n++)
+            event.detail[n] = detail[n];
+    }
+    event.detail[n] = '\0';
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+// Drops old events and starts recording; head is left to the owning threads, the session starts at its current value
+void Trace::start()
+{
+    {
+        std::lock_guard<std::mutex> guard(rings_lock);
+        for (auto& ring : rings)
+            ring->first.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+// Stops recording; the events stay available for write_json
+void Trace::stop()
+{
+    enabled.store(false, std::memory_order_relaxed);
+}
+
+// Writes the events in Chrome trace_event format, one tid per ring (threads that ran one after the other may share one)
+void Trace::write_json(std::ostream& o)
+{
+    std::lock_guard<std::mutex> guard(rings_lock);
+
+    o << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const auto& ring : rings)
+    {
+        unsigned long long head = ring->head.load(std::memory_order_acquire);
+        unsigned long long begin = std::max(ring->first.load(std::memory_order_relaxed), head > (unsigned long long)RING_SIZE ? head - RING_SIZE : 0);
+
+        for (unsigned long long i = begin; i < head; i++)
+        {
+            const TraceEvent& event = ring->events[i % RING_SIZE];
+            o << (first ? "" : ",") << "\n{\"name\":";
+            write_json_string(o, event.name);
+            o << ",\"ph\":\"" << event.phase << "\",\"ts\":" << event.timestamp_us
+              << ",\"pid\":1,\"tid\":" << ring->thread_id;
+            if (event.phase == 'i')
+                o << ",\"s\":\"t\"";
+            if (event.detail[0] != '\0')
+            {
+                o << ",\"args\":{\"detail\":";
+                write_json_string(o, event.detail);
+                o << "}";
+            }
+            o << "}";
+            first = false;
+        }
+    }
+    o << "\n]}\n";
+}
@@ -0,0 +1,183 @@
+#include "TransferScheduler.h"
+
+#include <chrono>
+#include <thread>
+#include <iostream>
+
+// Prints the aggregate result of a batch
+void TransferReport::print(std::ostream& o) const
+{
+    double mbytes = bytes / (1024.0 * 1024.0);
+    double rate = seconds > 0 ? mbytes / seconds : 0;
+
+    o << succeeded << " transferred, " << failed << " failed, "
+      << mbytes << " MB in " << seconds << " s (" << rate << " MB/s)\n";
+
+    for (const auto& error : errors)
+        o << "  " << error.message << "\n";
+    for (const auto& warning : warnings)
+        o << "  warning: " << warning << "\n";
+}
+
+// Constructor for TransferScheduler, sessions are opened lazily by each worker
+TransferScheduler::TransferScheduler(FTPClient* origin, int pool_size)
+    : origin{ origin }, pool_size{ pool_size } { }
+
+// Takes the next job of a worker, stealing from the other queues once its own is empty
+bool TransferScheduler::take_job(int worker, size_t& job)
+{
+    {
+        std::lock_guard<std::mutex> guard(queues[worker].lock);
+        if (!queues[worker].jobs.empty())
+        {
+            job = queues[worker].jobs.front();
+            queues[worker].jobs.pop_front();
+            return true;
+        }
+    }
+
+    for (int k = 1; k < pool_size; k++)
+    {
+        WorkerQueue& victim = queues[(worker + k) % pool_size];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Adds the outcome of one job to the report
+void TransferScheduler::record(size_t job, unsigned long long bytes, const char* error)
+{
+    std::lock_guard<std::mutex> guard(report_lock);
+    if (error == nullptr)
+    {
+        report.succeeded++;
+        report.bytes += bytes;
+        return;
+    }
+    report.failed++;
+    report.errors.push_back(TransferReport::Error{ (int)job, (*jobs)[job].path + ": " + error });
+}
+
+// Adds a problem of a job that still succeeded to the report
+void TransferScheduler::warn(const TransferJob& job, const char* warning)
+{
+    std::lock_guard<std::mutex> guard(report_lock);
+    report.warnings.push_back(job.path + ": " + warning);
+}
+
+// Worker loop: one session per worker, replaced whenever a transfer leaves it in an unknown state
+void TransferScheduler::run_worker(int worker)
+{
+    // Only the origin's connections are recorded, so a recorded origin does the transfers itself
+    bool on_origin = origin->is_recording();
+    FTPClient* session = nullptr;
+    size_t index;
+
+    while (take_job(worker, index))
+    {
+        const TransferJob& job = (*jobs)[index];
+
+        if (session == nullptr)
+        {
+            try
+            {
+                session = on_origin ? origin : origin->open_session();
+            }
+            catch (const std::exception& e)
+            {
+                // Leave the job to the remaining workers (e.g. the server limits connections)
+                if (alive_workers.load() > 1)
+                {
+                    std::lock_guard<std::mutex> guard(queues[worker].lock);
+                    queues[worker].jobs.push_front(index);
+                    break;
+                }
+                record(index, 0, e.what());
+                continue;
+            }
+        }
+
+        try
+        {
+            session->prepare_data_port();
+            unsigned long long bytes = job.upload ? session->stor(job.path.c_str()) : session->retr(job.path.c_str());
+            record(index, bytes, nullptr);
+        }
+        catch (const std::exception& e)
+        {
+            record(index, 0, e.what());
+
+            // The control connection may be out of sync, start the next job on a fresh session
+            if (!on_origin)
+                delete session;
+            session = nullptr;
+            continue;
+        }
+
+        // The file is complete: a copy left without its time is reported, not transferred again
+        // (best effort on the server, which may not support MFMT)
+        try
+        {
+            if (job.mtime >= 0 && job.upload)
+                session->set_modified(job.path.c_str(), job.mtime);
+            else if (job.mtime >= 0)
+                session->get_filesystem()->set_mtime(job.path, job.mtime);
+        }
+        catch (const std::exception& e)
+        {
+            warn(job, (std::string("modification time not set: ") + e.what()).c_str());
+
+            if (!on_origin)
+                delete session;
+            session = nullptr;
+        }
+    }
+
+    alive_workers--;
+
+    if (session != nullptr && !on_origin)
+        FTPClient::close_session(session);
+}
+
+// Runs all jobs and returns the aggregate report; a failing job or session never aborts the batch
+TransferReport TransferScheduler::run(const std::vector<TransferJob>& jobs)
+{
+    this->jobs = &jobs;
+    report = TransferReport{};
+    queues = std::vector<WorkerQueue>(pool_size);
+
+    // Deal the jobs round-robin so every worker starts with a share
+    for (size_t i = 0; i < jobs.size(); i++)
+        queues[i % pool_size].jobs.push_back(i);
+
+    int workers_count = jobs.size() < (size_t)pool_size ? (int)jobs.size() : pool_size;
+    if (origin->is_recording())
+        workers_count = 1;
+    alive_workers = workers_count;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < workers_count; i++)
+        workers.emplace_back(&TransferScheduler::run_worker, this, i);
+    for (auto& worker : workers)
+        worker.join();
+
+    // Jobs handed back by workers that could not connect after the others had finished
+    for (auto& queue : queues)
+    {
+        for (size_t index : queue.jobs)
+            record(index, 0, "no session available");
+        queue.jobs.clear();
+    }
+
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    this->jobs = nullptr;
+    return report;
+}
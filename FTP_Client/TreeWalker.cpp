@@ -0,0 +1,290 @@
+#include "TreeWalker.h"
+
+#include <chrono>
+#include <thread>
+#include "ListingCache.h"
+
+namespace
+{
+    // Helper function to build the relative path of an entry of a walked directory
+    std::string join(const std::string& directory, std::string_view name)
+    {
+        std::string path = directory;
+        if (!path.empty())
+            path += '/';
+        path.append(name.data(), name.size());
+        return path;
+    }
+}
+
+// Prints the totals of a walk and the directories that could not be listed
+void TreeWalkReport::print(std::ostream& o) const
+{
+    double rate = seconds > 0 ? directories / seconds : 0;
+
+    o << directories << " directories, " << entries << " entries in " << seconds << " s ("
+      << rate << " directories/s), " << failed << " failed" << (stopped ? ", stopped" : "") << "\n";
+
+    for (const auto& error : errors)
+        o << "  " << error << "\n";
+}
+
+// Constructor for TreeWalker, sessions are opened lazily by each worker
+TreeWalker::TreeWalker(FTPClient* origin, int max_in_flight) : origin{ origin }
+{
+    if (max_in_flight < 1)
+        max_in_flight = 1;
+    if (max_in_flight > FTPClient::MAX_POOL_SIZE)
+        max_in_flight = FTPClient::MAX_POOL_SIZE;
+    this->max_in_flight = max_in_flight;
+}
+
+// Remote path of a directory of the walk
+std::string TreeWalker::remote_path(const std::string& relative) const
+{
+    if (relative.empty())
+        return root.empty() ? "." : root;
+    if (root.empty())
+        return relative;
+    return root == "/" ? root + relative : root + "/" + relative;
+}
+
+// Takes the next directory to list, waiting while the directories in flight may still add some
+bool TreeWalker::take_directory(Directory& directory)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this]() { return stopped || !pending.empty() || busy == 0; });
+    if (stopped || pending.empty())
+        return false;
+
+    directory = std::move(pending.front());
+    pending.pop_front();
+    busy++;
+    return true;
+}
+
+// Marks a taken directory as done, the walk is over once none is pending or busy
+void TreeWalker::finish_directory()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    busy--;
+    changed.notify_all();
+}
+
+// Adds a directory that could not be listed to the report
+void TreeWalker::record_failure(const Directory& directory, const char* error)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    report.failed++;
+    report.errors.push_back(remote_path(directory.path) + ": " + error);
+}
+
+// Hands one entry to the handler, a handler that throws stops the walk like one returning false
+bool TreeWalker::deliver(const std::string& directory, const ListingEntry& entry)
+{
+    bool go_on;
+    try
+    {
+        go_on = (*handler)(directory, entry);
+        delivered++;
+    }
+    catch (const std::exception& e)
+    {
+        record_failure(Directory{ directory, 0 }, e.what());
+        go_on = false;
+    }
+
+    if (!go_on)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopped = true;
+        changed.notify_all();
+    }
+    return go_on;
+}
+
+// Unordered mode: entries go to the handler as their lines arrive, subdirectories are queued as soon as they are seen
+void TreeWalker::list_streamed(FTPClient* session, const Directory& directory)
+{
+    session->list_stream(remote_path(directory.path).c_str(), [&](const ListingEntry& entry)
+    {
+        if (entry.type == EntryType::DIRECTORY)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            pending.push_back(Directory{ join(directory.path, entry.name), 0 });
+            changed.notify_one();
+        }
+
+        std::lock_guard<std::mutex> guard(handler_lock);
+        return !stopped && deliver(directory.path, entry);
+    });
+
+    std::lock_guard<std::mutex> guard(lock);
+    report.directories++;
+}
+
+// Ordered mode: the whole listing is kept until every directory before it has been handed on
+void TreeWalker::list_ordered(FTPClient* session, const Directory& directory)
+{
+    std::unique_ptr<DirectoryListing> listing(new DirectoryListing(session->list_entries(remote_path(directory.path).c_str())));
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        report.directories++;
+    }
+    release(directory.index, Listed{ directory.path, std::move(listing) });
+}
+
+// Ordered mode: hands on every finished listing whose turn has come. One worker at a time does it, the others
+// leave their listings behind; the subdirectories are numbered as they are handed on, so the order never
+// depends on which listing finished first
+void TreeWalker::release(size_t index, Listed listed)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        finished.emplace(index, std::move(listed));
+        if (releasing)
+            return;
+        releasing = true;
+    }
+
+    while (true)
+    {
+        Listed next;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = finished.find(next_release);
+            if (it == finished.end() || stopped)
+            {
+                releasing = false;
+                return;
+            }
+            next = std::move(it->second);
+            finished.erase(it);
+            next_release++;
+        }
+
+        // A directory that could not be listed keeps its turn and hands on nothing
+        std::vector<std::string> subdirectories;
+        bool go_on = true;
+        for (size_t i = 0; next.listing != nullptr && i < next.listing->count() && go_on; i++)
+        {
+            ListingEntry entry = next.listing->entry(i);
+            if (entry.type == EntryType::DIRECTORY)
+                subdirectories.push_back(join(next.path, entry.name));
+            go_on = deliver(next.path, entry);
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        for (std::string& path : subdirectories)
+            pending.push_back(Directory{ std::move(path), next_index++ });
+        changed.notify_all();
+    }
+}
+
+// Worker loop: one session per worker, replaced whenever a listing leaves it in an unknown state
+void TreeWalker::run_worker()
+{
+    // Only the origin's connections are recorded, so a recorded origin lists the tree itself
+    bool on_origin = origin->is_recording();
+    FTPClient* session = nullptr;
+    Directory directory;
+
+    while (take_directory(directory))
+    {
+        if (session == nullptr)
+        {
+            try
+            {
+                session = on_origin ? origin : origin->open_session();
+            }
+            catch (const std::exception& e)
+            {
+                // Leave the directory to the remaining workers (e.g. the server limits connections)
+                std::unique_lock<std::mutex> guard(lock);
+                if (alive_workers > 1)
+                {
+                    pending.push_front(std::move(directory));
+                    busy--;
+                    alive_workers--;
+                    changed.notify_all();
+                    return;
+                }
+                guard.unlock();
+
+                record_failure(directory, e.what());
+                if (ordered)
+                    release(directory.index, Listed{ directory.path, nullptr });
+                finish_directory();
+                continue;
+            }
+        }
+
+        try
+        {
+            if (ordered)
+                list_ordered(session, directory);
+            else
+                list_streamed(session, directory);
+        }
+        catch (const std::exception& e)
+        {
+            record_failure(directory, e.what());
+            if (ordered)
+                release(directory.index, Listed{ directory.path, nullptr });
+
+            // The control connection may be out of sync, list the next directory on a fresh session
+            if (!on_origin)
+                delete session;
+            session = nullptr;
+        }
+        finish_directory();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        alive_workers--;
+    }
+
+    if (session != nullptr && !on_origin)
+        FTPClient::close_session(session);
+}
+
+// Walks the tree under path and returns the totals; failed directories are reported, their subtrees skipped
+TreeWalkReport TreeWalker::walk(const char* path, const TreeWalkHandler& handler)
+{
+    this->root = ListingCache::normalize(path);
+    this->handler = &handler;
+    report = TreeWalkReport{};
+    pending.clear();
+    finished.clear();
+    busy = 0;
+    stopped = false;
+    next_index = 1;
+    next_release = 0;
+    releasing = false;
+    delivered = 0;
+
+    pending.push_back(Directory{ "", 0 });
+    int workers_count = origin->is_recording() ? 1 : max_in_flight;
+    alive_workers = workers_count;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < workers_count; i++)
+        workers.emplace_back(&TreeWalker::run_worker, this);
+    for (auto& worker : workers)
+        worker.join();
+
+    // Directories handed back by workers that could not connect after the others had finished
+    for (const Directory& directory : pending)
+        record_failure(directory, "no session available");
+    pending.clear();
+    finished.clear();
+
+    report.entries = delivered;
+    report.stopped = stopped;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    this->handler = nullptr;
+    return report;
+}
@@ -0,0 +1,473 @@
+#include "DataEngine.h"
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <cstdlib>
+#include "tcp_exception.h"
+#include "Trace.h"
+
+namespace
+{
+    int sys_io_uring_setup(unsigned entries, io_uring_params* params)
+    {
+        return (int)syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+
+    int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args)
+    {
+        return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+    }
+
+    // user_data layout: operation in the high half, buffer index in the low half
+    enum Operation : unsigned { OP_RECV = 1, OP_WRITE, OP_READ, OP_SEND };
+
+    unsigned long long make_user_data(Operation op, int buffer) { return ((unsigned long long)op << 32) | (unsigned)buffer; }
+    Operation user_data_op(unsigned long long user_data) { return (Operation)(user_data >> 32); }
+    int user_data_buffer(unsigned long long user_data) { return (int)(user_data & 0xFFFFFFFF); }
+
+    // Clears O_NONBLOCK for the duration of a transfer so io_uring waits for the socket instead of failing with EAGAIN
+    class BlockingScope
+    {
+    private:
+        int fd;
+        int flags;
+    public:
+        BlockingScope(int fd) : fd{ fd }, flags{ fcntl(fd, F_GETFL, 0) }
+        {
+            if (flags >= 0 && (flags & O_NONBLOCK))
+                fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+        }
+        ~BlockingScope()
+        {
+            if (flags >= 0)
+                fcntl(fd, F_SETFL, flags);
+        }
+    };
+}
+
+// Submission/completion rings mapped from the kernel, plus the transfer buffers
+struct UringDataEngine::Ring
+{
+    static constexpr unsigned ENTRIES = 32;
+
+    int fd = -1;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned sqe_tail = 0;      // local tail, published to the kernel on submit
+    unsigned to_submit = 0;
+    io_uring_sqe* sqes = nullptr;
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    void* sq_map = MAP_FAILED;
+    size_t sq_map_len = 0;
+    void* cq_map = MAP_FAILED;
+    size_t cq_map_len = 0;
+    void* sqe_map = MAP_FAILED;
+    size_t sqe_map_len = 0;
+
+    char* buffers = nullptr;
+    bool fixed_buffers = false;
+
+    Ring()
+    {
+        try
+        {
+            setup();
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+    }
+
+    void setup()
+    {
+        io_uring_params params{};
+        fd = sys_io_uring_setup(ENTRIES, &params);
+        if (fd < 0)
+            throw tcp_exception(TCPResult::fail(errno).get_error_message());
+
+        sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap)
+            sq_map_len = cq_map_len = sq_map_len > cq_map_len ? sq_map_len : cq_map_len;
+
+        sq_map = mmap(nullptr, sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_map == MAP_FAILED)
+            throw tcp_exception(TCPResult::fail(errno).get_error_message());
+
+        if (single_mmap)
+        {
+            cq_map = sq_map;
+        }
+        else
+        {
+            cq_map = mmap(nullptr, cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq_map == MAP_FAILED)
+                throw tcp_exception(TCPResult::fail(errno).get_error_message());
+        }
+
+        sqe_map_len = params.sq_entries * sizeof(io_uring_sqe);
+        sqe_map = mmap(nullptr, sqe_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqe_map == MAP_FAILED)
+            throw tcp_exception(TCPResult::fail(errno).get_error_message());
+
+        char* sq = static_cast<char*>(sq_map);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries = params.sq_entries;
+        sqe_tail = *sq_tail;
+        sqes = static_cast<io_uring_sqe*>(sqe_map);
+
+        char* cq = static_cast<char*>(cq_map);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        void* memory = nullptr;
+        if (posix_memalign(&memory, 4096, (size_t)RING_BUFFERS * BUFFER_SIZE) != 0)
+            throw tcp_exception("Failed to allocate io_uring buffers");
+        buffers = static_cast<char*>(memory);
+
+        // Registered buffers skip the per-operation page pinning; without them (e.g. low RLIMIT_MEMLOCK) plain READ/WRITE are used
+        iovec iov[RING_BUFFERS];
+        for (int i = 0; i < RING_BUFFERS; i++)
+        {
+            iov[i].iov_base = buffer(i);
+            iov[i].iov_len = BUFFER_SIZE;
+        }
+        fixed_buffers = sys_io_uring_register(fd, IORING_REGISTER_BUFFERS, iov, RING_BUFFERS) == 0;
+    }
+
+    void release()
+    {
+        if (sqe_map != MAP_FAILED) munmap(sqe_map, sqe_map_len);
+        if (cq_map != MAP_FAILED && cq_map != sq_map) munmap(cq_map, cq_map_len);
+        if (sq_map != MAP_FAILED) munmap(sq_map, sq_map_len);
+        if (fd >= 0) close(fd);
+        free(buffers);
+        sqe_map = cq_map = sq_map = MAP_FAILED;
+        fd = -1;
+        buffers = nullptr;
+    }
+
+    char* buffer(int i) { return buffers + (size_t)i * BUFFER_SIZE; }
+
+    // Next free submission entry, zeroed
+    io_uring_sqe* get_sqe(Operation op, int buffer_index)
+    {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (sqe_tail - head >= sq_entries)
+            throw tcp_exception("io_uring submission queue full");
+
+        unsigned index = sqe_tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data = make_user_data(op, buffer_index);
+        sq_array[index] = index;
+        sqe_tail++;
+        to_submit++;
+        return sqe;
+    }
+
+    // Publishes the queued entries and waits for at least wait_nr completions
+    void submit_and_wait(unsigned wait_nr)
+    {
+        __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+        while (true)
+        {
+            int ret = sys_io_uring_enter(fd, to_submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+            if (ret >= 0)
+            {
+                to_submit -= (unsigned)ret < to_submit ? (unsigned)ret : to_submit;
+                return;
+            }
+            if (errno != EINTR)
+                throw tcp_exception(TCPResult::fail(errno).get_error_message());
+        }
+    }
+
+    // Takes one completion if available
+    bool pop_cqe(unsigned long long& user_data, int& res)
+    {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            return false;
+
+        const io_uring_cqe& cqe = cqes[head & cq_mask];
+        user_data = cqe.user_data;
+        res = cqe.res;
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // File read/write on buffer i, through the registered buffer when possible
+    void prep_file_io(Operation op, int file, int i, unsigned len, unsigned long long offset)
+    {
+        bool write = op == OP_WRITE;
+        io_uring_sqe* sqe = get_sqe(op, i);
+        sqe->opcode = fixed_buffers ? (write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED) : (write ? IORING_OP_WRITE : IORING_OP_READ);
+        sqe->fd = file;
+        sqe->addr = (unsigned long long)buffer(i);
+        sqe->len = len;
+        sqe->off = offset;
+        if (fixed_buffers)
+            sqe->buf_index = (unsigned short)i;
+    }
+
+    // Socket send/recv of len bytes at data; MSG_WAITALL makes a short result mean end of stream or error
+    io_uring_sqe* prep_socket_io(Operation op, int sock, int i, const char* data, unsigned len)
+    {
+        io_uring_sqe* sqe = get_sqe(op, i);
+        sqe->opcode = op == OP_SEND ? IORING_OP_SEND : IORING_OP_RECV;
+        sqe->fd = sock;
+        sqe->addr = (unsigned long long)data;
+        sqe->len = len;
+        sqe->msg_flags = op == OP_SEND ? MSG_WAITALL | MSG_NOSIGNAL : MSG_WAITALL;
+        return sqe;
+    }
+
+    ~Ring() { release(); }
+};
+
+// Constructor sets up the ring; throws if io_uring is not available (old kernel, seccomp, disabled by sysctl)
+UringDataEngine::UringDataEngine() : ring{ new Ring() } { }
+
+// Receives with chains of linked receives and writes each completed chunk at its offset while the next ones arrive
+unsigned long long UringDataEngine::recv_to_file(TCP& data_port, VirtualFS::Writer& writer, Digest* digest)
+{
+    enum State { FREE, RECEIVING, WRITING };
+
+    int sock = (int)data_port.get_native_handle();
+    int file = writer.get_fd();
+    BlockingScope blocking(sock);
+
+    State state[RING_BUFFERS] = {};
+    unsigned write_len[RING_BUFFERS] = {};
+    unsigned long long write_offset[RING_BUFFERS] = {};
+    unsigned long long file_offset = 0;
+    int chain_outstanding = 0;
+    int in_flight = 0;
+    bool eof = false;
+    int error = 0;
+
+    while (true)
+    {
+        // Queue the next chain of receives on the free buffers once the previous chain is done;
+        // linked receives complete in order, so offsets can be assigned as completions arrive
+        if (chain_outstanding == 0 && !eof && error == 0)
+        {
+            int chain[CHAIN_LENGTH];
+            int n = 0;
+            for (int i = 0; i < RING_BUFFERS && n < CHAIN_LENGTH; i++)
+            {
+                if (state[i] == FREE)
+                    chain[n++] = i;
+            }
+
+            for (int k = 0; k < n; k++)
+            {
+                io_uring_sqe* sqe = ring->prep_socket_io(OP_RECV, sock, chain[k], ring->buffer(chain[k]), BUFFER_SIZE);
+                if (k + 1 < n)
+                    sqe->flags |= IOSQE_IO_LINK;
+                state[chain[k]] = RECEIVING;
+            }
+            chain_outstanding = n;
+            in_flight += n;
+        }
+
+        if (in_flight == 0)
+            break;
+
+        ring->submit_and_wait(1);
+
+        unsigned long long user_data;
+        int res;
+        while (ring->pop_cqe(user_data, res))
+        {
+            int i = user_data_buffer(user_data);
+            in_flight--;
+            state[i] = FREE;
+
+            if (user_data_op(user_data) == OP_RECV)
+            {
+                chain_outstanding--;
+                if (res == -ECANCELED) continue;   // rest of a chain cut short by a short receive
+                if (res < 0) { if (error == 0) error = -res; continue; }
+                if (res == 0) { eof = true; continue; }
+                if (error != 0) continue;
+
+                if (file_offset == 0)
+                {
+                    first_byte_time = std::chrono::steady_clock::now();
+                    Trace::instant("first byte");
+                }
+
+                // Receives complete in file order, so the digest can take each one before it is written
+                if (digest != nullptr)
+                    digest->update(ring->buffer(i), (size_t)res);
+
+                // Turn the completed receive straight into a write at its position in the file
+                write_len[i] = (unsigned)res;
+                write_offset[i] = file_offset;
+                file_offset += res;
+                ring->prep_file_io(OP_WRITE, file, i, write_len[i], write_offset[i]);
+                state[i] = WRITING;
+                in_flight++;
+                continue;
+            }
+
+            // OP_WRITE: a short write to a regular file only happens on errors like a full disk, finish it synchronously
+            if (res < 0) { if (error == 0) error = -res; continue; }
+            for (unsigned done = (unsigned)res; done < write_len[i] && error == 0; )
+            {
+                ssize_t n = pwrite(file, ring->buffer(i) + done, write_len[i] - done, (off_t)(write_offset[i] + done));
+                if (n <= 0) error = n < 0 ? errno : EIO;
+                else done += (unsigned)n;
+            }
+        }
+    }
+
+    if (error != 0)
+        throw tcp_exception(TCPResult::fail(error).get_error_message());
+
+    writer.add_bytes_written(file_offset);
+    return file_offset;
+}
+
+// Reads ahead into the free buffers and sends them strictly in file order, one send at a time
+void UringDataEngine::send_from_file(TCP& data_port, VirtualFS::Reader& reader, Digest* digest)
+{
+    enum State { FREE, READING, READY, SENDING };
+
+    int sock = (int)data_port.get_native_handle();
+    int file = reader.get_fd();
+    unsigned long long size = reader.get_size();
+    BlockingScope blocking(sock);
+
+    State state[RING_BUFFERS] = {};
+    unsigned long long sequence[RING_BUFFERS] = {};
+    unsigned length[RING_BUFFERS] = {};
+    unsigned sent[RING_BUFFERS] = {};
+    unsigned long long next_read_offset = 0;
+    unsigned long long next_read_sequence = 0;
+    unsigned long long next_send_sequence = 0;
+    bool sending = false;
+    int in_flight = 0;
+    int error = 0;
+
+    while (true)
+    {
+        if (error == 0)
+        {
+            // Keep every free buffer busy reading ahead
+            for (int i = 0; i < RING_BUFFERS && next_read_offset < size; i++)
+            {
+                if (state[i] != FREE) continue;
+
+                unsigned long long left = size - next_read_offset;
+                length[i] = left < (unsigned long long)BUFFER_SIZE ? (unsigned)left : (unsigned)BUFFER_SIZE;
+                sequence[i] = next_read_sequence++;
+                sent[i] = 0;
+                ring->prep_file_io(OP_READ, file, i, length[i], next_read_offset);
+                next_read_offset += length[i];
+                state[i] = READING;
+                in_flight++;
+            }
+
+            // Send the next chunk in file order (or the rest of a partially sent one)
+            for (int i = 0; i < RING_BUFFERS && !sending; i++)
+            {
+                if (state[i] != READY || sequence[i] != next_send_sequence) continue;
+
+                // Reads may complete out of order, sends do not: hash a chunk when its first send goes out
+                if (digest != nullptr && sent[i] == 0)
+                    digest->update(ring->buffer(i), length[i]);
+
+                ring->prep_socket_io(OP_SEND, sock, i, ring->buffer(i) + sent[i], length[i] - sent[i]);
+                state[i] = SENDING;
+                sending = true;
+                in_flight++;
+            }
+        }
+
+        if (in_flight == 0)
+            break;
+
+        ring->submit_and_wait(1);
+
+        unsigned long long user_data;
+        int res;
+        while (ring->pop_cqe(user_data, res))
+        {
+            int i = user_data_buffer(user_data);
+            in_flight--;
+
+            if (user_data_op(user_data) == OP_READ)
+            {
+                // Regular files only return less than asked at end of file, which means the file shrank
+                if (res < 0 || (unsigned)res != length[i])
+                {
+                    if (error == 0) error = res < 0 ? -res : EIO;
+                    state[i] = FREE;
+                    continue;
+                }
+                state[i] = READY;
+                continue;
+            }
+
+            // OP_SEND
+            sending = false;
+            if (res < 0)
+            {
+                if (error == 0) error = -res;
+                state[i] = FREE;
+                continue;
+            }
+
+            sent[i] += (unsigned)res;
+            if (sent[i] < length[i])
+            {
+                state[i] = READY;  // resubmitted with the remaining bytes
+                continue;
+            }
+            state[i] = FREE;
+            next_send_sequence++;
+        }
+    }
+
+    if (error != 0)
+        throw tcp_exception(TCPResult::fail(error).get_error_message());
+}
+
+// Destructor unmaps the rings and frees the buffers
+UringDataEngine::~UringDataEngine() { delete ring; }
+
+#endif
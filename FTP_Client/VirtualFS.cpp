@@ -1,7 +1,22 @@
 #include "VirtualFS.h"
+#include "FileIndex.h"
 
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <climits>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <share.h>
+#include <sys/utime.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
 
 namespace fs = std::filesystem;
 
@@ -9,16 +24,47 @@ namespace
 {
 	fs::path get_absolute_path(fs::path root, fs::path relative)
 	{
-		if (relative.string()._Starts_with("/"))
+		if (relative.string().rfind('/', 0) == 0)
 			relative = fs::path("." + relative.string());
 		return root / relative;
 	}
+
+	constexpr const char* PART_SUFFIX = ".part";
+
+	// File a writer fills before renaming it onto its target, so a failed download leaves the previous file alone
+	fs::path part_path(const fs::path& path)
+	{
+		fs::path part = path;
+		part += PART_SUFFIX;
+		return part;
+	}
+
+	// Creates the missing parent directories of a file about to be written
+	void ensure_parent_exists(const fs::path& path)
+	{
+		std::error_code ec;
+		if (path.has_parent_path())
+			fs::create_directories(path.parent_path(), ec);
+	}
 }
 
 VirtualFS::VirtualFS(std::filesystem::path root) : root{ root }
 {
 	if (!fs::exists(root))
 		fs::create_directory(root);
+
+	// Loaded and checked against the disk by the first VirtualFS of the process, shared by the others
+	index = FileIndex::open(root);
+}
+
+bool VirtualFS::is_part_file(const std::filesystem::path& path)
+{
+	return path.extension() == PART_SUFFIX;
+}
+
+std::string VirtualFS::index_key(const std::filesystem::path& relative_path) const
+{
+	return get_absolute_path(root, relative_path).lexically_normal().lexically_relative(root.lexically_normal()).generic_string();
 }
 
 std::vector<char> VirtualFS::read(std::filesystem::path relative_path)
@@ -29,7 +75,7 @@ std::vector<char> VirtualFS::read(std::filesystem::path relative_path)
 	std::cout << "Reading path: " << path << "\n";
 	if (f.fail())
 	{
-		throw std::exception((std::string("File not found: ") + path.string()).c_str());
+		throw std::runtime_error((std::string("File not found: ") + path.string()).c_str());
 	}
 
 	f.seekg(0, std::ios::end);
@@ -40,28 +86,391 @@ std::vector<char> VirtualFS::read(std::filesystem::path relative_path)
 	f.read(buffer.data(), length);	
 
 	if (f.fail())
-		throw std::exception("File reading failed");
+		throw std::runtime_error("File reading failed");
 
 	f.close();	
 
 	return buffer;
 }
 
-void VirtualFS::write(std::filesystem::path relative_path, std::vector<char> buffer)
+void VirtualFS::write(std::filesystem::path relative_path, const std::vector<char>& buffer)
+{
+	Writer writer = open_writer(relative_path);
+	writer.write(buffer.data(), buffer.size());
+	writer.close();
+}
+
+VirtualFS::Writer VirtualFS::open_writer(std::filesystem::path relative_path)
 {
 	fs::path path = get_absolute_path(root, relative_path);
-	std::cout << "Writing path: " << path << "\n";	
-	std::ofstream f(path, std::ios::binary);
+	std::cout << "Writing path: " << path << "\n";
+	ensure_parent_exists(path);
+	return Writer(path, index, index_key(relative_path));
+}
 
-	if (f.fail())
+VirtualFS::Writer::Writer(std::filesystem::path path, std::shared_ptr<FileIndex> index, std::string index_key)
+	: path{ path }, part{ part_path(path) }, index{ std::move(index) }, index_key{ std::move(index_key) }
+{
+#ifdef _WIN32
+	if (_wsopen_s(&fd, part.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _SH_DENYWR, _S_IREAD | _S_IWRITE) != 0)
+		fd = -1;
+#else
+	fd = ::open(part.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+
+	if (fd < 0)
 	{
-		throw std::exception((std::string("Unable to write file: ") + path.string()).c_str());
+		throw std::runtime_error((std::string("Unable to write file: ") + path.string()).c_str());
 	}
+}
 
-	f.write(buffer.data(), buffer.size());
+VirtualFS::Writer::Writer(Writer&& other) noexcept
+	: path{ std::move(other.path) }, part{ std::move(other.part) }, fd{ other.fd }, bytes_written{ other.bytes_written }, index{ std::move(other.index) }, index_key{ std::move(other.index_key) }
+{
+	other.fd = -1;
+}
 
-	if (f.fail())
-		throw std::exception("File writing failed");
+void VirtualFS::Writer::write(const char* data, size_t size)
+{
+	while (size > 0)
+	{
+#ifdef _WIN32
+		int written = _write(fd, data, size > INT_MAX ? INT_MAX : (unsigned int)size);
+#else
+		ssize_t written = ::write(fd, data, size);
+#endif
+		if (written <= 0)
+			throw std::runtime_error("File writing failed");
 
-	f.close();	
-}
\ No newline at end of file
+		data += written;
+		size -= written;
+		bytes_written += written;
+	}
+}
+
+void VirtualFS::Writer::add_bytes_written(unsigned long long count) { bytes_written += count; }
+
+void VirtualFS::Writer::close()
+{
+	if (fd < 0)
+		return;
+
+#ifdef _WIN32
+	int result = _close(fd);
+#else
+	int result = ::close(fd);
+#endif
+	fd = -1;
+
+	std::error_code ec;
+	if (result == 0)
+		fs::rename(part, path, ec);
+	if (result != 0 || ec)
+	{
+		fs::remove(part, ec);
+		throw std::runtime_error((std::string("File writing failed: ") + path.string()).c_str());
+	}
+
+	if (index != nullptr)
+		index->update(index_key);
+}
+
+void VirtualFS::Writer::discard()
+{
+	if (fd < 0)
+		return;
+
+#ifdef _WIN32
+	_close(fd);
+#else
+	::close(fd);
+#endif
+	fd = -1;
+
+	std::error_code ec;
+	fs::remove(part, ec);
+}
+
+VirtualFS::Writer::~Writer() { discard(); }
+
+VirtualFS::Reader VirtualFS::open_reader(std::filesystem::path relative_path)
+{
+	fs::path path = get_absolute_path(root, relative_path);
+	std::cout << "Reading path: " << path << "\n";
+	return Reader(path);
+}
+
+VirtualFS::Reader::Reader(std::filesystem::path path) : path{ path }
+{
+	std::error_code ec;
+	size = fs::file_size(path, ec);
+	if (ec)
+		throw std::runtime_error((std::string("File not found: ") + path.string()).c_str());
+
+#ifdef _WIN32
+	if (_wsopen_s(&fd, path.c_str(), _O_RDONLY | _O_BINARY, _SH_DENYWR, _S_IREAD) != 0)
+		fd = -1;
+#else
+	fd = ::open(path.c_str(), O_RDONLY);
+#endif
+
+	if (fd < 0)
+		throw std::runtime_error((std::string("Unable to open file: ") + path.string()).c_str());
+
+	std::cout << "File size : " << size << "\n";
+}
+
+size_t VirtualFS::Reader::read(char* buffer, size_t size)
+{
+#ifdef _WIN32
+	int count = _read(fd, buffer, size > INT_MAX ? INT_MAX : (unsigned int)size);
+#else
+	ssize_t count = ::read(fd, buffer, size);
+#endif
+	if (count < 0)
+		throw std::runtime_error((std::string("File reading failed: ") + path.string()).c_str());
+	return (size_t)count;
+}
+
+VirtualFS::Reader::Reader(Reader&& other) noexcept : path{ std::move(other.path) }, fd{ other.fd }, size{ other.size }
+{
+	other.fd = -1;
+}
+
+void VirtualFS::Reader::close()
+{
+	if (fd < 0)
+		return;
+
+#ifdef _WIN32
+	_close(fd);
+#else
+	::close(fd);
+#endif
+	fd = -1;
+}
+
+VirtualFS::Reader::~Reader() { close(); }
+
+VirtualFS::PositionalWriter VirtualFS::open_positional_writer(std::filesystem::path relative_path, unsigned long long size)
+{
+	fs::path path = get_absolute_path(root, relative_path);
+	std::cout << "Writing path: " << path << "\n";
+	ensure_parent_exists(path);
+	return PositionalWriter(path, size, index, index_key(relative_path));
+}
+
+std::vector<std::string> VirtualFS::list_files(std::filesystem::path relative_dir)
+{
+	fs::path path = get_absolute_path(root, relative_dir);
+	std::error_code ec;
+	fs::directory_iterator it(path, ec);
+	if (ec)
+		throw std::runtime_error((std::string("Directory not found: ") + path.string()).c_str());
+
+	std::vector<std::string> files;
+	for (const auto& entry : it)
+	{
+		if (entry.is_regular_file() && !is_part_file(entry.path()))
+			files.push_back((relative_dir / entry.path().filename()).generic_string());
+	}
+	return files;
+}
+
+std::vector<VirtualFS::FileInfo> VirtualFS::list_tree(std::filesystem::path relative_dir)
+{
+	fs::path path = get_absolute_path(root, relative_dir);
+	std::error_code ec;
+	fs::recursive_directory_iterator it(path, ec);
+	if (ec)
+		throw std::runtime_error((std::string("Directory not found: ") + path.string()).c_str());
+
+	std::vector<FileInfo> entries;
+	for (; it != fs::recursive_directory_iterator(); it.increment(ec))
+	{
+		if (ec)
+			throw std::runtime_error((std::string("Directory listing failed: ") + path.string()).c_str());
+
+		const fs::directory_entry& entry = *it;
+		bool directory = entry.is_directory(ec);
+		if (!directory && (!entry.is_regular_file(ec) || is_part_file(entry.path())))
+			continue;
+
+		FileInfo info;
+		info.path = entry.path().lexically_relative(path).generic_string();
+		info.directory = directory;
+
+		// last_write_time has no portable conversion to time_t before C++20, stat has
+#ifdef _WIN32
+		struct _stat64 st;
+		if (_wstat64(entry.path().c_str(), &st) == 0)
+#else
+		struct stat st;
+		if (::stat(entry.path().c_str(), &st) == 0)
+#endif
+		{
+			info.size = directory ? 0 : (unsigned long long)st.st_size;
+			info.mtime = (long long)st.st_mtime;
+		}
+		entries.push_back(info);
+	}
+	return entries;
+}
+
+void VirtualFS::make_directory(std::filesystem::path relative_path)
+{
+	std::error_code ec;
+	fs::path path = get_absolute_path(root, relative_path);
+	fs::create_directories(path, ec);
+	if (ec)
+		throw std::runtime_error((std::string("Unable to create directory: ") + path.string()).c_str());
+}
+
+void VirtualFS::set_mtime(std::filesystem::path relative_path, long long mtime)
+{
+	fs::path path = get_absolute_path(root, relative_path);
+#ifdef _WIN32
+	struct __utimbuf64 times { mtime, mtime };
+	bool ok = _wutime64(path.c_str(), &times) == 0;
+#else
+	struct utimbuf times { (time_t)mtime, (time_t)mtime };
+	bool ok = utime(path.c_str(), &times) == 0;
+#endif
+	if (!ok)
+		throw std::runtime_error((std::string("Unable to set the modification time of ") + path.string()).c_str());
+
+	index->update(index_key(relative_path), true);
+}
+
+void VirtualFS::remove(std::filesystem::path relative_path)
+{
+	std::error_code ec;
+	fs::path path = get_absolute_path(root, relative_path);
+	fs::remove_all(path, ec);
+	if (ec)
+		throw std::runtime_error((std::string("Unable to remove ") + path.string()).c_str());
+	index->remove(index_key(relative_path));
+}
+
+uint32_t VirtualFS::content_crc32(std::filesystem::path relative_path)
+{
+	return index->crc32(index_key(relative_path));
+}
+
+VirtualFS::PositionalWriter::PositionalWriter(std::filesystem::path path, unsigned long long size, std::shared_ptr<FileIndex> index, std::string index_key)
+	: path{ path }, part{ part_path(path) }, index{ std::move(index) }, index_key{ std::move(index_key) }
+{
+#ifdef _WIN32
+	if (_wsopen_s(&fd, part.c_str(), _O_RDWR | _O_CREAT | _O_TRUNC | _O_BINARY, _SH_DENYWR, _S_IREAD | _S_IWRITE) != 0)
+		fd = -1;
+#else
+	fd = ::open(part.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+
+	if (fd < 0)
+		throw std::runtime_error((std::string("Unable to write file: ") + path.string()).c_str());
+
+	// Reserve the full size up front so segments can land in any order
+#ifdef _WIN32
+	bool allocated = _chsize_s(fd, (long long)size) == 0;
+#elif defined(__linux__)
+	bool allocated = posix_fallocate(fd, 0, (off_t)size) == 0;
+#else
+	bool allocated = ftruncate(fd, (off_t)size) == 0;
+#endif
+
+	if (!allocated)
+	{
+		discard();
+		throw std::runtime_error((std::string("Unable to preallocate file: ") + path.string()).c_str());
+	}
+}
+
+VirtualFS::PositionalWriter::PositionalWriter(PositionalWriter&& other) noexcept
+	: path{ std::move(other.path) }, part{ std::move(other.part) }, fd{ other.fd }, index{ std::move(other.index) }, index_key{ std::move(other.index_key) }
+{
+	other.fd = -1;
+}
+
+void VirtualFS::PositionalWriter::write_at(unsigned long long offset, const char* data, size_t size)
+{
+	while (size > 0)
+	{
+#ifdef _WIN32
+		// WriteFile with an explicit offset does not depend on the shared file pointer
+		OVERLAPPED position{};
+		position.Offset = (DWORD)(offset & 0xFFFFFFFF);
+		position.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD written = 0;
+		if (!WriteFile((HANDLE)_get_osfhandle(fd), data, (DWORD)size, &written, &position))
+			throw std::runtime_error("File writing failed");
+#else
+		ssize_t written = pwrite(fd, data, size, (off_t)offset);
+		if (written <= 0)
+			throw std::runtime_error("File writing failed");
+#endif
+		offset += written;
+		data += written;
+		size -= written;
+	}
+}
+
+size_t VirtualFS::PositionalWriter::read_at(unsigned long long offset, char* buffer, size_t size)
+{
+#ifdef _WIN32
+	OVERLAPPED position{};
+	position.Offset = (DWORD)(offset & 0xFFFFFFFF);
+	position.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD count = 0;
+	if (!ReadFile((HANDLE)_get_osfhandle(fd), buffer, (DWORD)size, &count, &position) && GetLastError() != ERROR_HANDLE_EOF)
+		throw std::runtime_error((std::string("File reading failed: ") + part.string()).c_str());
+#else
+	ssize_t count = pread(fd, buffer, size, (off_t)offset);
+	if (count < 0)
+		throw std::runtime_error((std::string("File reading failed: ") + part.string()).c_str());
+#endif
+	return (size_t)count;
+}
+
+void VirtualFS::PositionalWriter::close()
+{
+	if (fd < 0)
+		return;
+
+#ifdef _WIN32
+	int result = _close(fd);
+#else
+	int result = ::close(fd);
+#endif
+	fd = -1;
+
+	std::error_code ec;
+	if (result == 0)
+		fs::rename(part, path, ec);
+	if (result != 0 || ec)
+	{
+		fs::remove(part, ec);
+		throw std::runtime_error((std::string("File writing failed: ") + path.string()).c_str());
+	}
+
+	if (index != nullptr)
+		index->update(index_key);
+}
+
+void VirtualFS::PositionalWriter::discard()
+{
+	if (fd < 0)
+		return;
+
+#ifdef _WIN32
+	_close(fd);
+#else
+	::close(fd);
+#endif
+	fd = -1;
+
+	std::error_code ec;
+	fs::remove(part, ec);
+}
+
+VirtualFS::PositionalWriter::~PositionalWriter() { discard(); }
\ No newline at end of file
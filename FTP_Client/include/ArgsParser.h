@@ -24,27 +24,46 @@ public:
 		return args[i].c_str();
 	}
 
-	template<typename T> T get_arg(int i, T default_value)
-	{		
-		if(get_arg(i)==nullptr)
-			return default_value;
-		throw std::exception("Not implemented: get_arg<T>(int, T)");
-	}	
-
-	template<>
-	const char* get_arg<const char*>(int i, const char* default_value)
+	// value following a "--name" style option, nullptr when the option is absent
+	const char* get_option(const char* name)
 	{
-		const char* arg = get_arg(i);
-		return arg ? arg : default_value;
+		for (size_t i = 1; i + 1 < args.size(); i++)
+		{
+			if (args[i] == name)
+				return args[i + 1].c_str();
+		}
+		return nullptr;
 	}
 
-	template<>
-	int get_arg<int>(int i, int default_value)
+	// whether a "--name" style flag is present
+	bool has_option(const char* name)
 	{
-		const char* arg = get_arg(i);
-		return arg ? Utils::my_atoi(arg) : default_value;
+		for (size_t i = 1; i < args.size(); i++)
+		{
+			if (args[i] == name)
+				return true;
+		}
+		return false;
 	}
 
+	template<typename T> T get_arg(int i, T default_value)
+	{		
+		if(get_arg(i)==nullptr)
+			return default_value;
+		throw std::runtime_error("Not implemented: get_arg<T>(int, T)");
+	}	
+};
 
+template<>
+inline const char* ArgsParser::get_arg<const char*>(int i, const char* default_value)
+{
+	const char* arg = get_arg(i);
+	return arg ? arg : default_value;
+}
 
-};
\ No newline at end of file
+template<>
+inline int ArgsParser::get_arg<int>(int i, int default_value)
+{
+	const char* arg = get_arg(i);
+	return arg ? Utils::my_atoi(arg) : default_value;
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "FTPClient.h"
+#include "FTPCommandInterpreter.h"
+
+struct BatchStep
+{
+	int line = 0;	// 1-based line in the script
+	CommandInterpreter::PreparedCommand command;
+};
+
+struct BatchReport
+{
+	struct Error
+	{
+		int line;
+		std::string message;
+	};
+
+	int succeeded = 0;
+	int failed = 0;
+	unsigned long long bytes = 0;	// transferred by get/put
+	double seconds = 0;
+	std::vector<Error> errors;
+
+	// one JSON object on a single line
+	void print_json(std::ostream& o) const;
+};
+
+// Runs a command script without prompts or colors. The whole script is parsed before anything runs,
+// the session opens each data connection right after the previous transfer (speculative PASV),
+// and consecutive get (or put) commands are transferred together on the session pool.
+class BatchRunner
+{
+private:
+	FTPClient* ftp;
+	FTPCommandInterpreter* ci;
+	std::vector<BatchStep> steps;
+
+	static bool is_transfer(const BatchStep& step, const char* verb);
+	size_t run_transfers(size_t first, BatchReport& report);
+	void run_single_transfer(const BatchStep& step, BatchReport& report);
+
+public:
+	BatchRunner(FTPClient* ftp, FTPCommandInterpreter* ci);
+
+	// parses every line ('#' starts a comment line), throws "line N: ..." on the first invalid one
+	void load(std::istream& script);
+	BatchReport run();
+};
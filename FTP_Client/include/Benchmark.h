@@ -0,0 +1,77 @@
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "FTPClient.h"
+#include "LoopbackServer.h"
+
+struct BenchmarkResult
+{
+	std::string name;
+	int iterations = 0;
+	unsigned long long bytes = 0;	// payload moved by all iterations, 0 for operations without one
+	double seconds = 0;				// wall time of all iterations
+	double p50_ms = 0;				// per-iteration latency percentiles
+	double p99_ms = 0;
+	unsigned long long peak_rss = 0;	// bytes resident at most while the case ran (whole process), 0 where unknown
+	double cpu_seconds = 0;			// user + system CPU time of all iterations (whole process, the server included)
+
+	double ops_per_second() const;
+	// MB = 10^6 bytes
+	double mb_per_second() const;
+};
+
+// End-to-end benchmarks through the real FTPClient/TelNetClient/TCP stack against a server serving the
+// LoopbackServer tree. Each case repeats one operation on a quiet session and reports throughput, latency and the peak
+// memory of the process, which stays flat for streamed transfers of any size.
+class Benchmark
+{
+private:
+	std::string host;
+	int port;
+	bool full;
+	int max_iterations = 0;
+	LinkProfile link;
+	std::vector<BenchmarkResult> results;
+	std::vector<std::string> local_files;	// files the run writes under vfs_root, removed at the end
+
+	void log_in(FTPClient& ftp) const;
+	// registers a local file the case writes; throws if the file already exists, the run never overwrites one
+	void claim_local_file(const std::string& path);
+	void remove_local_files();
+	// throws unless the downloaded file holds the LoopbackServer pattern
+	void check_download(FTPClient& ftp, const std::string& path, unsigned long long size) const;
+	void measure(const std::string& name, int iterations, const std::function<unsigned long long()>& iteration);
+
+	void bench_login(int iterations);
+	void bench_list(unsigned long long entries, int iterations);
+	void bench_list_first_entry(unsigned long long entries, int iterations);
+	void bench_list_cached(unsigned long long entries, int iterations);
+	void bench_walk(unsigned long long fanout, int sessions, bool ordered, int iterations);
+	void bench_retr(unsigned long long size, const char* engine, int iterations);
+	void bench_stor(unsigned long long size, const char* engine, int iterations);
+	void bench_size_serial(int files, int iterations);
+	void bench_stat_pipelined(int files, int iterations);
+	void bench_retr_segmented(unsigned long long size, int segments, int iterations);
+	void bench_retr_speculative(unsigned long long size, int iterations);
+	void bench_event_loop(unsigned long long size, int iterations);
+
+public:
+	// full adds the long cases: LIST of 1M entries, 4 GB transfers and more iterations of the 1 GB ones
+	Benchmark(const char* host, int port, bool full = false);
+
+	// caps the iterations of every case (0: the default count of each case), for slow emulated links
+	void set_max_iterations(int count) { max_iterations = count; }
+	// network conditions the server emulates, recorded with the results
+	void set_link(const LinkProfile& profile) { link = profile; }
+
+	void run();
+	const std::vector<BenchmarkResult>& get_results() const { return results; }
+
+	// aligned table for the console
+	void print(std::ostream& o) const;
+	// {"benchmarks":[...]}, one case per line in a fixed order so the files of two commits diff cleanly
+	void write_json(std::ostream& o) const;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+enum class HashAlgorithm
+{
+	NONE,
+	CRC32,		// zlib CRC-32, what XCRC and HASH CRC32 report
+	CRC32C,		// Castagnoli CRC-32 (iSCSI, ext4), SSE 4.2 has an instruction for it
+	MD5,
+	SHA256
+};
+
+// name as the HASH command spells it ("CRC32", "CRC32C", "MD5", "SHA-256"), "off" for NONE
+const char* hash_name(HashAlgorithm algorithm);
+// "off", "crc32", "crc32c", "md5", "sha256" or "sha-256", any case; false when the name is unknown
+bool parse_hash_algorithm(const char* name, HashAlgorithm& algorithm);
+
+// Checksum or hash of a byte stream fed in chunks of any size
+class Digest
+{
+public:
+	virtual HashAlgorithm get_algorithm() const = 0;
+	virtual void update(const char* data, size_t size) = 0;
+	// upper case hex of the value so far; more data may follow
+	virtual std::string hex() const = 0;
+
+	// extends the value with the digest of length bytes that follow, without seeing them again
+	// (only the CRCs can, see is_combinable)
+	virtual void append(const Digest& following, unsigned long long length);
+
+	virtual ~Digest() = default;
+
+	// nullptr for NONE
+	static std::unique_ptr<Digest> create(HashAlgorithm algorithm);
+	static bool is_combinable(HashAlgorithm algorithm) { return algorithm == HashAlgorithm::CRC32 || algorithm == HashAlgorithm::CRC32C; }
+};
+
+// CRC-32 as zlib, PKZIP and the XCRC command compute it (reflected polynomial 0xEDB88320),
+// fed in chunks of any size; slicing-by-8 tables take it through eight bytes per step
+class Crc32 : public Digest
+{
+private:
+	uint32_t state = 0xFFFFFFFF;
+
+public:
+	HashAlgorithm get_algorithm() const override { return HashAlgorithm::CRC32; }
+	void update(const char* data, size_t size) override;
+	uint32_t value() const { return state ^ 0xFFFFFFFF; }
+	std::string hex() const override;
+	void append(const Digest& following, unsigned long long length) override;
+};
+
+// CRC-32C (reflected polynomial 0x82F63B78): with SSE 4.2, three interleaved streams of the crc32 instruction
+// merged per block (about 1 byte per cycle per stream); slicing-by-8 tables on other processors
+class Crc32c : public Digest
+{
+private:
+	uint32_t state = 0xFFFFFFFF;
+
+public:
+	HashAlgorithm get_algorithm() const override { return HashAlgorithm::CRC32C; }
+	void update(const char* data, size_t size) override;
+	uint32_t value() const { return state ^ 0xFFFFFFFF; }
+	std::string hex() const override;
+	void append(const Digest& following, unsigned long long length) override;
+
+	// whether update uses the crc32 instruction on this processor
+	static bool has_hardware();
+};
+
+// MD5 (RFC 1321), what XMD5 and HASH MD5 report
+class Md5 : public Digest
+{
+private:
+	uint32_t state[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+	unsigned char block[64];
+	size_t buffered = 0;
+	unsigned long long length = 0;
+
+	void compress(const unsigned char* data);
+
+public:
+	HashAlgorithm get_algorithm() const override { return HashAlgorithm::MD5; }
+	void update(const char* data, size_t size) override;
+	std::string hex() const override;
+};
+
+// SHA-256 (FIPS 180-4), what HASH SHA-256 reports
+class Sha256 : public Digest
+{
+private:
+	uint32_t state[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+	unsigned char block[64];
+	size_t buffered = 0;
+	unsigned long long length = 0;
+
+	void compress(const unsigned char* data);
+
+public:
+	HashAlgorithm get_algorithm() const override { return HashAlgorithm::SHA256; }
+	void update(const char* data, size_t size) override;
+	std::string hex() const override;
+};
@@ -3,6 +3,7 @@
 #include<vector>
 #include<functional>
 #include<iostream>
+#include<string>
 
 enum class ParameterType
 {
@@ -110,9 +111,23 @@ public:
 		add_command(Command{ action, std::move(cb.tokens) });
 	}
 
+	// matches by scanning the commands in registration order, the dispatch the trie replaced (--bench-micro compares the two)
+	void set_linear_dispatch(bool linear);
+
 	void print_commands(std::ostream& o);
 
 	void execute(const char* cmd);
 
+	// a command parsed ahead of time (batch scripts); command is -1 for an empty line
+	struct PreparedCommand
+	{
+		std::vector<std::string> words;
+		int command = -1;
+	};
+
+	// parses and type-checks without running, throws on the same errors as execute
+	PreparedCommand prepare(const char* cmd);
+	void execute(const PreparedCommand& cmd);
+
 	~CommandInterpreter();	
 };
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include "Checksum.h"
+#include "TCP.h"
+#include "VirtualFS.h"
+
+// Moves the bytes of a data connection between the socket and a local file
+class DataEngine
+{
+protected:
+	std::chrono::steady_clock::time_point first_byte_time{};
+public:
+	static constexpr int BUFFER_SIZE = 64 * 1024;
+
+	virtual const char* get_name() const = 0;
+
+	// receives until the server closes the data connection, appending to the writer; returns the bytes received.
+	// Both feed every byte to digest in file order while it is in memory anyway (nullptr: no digest)
+	virtual unsigned long long recv_to_file(TCP& data_port, VirtualFS::Writer& writer, Digest* digest) = 0;
+	// sends the whole file
+	virtual void send_from_file(TCP& data_port, VirtualFS::Reader& reader, Digest* digest) = 0;
+
+	// when the first byte of the last recv_to_file arrived
+	std::chrono::steady_clock::time_point get_first_byte_time() const { return first_byte_time; }
+
+	virtual ~DataEngine() = default;
+
+	// "plain", "copy" or "uring"; an engine that is not available on this system falls back to "plain"
+	static DataEngine* create(const char* name);
+};
+
+// recv + write loop for downloads, TCP::ensure_send_file (sendfile/TransmitFile) for uploads;
+// with a digest, uploads read + send through a buffer instead, as the zero-copy path never shows the bytes
+class PlainDataEngine : public DataEngine
+{
+public:
+	const char* get_name() const override { return "plain"; }
+	unsigned long long recv_to_file(TCP& data_port, VirtualFS::Writer& writer, Digest* digest) override;
+	void send_from_file(TCP& data_port, VirtualFS::Reader& reader, Digest* digest) override;
+protected:
+	// read + send through a user space buffer, every chunk hashed in between
+	static void send_buffered(TCP& data_port, VirtualFS::Reader& reader, Digest* digest);
+};
+
+// plain downloads, uploads always read + sent through a buffer: the copy the zero-copy path of plain avoids,
+// kept to measure it against (stor_*_copy in --bench)
+class CopyDataEngine : public PlainDataEngine
+{
+public:
+	const char* get_name() const override { return "copy"; }
+	void send_from_file(TCP& data_port, VirtualFS::Reader& reader, Digest* digest) override;
+};
+
+#ifdef __linux__
+// io_uring engine: registered buffers, several receives queued as one linked chain,
+// each completed receive turned straight into a file write (and file reads feeding sends for uploads)
+class UringDataEngine : public DataEngine
+{
+public:
+	static constexpr int RING_BUFFERS = 8;
+	static constexpr int CHAIN_LENGTH = RING_BUFFERS / 2;
+private:
+	struct Ring;
+	Ring* ring;
+public:
+	UringDataEngine();
+	UringDataEngine(const UringDataEngine&) = delete;
+	UringDataEngine& operator=(const UringDataEngine&) = delete;
+
+	const char* get_name() const override { return "uring"; }
+	unsigned long long recv_to_file(TCP& data_port, VirtualFS::Writer& writer, Digest* digest) override;
+	void send_from_file(TCP& data_port, VirtualFS::Reader& reader, Digest* digest) override;
+
+	~UringDataEngine();
+};
+#endif
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class EntryType : unsigned char
+{
+	REGULAR,
+	DIRECTORY,
+	LINK,
+	OTHER
+};
+
+// One parsed entry, as handed to a ListingHandler
+struct ListingEntry
+{
+	std::string_view name;
+	EntryType type;
+	long long size;		// -1 when not listed
+	long long mtime;	// seconds since 1970 (UTC), -1 when not listed
+
+	// type, size, modification time (UTC) and name on one aligned line
+	void print(std::ostream& o) const;
+};
+
+// "YYYYMMDDHHMMSS" of seconds since 1970 (UTC), the time format of MLSD, MDTM and MFMT
+std::string format_ftp_time(long long mtime);
+
+// called for each entry as it is parsed (the entry is valid only during the call); false stops the listing
+using ListingHandler = std::function<bool(const ListingEntry&)>;
+
+// Entries of one remote directory, stored column by column so a million of them fit in a few tens of MB:
+// the names back to back in one arena, sizes, modification times and types in parallel arrays
+class DirectoryListing
+{
+private:
+	std::vector<char> arena;
+	std::vector<uint32_t> name_ends;	// end of each name in the arena, the next name starts there
+	std::vector<long long> sizes;		// -1 when not listed
+	std::vector<long long> mtimes;		// seconds since 1970 (UTC), -1 when not listed
+	std::vector<EntryType> types;
+
+public:
+	void add(const char* name, size_t length, EntryType type, long long size, long long mtime);
+	void add(const ListingEntry& entry) { add(entry.name.data(), entry.name.size(), entry.type, entry.size, entry.mtime); }
+	// keeps the capacity, for parsing another listing into the same store
+	void clear();
+	// gives back the capacity a growing listing reserved in advance
+	void shrink_to_fit();
+
+	size_t count() const { return types.size(); }
+	bool empty() const { return types.empty(); }
+
+	std::string_view name(size_t i) const;
+	EntryType type(size_t i) const { return types[i]; }
+	long long size(size_t i) const { return sizes[i]; }
+	long long mtime(size_t i) const { return mtimes[i]; }
+	ListingEntry entry(size_t i) const { return ListingEntry{ name(i), types[i], sizes[i], mtimes[i] }; }
+
+	// bytes held by the arrays, capacity included
+	size_t memory_usage() const;
+
+	// one aligned line per entry
+	void print(std::ostream& o) const;
+};
+
+enum class ListingFormat
+{
+	MLSD,	// "fact=value;...; name" lines (RFC 3659)
+	LIST	// Unix "ls -l" or DOS lines, told apart line by line
+};
+
+// Parses a listing fed in chunks as it arrives from the data connection, handing each entry on as soon as its
+// line is complete; only a line split between two chunks is kept, so memory does not grow with the listing.
+// Lines it cannot parse (such as the "total" line of ls) and names holding '/', '\\' or NUL are counted and skipped,
+// "." and ".." are left out.
+class ListingParser
+{
+public:
+	// longer lines are skipped instead of buffered
+	static constexpr size_t MAX_LINE_SIZE = 64 * 1024;
+private:
+	ListingHandler on_entry;
+	ListingFormat format;
+	int current_year;
+	long long now;
+	std::string partial;	// line split between two chunks
+	bool partial_too_long = false;
+	bool stopped = false;
+	unsigned long long skipped = 0;
+	unsigned long long entries = 0;
+
+	void parse_line(const char* line, const char* end);
+	bool parse_mlsd(const char* line, const char* end);
+	bool parse_unix(const char* line, const char* end);
+	bool parse_dos(const char* line, const char* end);
+	void add(const char* name, const char* end, EntryType type, long long size, long long mtime);
+
+public:
+	// now: seconds since 1970, used for the year ls leaves out of recent dates (-1 for the current time)
+	ListingParser(ListingHandler on_entry, ListingFormat format, long long now = -1);
+	// collects every entry into listing
+	ListingParser(DirectoryListing& listing, ListingFormat format, long long now = -1);
+
+	// returns false once the handler has stopped the listing (the rest of the data is ignored)
+	bool feed(const char* data, size_t size);
+	// parses a last line without a line break
+	void finish();
+
+	bool is_stopped() const { return stopped; }
+	unsigned long long get_entries() const { return entries; }
+	unsigned long long get_skipped() const { return skipped; }
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include "TCP.h"
+
+// epoll-based readiness loop driving many non-blocking TCP connections from one thread.
+// Every watch is one-shot: its callback runs once, either with the ready events or with 0 when its deadline passes.
+class EventLoop
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr int READABLE = 1;
+	static constexpr int WRITABLE = 2;
+
+	using ReadyCallback = std::function<void(int events)>;
+	using Completion = std::function<void(TCPResult result)>;
+
+private:
+	struct Watch
+	{
+		int events;
+		Clock::time_point deadline;
+		ReadyCallback callback;
+	};
+
+	static constexpr int MAX_EVENTS = 64;
+
+	int epoll_fd = -1;
+	std::unordered_map<int, Watch> watches;
+
+	void continue_send(TCP& tcp, const char* buffer, size_t size, size_t sent, Clock::time_point deadline, Completion done);
+	int expire_watches(Clock::time_point now);
+
+public:
+	EventLoop();
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	// waits for READABLE and/or WRITABLE on the connection; replaces any previous watch on it
+	void watch(TCP& tcp, int events, Clock::time_point deadline, ReadyCallback callback);
+	void cancel(TCP& tcp);
+
+	// sends the whole buffer, handling partial writes; the buffer must stay alive until done runs
+	void async_send(TCP& tcp, const void* buffer, size_t size, Clock::time_point deadline, Completion done);
+	// completes as soon as some bytes arrive (bytes_count 0 means the peer closed the connection)
+	void async_recv(TCP& tcp, void* buffer, size_t size, Clock::time_point deadline, Completion done);
+
+	// dispatches ready and expired watches, waiting at most timeout_ms (-1 = until something happens)
+	int run_once(int timeout_ms);
+	// runs until no watch is left
+	void run();
+
+	size_t pending() const { return watches.size(); }
+
+	~EventLoop();
+};
+
+#endif
@@ -2,33 +2,187 @@
 
 #include "TCP.h"
 #include "TelNetClient.h"
+#include <chrono>
 #include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
 #include "VirtualFS.h"
+#include "DataEngine.h"
+#include "Checksum.h"
+#include "SessionCapture.h"
+#include "DirectoryListing.h"
+#include "ListingCache.h"
+
+// SIZE/MDTM answers for one remote file
+struct RemoteStat
+{
+	long long size = -1;        // -1 when the server does not report it
+	std::string modified;       // MDTM timestamp (YYYYMMDDHHMMSS[.sss], UTC), empty when not reported
+};
 
 class FTPClient
 {
 public:
 	static constexpr int MAX_LINE_BUFF_SIZE = 2048;
+	static constexpr int DATA_BUFF_SIZE = 64 * 1024;
+	static constexpr int MAX_SEGMENTS = 16;
+	static constexpr long long MIN_SEGMENT_SIZE = 1024 * 1024;
+	static constexpr int MAX_POOL_SIZE = 32;
+	static constexpr int SPECULATIVE_IDLE_SECONDS = 15;
+	// a segment whose data connection stays silent this long fails the segmented download
+	static constexpr int SEGMENT_IDLE_SECONDS = 60;
 private:
 	bool connected = false;
+	bool quiet = false;
+	std::string host;
+	int port;
+	std::string user;
+	std::string pass;
+	int segments = 1;
+	int pool_size = 4;
+	bool speculative = false;
+	bool speculating = false;
+	bool features_known = false;
+	bool collecting_features = false;
+	std::map<std::string, std::string> features;	// upper case name -> rest of its FEAT line
+	bool ascii = true;	// TYPE A is the server default until the user asks for binary
+	HashAlgorithm verify = HashAlgorithm::NONE;
+	std::string hash_selected;	// algorithm HASH uses in this session, "" until known
+	std::shared_ptr<ListingCache> listing_cache;
+	std::future<void> speculative_pasv;
+	std::chrono::steady_clock::time_point data_port_opened_at;
 	TelNetClient* telnet_client;
 	TCP data_port;
 	std::function<void(const char*)> print_line;
 	void line_received_callback(const char*);
 	int send_command_wrapper(const char*);	
+	int issue_command(const char*);
 	char line_buffer[MAX_LINE_BUFF_SIZE];	
 	VirtualFS* filesystem;
+	DataEngine* engine;
+	SessionRecorder* recorder;
+
+	void open_data_port();
+	void start_speculative_pasv();
+	void finish_speculative_pasv();
+
+	// one byte range of a segmented download, fetched on its own session
+	struct RangeDownload
+	{
+		FTPClient* session = nullptr;
+		long long offset = 0;
+		long long length = 0;
+		long long received = 0;
+		Digest* digest = nullptr;
+		std::exception_ptr error;
+	};
+	// PASV, REST and RETR, up to the 150/125 reply
+	void start_range(const char* path, long long offset);
+	// receives every range into its place in the file; one EventLoop thread drives all the data connections on
+	// Linux, elsewhere each range has its own thread. Failures are left in the ranges
+	static void recv_ranges(std::vector<RangeDownload>& ranges, VirtualFS::PositionalWriter& writer);
+	// closes the data connection, reads the final reply and throws if the range is incomplete
+	void finish_range(const RangeDownload& range);
+	// compares digest with the server's digest of path, throws on a mismatch; false if the server cannot tell
+	bool check_digest(const char* path, const Digest& digest);
 
 public:
 	FTPClient(const char* ip, int port = 21, std::function<void(const char*)> print_line = [](const char*) {});
+	// records the control and data connections of this session (not of the sessions it opens) into recorder,
+	// which must outlive the client
+	FTPClient(const char* ip, int port, std::function<void(const char*)> print_line, SessionRecorder* recorder);
 
 	void login(const char* user, const char* pass);
 	void logout();
-	void list(const char* path);
+	// prints the entries of a remote directory as they arrive (or from the listing cache unless bypass_cache)
+	void list(const char* path, bool bypass_cache = false);
+	// entries of a remote directory from the listing cache when they are younger than its TTL, listed (and cached)
+	// otherwise; bypass_cache always lists and refreshes the cached copy
+	std::shared_ptr<const DirectoryListing> list_cached(const char* path, bool bypass_cache = false);
+	// entries of a remote directory: MLSD when the server announces MLST, LIST (Unix or DOS lines) otherwise
+	DirectoryListing list_entries(const char* path);
+	// hands each entry to on_entry as soon as its line arrives, while the rest of the listing is still on the wire,
+	// keeping nothing; when on_entry returns false the transfer is aborted. Returns the number of entries handed on
+	unsigned long long list_stream(const char* path, const ListingHandler& on_entry);
+	// whether the FEAT reply lists a feature (upper case name, e.g. "MLST"); FEAT is sent once per client
+	bool has_feature(const char* name);
+	// what follows the name on its FEAT line (e.g. "SHA-1;SHA-256*;MD5" for HASH), empty when not listed
+	std::string get_feature_parameters(const char* name);
 	void pasv();
+	// data connection for the next transfer: the one opened speculatively after the previous transfer
+	// when it is still alive, a new PASV otherwise
+	void prepare_data_port();
+
+	// speculative mode: after each transfer, PASV + connect run in the background for the next one
+	void set_speculative(bool enabled);
+	bool get_speculative() const;
+
+	// both return the number of bytes transferred
+	unsigned long long stor(const char* path);
+	unsigned long long retr(const char* path);
+
+	// names in a remote directory (PASV + NLST)
+	std::vector<std::string> nlst(const char* path);
+
+	// DELE and RNFR + RNTO, both invalidate the cached listings they change
+	void remove(const char* path);
+	void rename(const char* from, const char* to);
+	// MKD and RMD, both invalidate the cached listings they change
+	void make_directory(const char* path);
+	void remove_directory(const char* path);
+	// sets the modification time of a remote file (MFMT), false if the server does not announce MFMT
+	bool set_modified(const char* path, long long mtime);
+	// CRC32 of a remote file (XCRC), false if the server does not announce XCRC or rejects the command
+	bool remote_crc32(const char* path, uint32_t& crc);
+	// upper case hex digest of a remote file: HASH when the server lists the algorithm (switched with OPTS HASH),
+	// otherwise XCRC for CRC32 and XMD5 for MD5; false if the server cannot compute it
+	bool remote_digest(const char* path, HashAlgorithm algorithm, std::string& hex);
+
+	// algorithm RETR/STOR compute while the bytes move and compare with remote_digest afterwards; a mismatch fails
+	// the transfer (and removes a downloaded file). NONE, the default, checks nothing; neither do ASCII transfers
+	void set_verify(HashAlgorithm algorithm) { verify = algorithm; }
+	HashAlgorithm get_verify() const { return verify; }
+
+	// size of a remote file (SIZE), -1 if the server does not report it
+	long long size(const char* path);
+	// SIZE and MDTM of many files, pipelined: a few round trips instead of two per file
+	std::vector<RemoteStat> stat_many(const std::vector<std::string>& paths);
+	// sets the restart offset for the next transfer (REST), false if the server rejects it
+	bool rest(long long offset);
+
+	// downloads with up to get_segments() parallel sessions (REST + RETR per byte range),
+	// falling back to a single PASV + RETR when segmenting is not possible
+	unsigned long long retr_segmented(const char* path);
+	void set_segments(int count);
+	int get_segments() const;
+
+	// another quiet, logged-in session to the same server in the same TYPE; release it with close_session()
+	FTPClient* open_session() const;
+	static void close_session(FTPClient* session);
+	// whether this session's connections are recorded; the pools then work on it alone, one transfer after the other
+	bool is_recording() const { return recorder != nullptr; }
+
+	// number of sessions used by mget/mput
+	void set_pool_size(int count);
+	int get_pool_size() const;
+
+	// engine used for RETR/STOR data connections: "plain" (default) or "uring" (Linux, falls back to plain);
+	// a recorded session keeps the plain engine, the only one whose bytes pass through the transport
+	void set_engine(const char* name);
+	const char* get_engine_name() const;
+
+	// quiet: no echo of commands, replies and listings (the state of sessions from open_session)
+	void set_quiet(bool enabled) { quiet = enabled; }
+
+	VirtualFS* get_filesystem() const { return filesystem; }
+	// listings cache, shared with the sessions from open_session
+	ListingCache& get_listing_cache() const { return *listing_cache; }
 
-	void stor(const char* path);
-	void retr(const char* path);
+	// "h1,h2,h3,h4,p1,p2)" of a PASV reply into a (zero-initialized by the caller), throws on malformed input
+	static void parse_pasv_addr(const char* buff, int a[6]);
 
 	void mode_binary();
 	void mode_ascii();
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Size, modification time, inode and content CRC32 of every file under a VirtualFS root, kept between runs in
+// "<root>.index" so that deciding whether a local file changed never means reading it again. The file is a
+// header, fixed-size records sorted by path and the paths back to back, with offsets instead of pointers, so
+// it is read through a memory mapping in one pass. One index per root is shared by every VirtualFS of the
+// process; the first one to open it revalidates it with a stat of every file, and a file whose stat changed
+// loses its CRC. Files written, retimed or removed through the VirtualFS are updated as it happens.
+class FileIndex
+{
+public:
+	// first bytes of the index file; the last two digits are the format version
+	static constexpr const char* MAGIC = "FTPIDX01";
+
+	// what the index knows of one file
+	struct Entry
+	{
+		unsigned long long size = 0;
+		long long mtime_ns = 0;			// nanoseconds since 1970 (UTC), as precise as the filesystem keeps it
+		unsigned long long inode = 0;	// 0 where the system has none (Windows)
+		bool has_crc = false;
+		uint32_t crc = 0;
+	};
+
+private:
+	// On-disk layout, little-endian, 40 bytes per record
+	struct Header
+	{
+		char magic[8];
+		uint32_t count;
+		uint32_t reserved;
+		uint64_t names_size;
+	};
+
+	struct Record
+	{
+		uint64_t size;
+		int64_t mtime_ns;
+		uint64_t inode;
+		uint32_t name_offset;
+		uint32_t name_length;
+		uint32_t crc;
+		uint32_t flags;
+	};
+
+	static constexpr uint32_t HAS_CRC = 1;
+	static constexpr uint32_t REMOVED = 2;	// in memory only, dropped by save()
+
+	std::filesystem::path root;
+	std::filesystem::path file;
+
+	mutable std::mutex mutex;
+	std::vector<Record> records;			// sorted by path, as loaded or last saved
+	std::vector<char> names;
+	std::map<std::string, Record> added;	// files not in records yet
+	bool dirty = false;
+	unsigned long long crcs_computed = 0;
+
+	FileIndex(std::filesystem::path root);
+
+	std::string_view name_of(const Record& record) const;
+	Record* find_record(std::string_view key);
+	const Record* find_any(const std::string& key) const;
+	void store(const std::string& key, const Record& record);
+	void rebuild(std::vector<std::pair<std::string, Record>>& files);
+	bool load();
+	void save_locked();
+
+	static bool stat_file(const std::filesystem::path& path, Record& record);
+	static bool same_file(const Record& a, const Record& b);
+
+public:
+	FileIndex(const FileIndex&) = delete;
+	FileIndex& operator=(const FileIndex&) = delete;
+
+	// the index of a root, loaded and revalidated the first time, shared afterwards
+	static std::shared_ptr<FileIndex> open(const std::filesystem::path& root);
+
+	// stats every file under the root: new files are added, vanished ones dropped, changed ones lose their CRC
+	void revalidate();
+	// re-stats one file (path relative to the root, "dir/name") after it was written, drops it if it is gone;
+	// times_only: only its modification time was set, so its CRC stays valid while its size and inode are the same
+	void update(const std::string& path, bool times_only = false);
+	// drops a file, or a directory and everything under it
+	void remove(const std::string& path);
+
+	bool find(const std::string& path, Entry& entry) const;
+	// CRC32 of a file's contents: the indexed one while its stat is unchanged, read and stored otherwise
+	uint32_t crc32(const std::string& path);
+
+	// writes the index file if anything changed since it was read (a new file replaces the old one)
+	void save();
+
+	size_t size() const;
+	size_t count_with_crc() const;
+	// CRCs that had to be computed by reading a file, since the index was opened
+	unsigned long long get_crcs_computed() const;
+	const std::filesystem::path& get_file() const { return file; }
+
+	// saves what changed
+	~FileIndex();
+};
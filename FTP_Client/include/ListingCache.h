@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "DirectoryListing.h"
+
+// Parsed listings of remote directories kept for a while, so listing an unchanged directory again costs no
+// round trip. Keyed by normalized path and shared by a client with the sessions it opens, which invalidate
+// the directories they change (STOR, DELE, RNFR/RNTO).
+// Paths are not resolved against the working directory: "a" and "/home/u/a" are two keys, and a change made
+// through one spelling does not invalidate a listing cached under the other.
+class ListingCache
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// off for interactive sessions, where other clients change directories between two listings
+	static constexpr int DEFAULT_TTL_SECONDS = 0;
+	// what batch scripts run with, unless they set their own
+	static constexpr int BATCH_TTL_SECONDS = 30;
+	// the oldest listing is dropped beyond this many directories
+	static constexpr size_t MAX_DIRECTORIES = 64;
+
+private:
+	struct Cached
+	{
+		std::shared_ptr<const DirectoryListing> listing;
+		Clock::time_point fetched;
+	};
+
+	mutable std::mutex mutex;
+	std::map<std::string, Cached> directories;
+	Clock::duration ttl = std::chrono::seconds(DEFAULT_TTL_SECONDS);
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
+	unsigned long long invalidations = 0;
+
+public:
+	// "a//b/./c/" -> "a/b/c", ".." removes the previous part; "" is the current directory, "/" the root
+	static std::string normalize(const char* path);
+	// directory holding path ("" for a name in the current directory)
+	static std::string parent_of(const std::string& key);
+
+	// 0 disables the cache (and drops what it holds)
+	void set_ttl(int seconds);
+	int get_ttl() const;
+	bool is_enabled() const;
+
+	// the listing of a directory if it is younger than the TTL, nullptr otherwise; counts a hit or a miss
+	std::shared_ptr<const DirectoryListing> find(const std::string& key);
+	void store(const std::string& key, std::shared_ptr<const DirectoryListing> listing);
+
+	// drops the directory holding path, path itself and everything under it
+	void invalidate(const char* path);
+	void clear();
+
+	size_t size() const;
+	unsigned long long get_hits() const;
+	unsigned long long get_misses() const;
+	unsigned long long get_invalidations() const;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include "SessionCapture.h"
+
+// Network conditions the stand-in server emulates on its connections, without root privileges or tc/netem.
+// Both legs of the delay are applied when a command reaches the server (it is handled one round trip after
+// it was sent and answered at once), and each new connection costs one more round trip, like its TCP
+// handshake would. Jitter never reorders bytes.
+struct LinkProfile
+{
+	int delay_ms = 0;			// one-way delay
+	int jitter_ms = 0;			// random extra delay in [0, jitter_ms] for each segment received
+	long long bandwidth = 0;	// bytes per second of each data connection, 0 = unlimited
+};
+
+// Minimal RFC 959 stand-in server on 127.0.0.1, running on its own threads (one per session), used to
+// benchmark the client without a real server. Any login is accepted and the tree is generated, not stored:
+//   bench/list/<N>    directory with N entries (LIST, MLSD, NLST)
+//   bench/data/<N>    file of N generated bytes (RETR with REST, SIZE, MDTM)
+//   bench/tree/<F>    tree three levels deep: F subdirectories and F files in each directory, files only at the bottom
+// STOR to any path is accepted, the uploaded bytes are counted and dropped.
+// In replay mode every session plays a captured session back instead (see set_replay).
+class LoopbackServer
+{
+public:
+	// byte at offset i of every bench/data file, so downloads can be checked
+	static unsigned char pattern_byte(unsigned long long offset);
+
+private:
+	class __privates__;
+	__privates__* privates;
+
+public:
+	LoopbackServer();
+	LoopbackServer(const LoopbackServer&) = delete;
+	LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+	// listens on an ephemeral loopback port and starts accepting sessions
+	void start();
+	int get_port() const;
+	// network conditions for the sessions accepted from now on
+	void set_link(const LinkProfile& link);
+	// replay mode, for the sessions accepted from now on: the server side of a capture is played back to a
+	// client sending the same commands, each reply with the delay it had after the client's last action
+	void set_replay(std::vector<CaptureEvent> events);
+	// closes the listener and every open session, then waits for their threads
+	void stop();
+
+	~LoopbackServer();
+};
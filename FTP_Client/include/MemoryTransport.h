@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include "Transport.h"
+
+// Transport replaying a recorded byte stream from memory, so the protocol code runs at memory speed and the
+// same bytes always produce the same result. recv hands the stream out in segments of at most segment_size
+// bytes, send only counts what is written. connect starts the stream over, so one transport can replay a
+// session any number of times.
+class MemoryTransport final : public Transport
+{
+public:
+	static constexpr size_t DEFAULT_SEGMENT_SIZE = 1448;	// TCP payload of a full Ethernet frame
+private:
+	std::string input;
+	size_t segment_size;
+	size_t position = 0;
+	unsigned long long bytes_sent = 0;
+	bool connected = false;
+public:
+	MemoryTransport(std::string input, size_t segment_size = DEFAULT_SEGMENT_SIZE);
+
+	void rewind() { position = 0; }
+	size_t remaining() const { return input.size() - position; }
+	unsigned long long get_bytes_sent() const { return bytes_sent; }
+
+	void connect(const char* host, int port) override;
+	void set_timeout(int) override { }
+
+	int send(const char* buffer, size_t size) override;
+	int recv(char* buffer, size_t size) override;
+	int send_some(const char* buffer, size_t size) override { return send(buffer, size); }
+	int recv_some(char* buffer, size_t size) override { return recv(buffer, size); }
+	unsigned long long send_file(int fd, unsigned long long offset, unsigned long long size) override;
+
+	int get_port() const override { return 0; }
+	const char* get_ip() const override { return "memory"; }
+	long long get_native_handle() const override { return -1; }
+	bool is_idle() override { return connected && remaining() == 0; }
+	int last_error() const override;
+
+	void close() override { connected = false; }
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Latency (or any non-negative quantity) histogram with power-of-two buckets; recording is lock-free.
+// Bucket 0 holds 0, bucket i > 0 holds values in [2^(i-1), 2^i).
+class Histogram
+{
+public:
+	static constexpr int BUCKETS = 40;
+private:
+	std::atomic<unsigned long long> buckets[BUCKETS] = {};
+	std::atomic<unsigned long long> count{ 0 };
+	std::atomic<unsigned long long> sum{ 0 };
+	std::atomic<unsigned long long> max{ 0 };
+public:
+	static int bucket_of(unsigned long long value);
+	// largest value that falls in bucket i
+	static unsigned long long bucket_limit(int i) { return i == 0 ? 0 : (1ULL << i) - 1; }
+
+	void record(unsigned long long value);
+
+	unsigned long long get_count() const { return count.load(std::memory_order_relaxed); }
+	unsigned long long get_sum() const { return sum.load(std::memory_order_relaxed); }
+	unsigned long long get_max() const { return max.load(std::memory_order_relaxed); }
+	unsigned long long get_bucket(int i) const { return buckets[i].load(std::memory_order_relaxed); }
+
+	// upper bound of the bucket holding the p-th percentile (0 < p <= 1), capped at the maximum
+	unsigned long long percentile(double p) const;
+
+	void reset();
+};
+
+// Process-wide transfer metrics, shared by every session (pool and segment sessions included).
+// Times are in microseconds, throughput in KiB/s.
+class Metrics
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr int MAX_VERBS = 64;
+	static constexpr int MAX_REPLY_CODE = 600;
+
+private:
+	// open-addressing table keyed by the verb packed into 32 bits (verbs are at most 4 letters)
+	std::atomic<uint32_t> verb_keys[MAX_VERBS] = {};
+	Histogram verb_rtt[MAX_VERBS];
+	std::atomic<unsigned long long> replies[MAX_REPLY_CODE] = {};
+
+	Histogram data_connect;		// TCP connect of the data connection
+	Histogram first_byte;		// RETR sent -> first data byte
+	Histogram transfer_time;	// whole RETR/STOR, command to 226
+	Histogram throughput;		// per transfer
+	std::atomic<unsigned long long> bytes_received{ 0 };
+	std::atomic<unsigned long long> bytes_sent{ 0 };
+	std::atomic<unsigned long long> transfers{ 0 };
+	std::atomic<unsigned long long> failed_transfers{ 0 };
+	std::atomic<unsigned long long> listing_cache_hits{ 0 };
+	std::atomic<unsigned long long> listing_cache_misses{ 0 };
+	std::atomic<unsigned long long> listing_invalidations{ 0 };
+
+	static uint32_t pack_verb(const char* command);
+	static void unpack_verb(uint32_t key, char* verb);
+
+	Metrics() = default;
+
+public:
+	std::atomic<bool> enabled{ true };
+
+	static Metrics& instance();
+	static unsigned long long elapsed_us(Clock::time_point since);
+
+	Metrics(const Metrics&) = delete;
+	Metrics& operator=(const Metrics&) = delete;
+
+	// control command round trip, keyed by the command verb (first word)
+	void record_command(const char* command, unsigned long long us);
+	void record_reply(int code);
+	void record_data_connect(unsigned long long us);
+	void record_first_byte(unsigned long long us);
+	// a finished RETR/STOR
+	void record_transfer(bool upload, unsigned long long bytes, unsigned long long us);
+	void record_failed_transfer();
+	// a lookup in a ListingCache, and a cached listing dropped because the client changed its directory
+	void record_listing_cache(bool hit);
+	void record_listing_invalidation();
+
+	void print(std::ostream& o) const;
+	void write_prometheus(std::ostream& o) const;
+	void write_json(std::ostream& o) const;
+
+	void reset();
+};
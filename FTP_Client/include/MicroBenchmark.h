@@ -0,0 +1,48 @@
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Checksum.h"
+#include "DirectoryListing.h"
+
+struct MicroResult
+{
+	std::string name;
+	unsigned long long operations = 0;
+	double seconds = 0;
+	unsigned long long allocations = 0;	// heap allocations made by the thread during the timed loop
+
+	double ops_per_second() const;
+	double ns_per_op() const;
+	double allocations_per_op() const;
+};
+
+// Microbenchmarks of the protocol hot spots (reply parsing, command formatting, PASV parsing, command dispatch,
+// directory listing parsing, transfer checksums), run without sockets: the control connection is a MemoryTransport replaying generated server replies.
+class MicroBenchmark
+{
+private:
+	std::vector<MicroResult> results;
+
+	// times body(operations) once, after an untimed warm-up run of a tenth of the operations
+	void measure(const std::string& name, unsigned long long operations, const std::function<void(unsigned long long)>& body);
+
+	void bench_recv_response(const char* name, const std::string& reply, unsigned long long replies);
+	void bench_send_command(unsigned long long commands);
+	void bench_parse_pasv(unsigned long long parses);
+	void bench_interpreter(unsigned long long commands);
+	void bench_dispatch(int registered, bool linear, unsigned long long commands);
+	void bench_atoi(unsigned long long conversions);
+	void bench_parse_listing(const char* name, ListingFormat format, const char* line_format, unsigned long long entries);
+	void bench_digest(const char* name, HashAlgorithm algorithm, unsigned long long chunks);
+
+public:
+	void run();
+	const std::vector<MicroResult>& get_results() const { return results; }
+
+	void print(std::ostream& o) const;
+	// {"microbenchmarks":[...]}, one case per line
+	void write_json(std::ostream& o) const;
+};
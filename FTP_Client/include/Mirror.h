@@ -0,0 +1,71 @@
+#pragma once
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "FTPClient.h"
+#include "TransferScheduler.h"
+
+// What a mirror run has to do, worked out from both trees before anything is changed
+struct MirrorPlan
+{
+	std::string root;						// mirrored directory, the same path on both sides
+	bool upload = false;
+	std::vector<std::string> directories;	// to create on the destination, parents first
+	std::vector<TransferJob> transfers;		// changed or missing files, with the source modification time
+	std::vector<TransferJob> retimes;		// identical contents (checked by CRC), only the modification time differs
+	std::vector<std::string> deletions;		// destination files and directories the source no longer has, children first
+	std::vector<bool> deletion_is_directory;
+	unsigned long long compared = 0;		// files present on both sides
+	unsigned long long unchanged = 0;
+	unsigned long long checksummed = 0;		// compared by CRC because their times differ
+	unsigned long long skipped = 0;			// links and special files of the source
+	unsigned long long bytes = 0;			// to transfer
+
+	void print(std::ostream& o) const;
+};
+
+// Keeps a directory of the VirtualFS and the remote directory of the same path in sync, in one direction.
+// Both trees are walked first (the remote one by a TreeWalker on the session pool), a file is transferred only when it is
+// missing or its size differs or its source is newer; when the times differ but the sizes do not and the server
+// has XCRC, the CRCs decide instead. Transfers run on the session pool, copies take the modification time of
+// their source (MFMT on the server when it has it), so the next run finds nothing to do.
+class Mirror
+{
+public:
+	// times closer than this are equal (FAT keeps 2 second times)
+	static constexpr long long TIME_TOLERANCE_SECONDS = 2;
+
+private:
+	struct FileState
+	{
+		bool directory;
+		long long size;		// -1 when not known
+		long long mtime;	// -1 when not known
+	};
+	// keyed by path relative to the mirrored directory
+	using Tree = std::map<std::string, FileState>;
+
+	FTPClient* ftp;
+	bool upload;
+	bool delete_extra;
+
+	// false when allow_missing and the root itself could not be listed; throws on any other failure
+	bool walk_remote(const std::string& root, Tree& tree, MirrorPlan& plan, bool allow_missing);
+	void walk_local(const std::string& root, Tree& tree);
+	bool same_contents(const std::string& path, bool& checked);
+	static std::string join(const std::string& root, const std::string& relative);
+	// whether relative names something under the mirrored directory ("a/../../b" does not): every planned
+	// write and deletion comes from these paths, so a hostile listing must not steer them elsewhere
+	static bool is_inside(const std::string& relative);
+
+public:
+	// upload: the local tree is the source (reverse mirror); delete_extra: delete what the source does not have
+	Mirror(FTPClient* ftp, bool upload, bool delete_extra);
+
+	// walks both trees and compares them, changing nothing
+	MirrorPlan plan(const char* path);
+	// creates the directories, transfers on the session pool, fixes the times and deletes; never stops on a failure
+	TransferReport run(const MirrorPlan& plan);
+};
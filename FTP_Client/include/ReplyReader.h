@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string_view>
+#include "TCP.h"
+
+// Buffered reader for the control connection: receives large chunks and splits them into lines
+class ReplyReader
+{
+public:
+	static constexpr int BUFFER_SIZE = 8192;
+private:
+	char buffer[BUFFER_SIZE + 1] = {};	// +1 so a line ending at the last received byte can always be '\0'-terminated
+	size_t begin = 0;					// first byte not yet handed out as a line
+	size_t end = 0;						// one past the last received byte
+	size_t scanned = 0;					// bytes in [begin, scanned) are known not to contain '\n'
+	size_t saved_pos = 0;				// position overwritten by the '\0' of the last returned line
+	char saved_char = '\0';				// original byte at saved_pos
+	bool has_saved = false;
+
+	void restore_terminator();
+	void fill(TCP& tcp);
+
+public:
+	ReplyReader() = default;
+
+	// returns the next line including its "\r\n"; data() is '\0'-terminated and valid until the next call
+	std::string_view read_line(TCP& tcp);
+
+	// drops all buffered bytes (used when the connection is closed or reopened)
+	void reset();
+
+	size_t buffered() const { return end - begin; }
+};
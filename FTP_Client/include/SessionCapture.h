@@ -0,0 +1,107 @@
+#pragma once
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Transport.h"
+
+// One event of a captured session, as seen by the client
+struct CaptureEvent
+{
+	enum Kind : unsigned char
+	{
+		CONNECT = 0,	// bytes: "C" for a control connection, "D" for a data connection
+		SENT = 1,		// bytes written by the client
+		RECEIVED = 2,	// bytes read by the client, one event per recv
+		CLOSE = 3		// the client closed the connection
+	};
+
+	Kind kind;
+	unsigned channel;				// one per connection, in connect order
+	unsigned long long time_us;		// since the first event
+	std::string bytes;
+};
+
+// Writes every byte a session moves on its control and data connections, with timestamps, to a capture file.
+// Format: "FTPCAP01", then per event: kind (1 byte), channel, microseconds since the previous event and
+// payload length as LEB128 varints, then the payload.
+class SessionRecorder
+{
+private:
+	std::ofstream file;
+	std::mutex mutex;
+	std::chrono::steady_clock::time_point started;
+	std::chrono::steady_clock::time_point last_event;
+	unsigned next_channel = 0;
+
+	void write_varint(unsigned long long value);
+
+public:
+	static constexpr const char* MAGIC = "FTPCAP01";
+
+	SessionRecorder() = default;
+	SessionRecorder(const SessionRecorder&) = delete;
+	SessionRecorder& operator=(const SessionRecorder&) = delete;
+
+	void open(const char* path);
+	bool is_open() const { return file.is_open(); }
+	void close();
+
+	// a socket whose connections are recorded here (RecordingTransport), owned by the caller
+	Transport* create_transport(bool control);
+
+	// records a CONNECT and returns the channel of the new connection
+	unsigned open_channel(bool control);
+	void record(CaptureEvent::Kind kind, unsigned channel, const char* data, size_t size);
+
+	// reads a whole capture file, throws on a malformed one
+	static std::vector<CaptureEvent> load(const char* path);
+
+	~SessionRecorder() { close(); }
+};
+
+// Transport decorator that forwards to another transport and records the traffic in a SessionRecorder;
+// passwords sent on a control connection are recorded as '*'s of the same length
+class RecordingTransport final : public Transport
+{
+private:
+	Transport* inner;
+	SessionRecorder* recorder;
+	bool control;
+	unsigned channel = 0;
+	bool connected = false;
+	std::string line_head;		// first bytes of the command being sent, until its verb is known
+	bool hiding = false;		// inside the argument of a PASS command
+
+	int record(CaptureEvent::Kind kind, int result, const char* data);
+	// replaces the argument of PASS commands by as many '*'s, across sends that split a command
+	void redact(std::string& bytes);
+
+public:
+	// takes ownership of inner
+	RecordingTransport(Transport* inner, SessionRecorder* recorder, bool control);
+	RecordingTransport(const RecordingTransport&) = delete;
+	RecordingTransport& operator=(const RecordingTransport&) = delete;
+
+	void connect(const char* host, int port) override;
+	void set_timeout(int seconds) override { inner->set_timeout(seconds); }
+
+	int send(const char* buffer, size_t size) override { return record(CaptureEvent::SENT, inner->send(buffer, size), buffer); }
+	int recv(char* buffer, size_t size) override { return record(CaptureEvent::RECEIVED, inner->recv(buffer, size), buffer); }
+	int send_some(const char* buffer, size_t size) override { return record(CaptureEvent::SENT, inner->send_some(buffer, size), buffer); }
+	int recv_some(char* buffer, size_t size) override { return record(CaptureEvent::RECEIVED, inner->recv_some(buffer, size), buffer); }
+	// never zero-copy: the caller falls back to send(), which records the file contents
+	unsigned long long send_file(int, unsigned long long, unsigned long long) override { return 0; }
+
+	int get_port() const override { return inner->get_port(); }
+	const char* get_ip() const override { return inner->get_ip(); }
+	long long get_native_handle() const override { return inner->get_native_handle(); }
+	bool is_idle() override { return inner->is_idle(); }
+	int last_error() const override { return inner->last_error(); }
+
+	void close() override;
+
+	~RecordingTransport() override;
+};
@@ -2,24 +2,38 @@
 
 #include "TCPResult.h"
 #include "TCPResponse.h"
+#include "Transport.h"
 
 class TCP final
 {
 private:
-	class __privates__;
-	__privates__* privates;	
+	Transport* transport;
 
 public:
+	static constexpr int SEND_FILE_CHUNK_SIZE = 64 * 1024;
+
 	TCP();
+	// runs on the given transport (a socket for nullptr) and takes ownership of it
+	explicit TCP(Transport* transport);
+	TCP(const TCP&) = delete;
+	TCP& operator=(const TCP&) = delete;
 
 	void connect(const char* host, int port);	
 
+	// blocking: send waits until every byte is queued, recv until at least one byte arrives
 	TCPResult send(const void* buffer, size_t size);
 	TCPResult recv(void* buffer, size_t size);
 
+	// non-blocking single attempts, TCPResult::is_would_block() when the socket is not ready
+	TCPResult send_some(const void* buffer, size_t size);
+	TCPResult recv_some(void* buffer, size_t size);
+
 	void ensure_send(void* buffer, size_t size);
 	void ensure_recv(void* buffer, size_t size);
 
+	// sends a region of an open file (zero-copy when the platform supports it), throws tcp_exception on failure
+	void ensure_send_file(int fd, unsigned long long offset, unsigned long long size);
+
 	TCPResult send_i32(int n);
 	TCPResponse<int> recv_i32();
 
@@ -33,6 +47,10 @@ public:
 
 	int get_port() const;
 	const char* get_ip() const;
+	long long get_native_handle() const;
+
+	// connected and nothing received yet (no data, no close/reset from the peer)
+	bool is_idle() const;
 
 	void close();
 
@@ -7,7 +7,7 @@ struct TCPResponse
 	T value;	
 
 	static TCPResponse success(const T& value) { return { true, value }; }
-	static TCPResponse fail() { return { false, default(T) }; }
+	static TCPResponse fail() { return { false, T{} }; }
 
 	operator T() { return value; }
 };
\ No newline at end of file
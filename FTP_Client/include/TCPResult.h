@@ -1,17 +1,27 @@
 #pragma once
 
+#include <cstddef>
+#include <string>
 #include "bufferf.h"
 
 struct TCPResult
 {
+	static constexpr int WOULD_BLOCK = -1;
+	static constexpr int TIMED_OUT = -2;
+
 	bool ok;
 	int bytes_count;
 	int error_code;
 
 	static TCPResult success(int sent_bytes) { return { true, sent_bytes, 0 }; }
 	static TCPResult fail(int error_code) { return { false, 0, error_code }; }	
+	static TCPResult would_block() { return { false, 0, WOULD_BLOCK }; }
+	static TCPResult timed_out() { return { false, 0, TIMED_OUT }; }
+
+	bool is_would_block() const { return !ok && error_code == WOULD_BLOCK; }
+	bool is_timed_out() const { return !ok && error_code == TIMED_OUT; }
 
-	const char* get_error_message();
+	std::string get_error_message();
 
 	void validate_send(size_t desired_size);
 	void validate_recv(size_t desired_size);
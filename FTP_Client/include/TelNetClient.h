@@ -1,22 +1,54 @@
 #pragma once
 
 #include "TCP.h"
+#include "ReplyReader.h"
 #include <functional>
+#include <string>
+#include <vector>
 
 class TelNetClient
 {
+public:
+	// called with the reply code and the first line of the reply (valid only during the call)
+	using ReplyHandler = std::function<void(int code, const char* line)>;
+
+	// at most this many bytes of queued commands are on the wire without their reply; more are written
+	// whenever half of the window has been answered, so the server always has commands left to read
+	static constexpr size_t PIPELINE_WINDOW_BYTES = 16 * 1024;
 private:
+	struct PipelinedCommand
+	{
+		std::string command;
+		ReplyHandler on_reply;
+	};
+
+
 	TCP tcp;	
-	std::function<void(char*)> line_received_callback = [](char*) {};
+	ReplyReader reader;
+	std::function<void(const char*)> line_received_callback = [](const char*) {};
 	const char* ip = nullptr;
 	int port = 21;
 	bool is_connected = false;
+	std::string first_line;
+	std::vector<PipelinedCommand> pipeline;
 public:	
 
-	TelNetClient(const char* ip, int port, std::function<void(char*)> line_received_callback = [](char*) {});
+	TelNetClient(const char* ip, int port, std::function<void(const char*)> line_received_callback = [](const char*) {});
+	// control connection on another transport (owned from now on, nullptr for a socket),
+	// e.g. a MemoryTransport replaying a session or a RecordingTransport capturing one
+	TelNetClient(Transport* transport, const char* ip, int port, std::function<void(const char*)> line_received_callback = [](const char*) {});
 	int send_command(const char* command);
 	int recv_response();
 
+	// pipelining: queue commands whose replies are not needed before sending the next one,
+	// then send them in as few writes as possible and dispatch the replies in order
+	void queue_command(const char* command, ReplyHandler on_reply);
+	void flush_pipeline();
+	size_t queued_commands() const { return pipeline.size(); }
+
+	// first line of the last reply
+	const char* get_reply_line() const { return first_line.c_str(); }
+
 	void close();
 
 	void reconnect();
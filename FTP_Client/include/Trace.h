@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <ostream>
+
+// Timeline tracing: begin/end/instant events recorded into per-thread ring buffers and exported as
+// Chrome trace_event JSON (chrome://tracing, Perfetto). While tracing is off every probe is one relaxed
+// load and a branch; event names must be string literals (only the pointer is stored).
+class Trace
+{
+public:
+	static constexpr int RING_SIZE = 8192;	// events kept per thread, the oldest are overwritten
+	static constexpr int DETAIL_SIZE = 24;	// bytes of the optional detail text kept per event
+
+private:
+	inline static std::atomic<bool> enabled{ false };
+
+	static void record(char phase, const char* name, const char* detail);
+
+	friend class TraceSpan;
+
+public:
+	static bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+
+	// start drops the events of a previous session
+	static void start();
+	static void stop();
+
+	static void begin(const char* name, const char* detail = nullptr) { if (is_enabled()) record('B', name, detail); }
+	static void end(const char* name) { if (is_enabled()) record('E', name, nullptr); }
+	static void instant(const char* name, const char* detail = nullptr) { if (is_enabled()) record('i', name, detail); }
+
+	// writes every buffered event as {"traceEvents":[...]}
+	static void write_json(std::ostream& o);
+};
+
+// Begin/end pair for a scope; the end is recorded only if the begin was
+class TraceSpan
+{
+private:
+	const char* name;
+	bool active;
+public:
+	TraceSpan(const char* name, const char* detail = nullptr) : name{ name }, active{ Trace::is_enabled() }
+	{
+		if (active) Trace::record('B', name, detail);
+	}
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+	~TraceSpan()
+	{
+		if (active) Trace::record('E', name, nullptr);
+	}
+};
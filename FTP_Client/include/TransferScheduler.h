@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <ostream>
+#include "FTPClient.h"
+
+struct TransferJob
+{
+	std::string path;
+	bool upload = false;
+	// modification time (seconds since 1970, UTC) given to the copy once transferred, -1 leaves it
+	long long mtime = -1;
+};
+
+struct TransferReport
+{
+	struct Error
+	{
+		int job;				// index in the jobs given to TransferScheduler::run, -1 for other steps (e.g. of a mirror)
+		std::string message;	// "path: message"
+	};
+
+	int succeeded = 0;
+	int failed = 0;
+	unsigned long long bytes = 0;
+	double seconds = 0;
+	std::vector<Error> errors;
+	std::vector<std::string> warnings;	// "path: message" for transferred files whose modification time could not be set
+
+	void print(std::ostream& o) const;
+};
+
+// Runs a batch of transfers on a pool of sessions cloned from a logged-in FTPClient.
+// Jobs are spread over per-worker queues; an idle worker steals from the back of the others' queues.
+class TransferScheduler
+{
+private:
+	struct WorkerQueue
+	{
+		std::mutex lock;
+		std::deque<size_t> jobs;
+	};
+
+	FTPClient* origin;
+	int pool_size;
+
+	const std::vector<TransferJob>* jobs = nullptr;
+	std::vector<WorkerQueue> queues;
+	std::atomic<int> alive_workers{ 0 };
+	std::mutex report_lock;
+	TransferReport report;
+
+	bool take_job(int worker, size_t& job);
+	void record(size_t job, unsigned long long bytes, const char* error);
+	void warn(const TransferJob& job, const char* warning);
+	void run_worker(int worker);
+
+public:
+	TransferScheduler(FTPClient* origin, int pool_size);
+
+	TransferReport run(const std::vector<TransferJob>& jobs);
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+
+// Byte stream a TCP object runs on: a socket by default, or a replacement such as MemoryTransport.
+// send/recv follow the socket conventions: bytes moved, 0 for end of stream, -1 on failure (last_error()
+// tells why), and the *_some calls return WOULD_BLOCK instead of waiting.
+class Transport
+{
+public:
+	static constexpr int WOULD_BLOCK = -2;
+
+	virtual void connect(const char* host, int port) = 0;
+	virtual void set_timeout(int seconds) = 0;
+
+	// blocking: send waits until every byte is queued, recv until at least one byte arrives
+	virtual int send(const char* buffer, size_t size) = 0;
+	virtual int recv(char* buffer, size_t size) = 0;
+	virtual int send_some(const char* buffer, size_t size) = 0;
+	virtual int recv_some(char* buffer, size_t size) = 0;
+
+	// sends a file region without copying it; returns the bytes sent, fewer (0) when the caller must copy the rest
+	virtual unsigned long long send_file(int fd, unsigned long long offset, unsigned long long size) = 0;
+
+	virtual int get_port() const = 0;
+	virtual const char* get_ip() const = 0;
+	// OS handle for event loops and data engines, -1 when there is none
+	virtual long long get_native_handle() const = 0;
+	virtual bool is_idle() = 0;
+	virtual int last_error() const = 0;
+
+	virtual void close() = 0;
+
+	virtual ~Transport() = default;
+
+	// the default transport, a TCP socket
+	static Transport* create_socket();
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "FTPClient.h"
+
+// called for every entry found, with the directory holding it relative to the walked one ("" for the walked
+// directory itself); calls never overlap. Returning false stops the walk
+using TreeWalkHandler = std::function<bool(const std::string& directory, const ListingEntry& entry)>;
+
+struct TreeWalkReport
+{
+	unsigned long long directories = 0;	// listed, the walked one included
+	unsigned long long entries = 0;		// handed to the handler
+	int failed = 0;						// directories that could not be listed
+	bool stopped = false;				// the handler ended the walk
+	double seconds = 0;
+	std::vector<std::string> errors;	// "path: message" for every failed directory
+
+	void print(std::ostream& o) const;
+};
+
+// Lists a remote directory and everything under it breadth-first, on a pool of sessions cloned from a logged-in
+// FTPClient. Each session has one listing in flight, so at most max_in_flight directories are listed at once and
+// a tree costs about directories / max_in_flight listing round trips instead of one per directory.
+// Unordered, entries reach the handler as their lines arrive and a subdirectory is queued as soon as it is seen.
+// Ordered, each directory is handed on whole and in the order one session walking breadth-first would list them,
+// whichever listing finishes first; its subdirectories are queued when it is handed on.
+class TreeWalker
+{
+public:
+	static constexpr int DEFAULT_MAX_IN_FLIGHT = 8;
+
+private:
+	struct Directory
+	{
+		std::string path;	// relative to the walked directory
+		size_t index;		// breadth-first position, for the ordered mode
+	};
+
+	struct Listed
+	{
+		std::string path;
+		std::unique_ptr<DirectoryListing> listing;	// nullptr when the directory could not be listed
+	};
+
+	FTPClient* origin;
+	int max_in_flight;
+	bool ordered = false;
+
+	std::string root;
+	const TreeWalkHandler* handler = nullptr;
+
+	std::mutex lock;					// the queue, the counters and the report
+	std::condition_variable changed;
+	std::deque<Directory> pending;
+	int busy = 0;						// directories taken and not finished
+	int alive_workers = 0;
+	std::atomic<bool> stopped{ false };
+	TreeWalkReport report;
+
+	// ordered mode: listings finished ahead of the ones before them, and who is handing them on
+	std::map<size_t, Listed> finished;
+	size_t next_index = 0;
+	size_t next_release = 0;
+	bool releasing = false;
+
+	std::mutex handler_lock;			// keeps the handler calls from overlapping
+	unsigned long long delivered = 0;	// entries handed on, counted under the handler exclusion
+
+	std::string remote_path(const std::string& relative) const;
+	bool take_directory(Directory& directory);
+	void finish_directory();
+	void record_failure(const Directory& directory, const char* error);
+	bool deliver(const std::string& directory, const ListingEntry& entry);
+	void list_streamed(FTPClient* session, const Directory& directory);
+	void list_ordered(FTPClient* session, const Directory& directory);
+	void release(size_t index, Listed listed);
+	void run_worker();
+
+public:
+	// max_in_flight: sessions opened, and so directories listed at once (1 to FTPClient::MAX_POOL_SIZE)
+	TreeWalker(FTPClient* origin, int max_in_flight = DEFAULT_MAX_IN_FLIGHT);
+
+	// deterministic order of the handler calls, at the cost of holding listings that finish early
+	void set_ordered(bool enabled) { ordered = enabled; }
+	bool get_ordered() const { return ordered; }
+
+	// walks path (a failed directory is reported and skipped, never aborts the walk)
+	TreeWalkReport walk(const char* path, const TreeWalkHandler& handler);
+};
@@ -1,15 +1,136 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <filesystem>
+#include <memory>
 #include <vector>
 
+class FileIndex;
+
 class VirtualFS
 {
 private:
 	std::filesystem::path root;
+	std::shared_ptr<FileIndex> index;
+
+	// path of a file relative to the root as the index keys it ("dir/name")
+	std::string index_key(const std::filesystem::path& relative_path) const;
 public:
+	// A file or directory found by list_tree
+	struct FileInfo
+	{
+		std::string path;		// relative to the listed directory ("sub/name")
+		bool directory = false;
+		unsigned long long size = 0;
+		long long mtime = -1;	// seconds since 1970 (UTC)
+	};
+
+	// Incremental writer for a single file: data is appended chunk by chunk instead of buffered in memory, to
+	// "<path>.part", which close() renames onto the file; until then an existing file keeps its contents
+	class Writer
+	{
+	private:
+		std::filesystem::path path;
+		std::filesystem::path part;
+		int fd = -1;
+		unsigned long long bytes_written = 0;
+		std::shared_ptr<FileIndex> index;	// told about the file once it is closed or discarded
+		std::string index_key;
+	public:
+		Writer(std::filesystem::path path, std::shared_ptr<FileIndex> index = nullptr, std::string index_key = "");
+		Writer(Writer&& other) noexcept;
+		Writer(const Writer&) = delete;
+		Writer& operator=(const Writer&) = delete;
+
+		void write(const char* data, size_t size);
+		// closes the file and renames it onto the target
+		void close();
+		// closes the file and removes it, leaving the target as it was (used when a transfer fails half-way);
+		// a writer destroyed before close() discards its file
+		void discard();
+
+		// native descriptor, for data engines that write to the file themselves
+		int get_fd() const { return fd; }
+		// accounts bytes written directly through get_fd()
+		void add_bytes_written(unsigned long long count);
+		unsigned long long get_bytes_written() const { return bytes_written; }
+
+		~Writer();
+	};
+
+	// Read-only handle to a file, exposing the native descriptor so it can be sent without copying
+	class Reader
+	{
+	private:
+		std::filesystem::path path;
+		int fd = -1;
+		unsigned long long size = 0;
+	public:
+		Reader(std::filesystem::path path);
+		Reader(Reader&& other) noexcept;
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+
+		int get_fd() const { return fd; }
+		unsigned long long get_size() const { return size; }
+
+		// reads the next bytes, 0 at the end of the file
+		size_t read(char* buffer, size_t size);
+
+		void close();
+
+		~Reader();
+	};
+
+	// Preallocated file written at explicit offsets, safe to share between threads writing disjoint ranges;
+	// like Writer it fills "<path>.part" and renames it onto the file on close()
+	class PositionalWriter
+	{
+	private:
+		std::filesystem::path path;
+		std::filesystem::path part;
+		int fd = -1;
+		std::shared_ptr<FileIndex> index;	// told about the file once it is closed or discarded
+		std::string index_key;
+	public:
+		PositionalWriter(std::filesystem::path path, unsigned long long size, std::shared_ptr<FileIndex> index = nullptr, std::string index_key = "");
+		PositionalWriter(PositionalWriter&& other) noexcept;
+		PositionalWriter(const PositionalWriter&) = delete;
+		PositionalWriter& operator=(const PositionalWriter&) = delete;
+
+		void write_at(unsigned long long offset, const char* data, size_t size);
+		// reads back what was written, fewer bytes than asked at the end of the file
+		size_t read_at(unsigned long long offset, char* buffer, size_t size);
+		// closes the file and renames it onto the target
+		void close();
+		// closes the file and removes it, leaving the target as it was (used when a transfer fails half-way);
+		// a writer destroyed before close() discards its file
+		void discard();
+
+		~PositionalWriter();
+	};
+
 	VirtualFS(std::filesystem::path root);
 	std::vector<char> read(std::filesystem::path relative_path);
-	void write(std::filesystem::path relative_path, std::vector<char> buffer);	
+	void write(std::filesystem::path relative_path, const std::vector<char>& buffer);	
+	Writer open_writer(std::filesystem::path relative_path);
+	Reader open_reader(std::filesystem::path relative_path);
+	PositionalWriter open_positional_writer(std::filesystem::path relative_path, unsigned long long size);
+	// whether a file is the "<path>.part" temporary of a writer; listings leave those out
+	static bool is_part_file(const std::filesystem::path& path);
+	// regular files directly inside a directory, as paths relative to the root ("dir/name")
+	std::vector<std::string> list_files(std::filesystem::path relative_dir);
+	// every file and directory under a directory, at any depth
+	std::vector<FileInfo> list_tree(std::filesystem::path relative_dir);
+	// creates a directory and its missing parents
+	void make_directory(std::filesystem::path relative_path);
+	// sets the modification time of a file (seconds since 1970, UTC)
+	void set_mtime(std::filesystem::path relative_path, long long mtime);
+	// removes a file or a whole directory, missing paths are ignored; throws when the removal fails
+	void remove(std::filesystem::path relative_path);
+	// CRC32 of a file's contents, from the local index while the file is unchanged (read only when it changed)
+	uint32_t content_crc32(std::filesystem::path relative_path);
+	// index of the files under the root, kept in "<root>.index"
+	FileIndex& get_index() const { return *index; }
 };
\ No newline at end of file
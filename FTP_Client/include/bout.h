@@ -1,9 +1,14 @@
 #pragma once
 
-#include <vector>
+#include <charconv>
 #include <string>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
 #include "utils.h"
 
+// Define BOUT_HEX_DUMP to print every finished buffer as hex (protocol debugging)
+
 struct _bhex {};
 struct _bdec {};
 struct _bfin {};
@@ -12,41 +17,58 @@ inline _bhex bhex;
 inline _bdec bdec;
 inline _bfin bfin;
 
+// Builds a short string (command line, error message) in a fixed inline buffer, without heap allocations.
+// The pointer returned by << bfin points into the bout itself: it is valid as long as the bout is alive,
+// i.e. until the end of the full expression for a temporary bout() passed straight to a function.
 class bout
 {
+public:
+	inline static constexpr int CAPACITY = 2048;
 private:
 	inline static constexpr int STR_ARG_MAX_SIZE = 1024;
-	std::vector<char> buffer;
 	inline static constexpr const char* digits = "0123456789ABCDEF";
 
-
+	char buffer[CAPACITY];
+	int length = 0;
 	bool int_mode_hex = false;
 
+	// Reserves n more characters (plus the terminator) at the end of the buffer
+	char* reserve(int n)
+	{
+		if (n > CAPACITY - 1 - length)
+			throw std::runtime_error("bout failed: formatted text too long");
+		return buffer + length;
+	}
+
 public:
+	bout() = default;
+	bout(const bout&) = delete;
+	bout& operator=(const bout&) = delete;
+
 	bout& operator <<(const char* str)
 	{
-		const char* it = str;
-
 		int k = Utils::get_str_bound(str, STR_ARG_MAX_SIZE);
 		if(k<0)
-			throw std::exception("bout failed: invalid char*: '\\0' not found");					
+			throw std::runtime_error("bout failed: invalid char*: '\\0' not found");
 
 		if (k > 0) // k==0 means "" so no need to append anything
 		{
-			std::vector<char> result(k);
-			memcpy(result.data(), str, k);
-			buffer.insert(buffer.end(), result.begin(), result.end());
+			memcpy(reserve(k), str, k);
+			length += k;
 		}
 		return *this;
-	}	
+	}
 
 	//template<int N> // why doesn't compile...
 	bout& operator <<(wchar_t s[256])
 	{
-		std::wstring wstr{s};
-		std::string str{};
-		str.assign(wstr.begin(), wstr.end());		
-		return *this << str.c_str();
+		// Narrowing copy, one character at a time (the messages are ASCII)
+		for (int i = 0; i < 256 && s[i] != L'\0'; i++)
+		{
+			*reserve(1) = (char)s[i];
+			length++;
+		}
+		return *this;
 	}
 
 
@@ -55,17 +77,20 @@ public:
 
 	bout& operator << (char c)
 	{
-		if (isgraph(c))
+		if (isgraph((unsigned char)c))
 		{
-			buffer.push_back(c);
+			*reserve(1) = c;
+			length++;
 			return *this;
 		}
 
-		buffer.push_back('\\');
-		buffer.push_back('0');
-		buffer.push_back('x');
-		buffer.push_back(digits[((unsigned)c & 0xF0) >> 4]);
-		buffer.push_back(digits[((unsigned)c & 0x0F)]);
+		char* out = reserve(5);
+		out[0] = '\\';
+		out[1] = '0';
+		out[2] = 'x';
+		out[3] = digits[((unsigned char)c & 0xF0) >> 4];
+		out[4] = digits[((unsigned char)c & 0x0F)];
+		length += 5;
 		return *this;
 	}
 
@@ -73,46 +98,50 @@ public:
 	{
 		if (x < 0)
 		{
-			x = -x;
-			buffer.push_back('-');
-		}	
+			*reserve(1) = '-';
+			length++;
+			return *this << (0ULL - (unsigned long long)x);
+		}
 		return *this << (unsigned long long)x;
 	}
 
 
 	bout& operator << (unsigned long long x)
-	{		
-		if (x == 0)
+	{
+		// 20 digits cover the largest decimal value, 16 the largest hex one
+		char* out = reserve(20);
+		std::to_chars_result r = std::to_chars(out, out + 20, x, int_mode_hex ? 16 : 10);
+
+		if (int_mode_hex)
 		{
-			buffer.push_back(digits[0]);
-			return *this;
+			for (char* it = out; it != r.ptr; it++)
+				*it = digits[*it >= 'a' ? *it - 'a' + 10 : *it - '0'];
 		}
-
-		int base = int_mode_hex ? 16 : 10;
-		std::vector<char> result;
-		for (; x > 0; x /= base)
-			result.push_back(digits[x % base]);
-
-		buffer.insert(buffer.end(), result.rbegin(), result.rend());
+		length += (int)(r.ptr - out);
 		return *this;
 	}
 
 	bout& operator << (int x) { return *this << (long long)x; }
 	bout& operator << (unsigned int x) { return *this << (long long)x; }
+	bout& operator << (long x) { return *this << (long long)x; }
+	bout& operator << (unsigned long x) { return *this << (unsigned long long)x; }
 
-	const char* operator << (const _bfin&) 
-	{ 
-		buffer.push_back('\0');
+	// Formatted text so far (not '\0'-terminated before << bfin)
+	const char* data() const { return buffer; }
+	int size() const { return length; }
+
+	const char* operator << (const _bfin&)
+	{
+		buffer[length] = '\0';
 
-		for (char c : buffer)
+#ifdef BOUT_HEX_DUMP
+		for (int i = 0; i <= length; i++)
 		{
-			printf("%02X ", c);
+			printf("%02X ", (unsigned char)buffer[i]);
 		}
 		printf("\n");
+#endif
 
-		char* output = new char[buffer.size()];
-		memcpy(output, buffer.data(), buffer.size());
-		buffer.clear();
-		return output;
+		return buffer;
 	}
-};
\ No newline at end of file
+};
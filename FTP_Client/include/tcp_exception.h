@@ -1,10 +1,12 @@
 #pragma once
 
-#include <exception>
+#include <stdexcept>
+#include <string>
 
-class tcp_exception : public std::exception
+class tcp_exception : public std::runtime_error
 {
 public:
-	tcp_exception() : std::exception() { }
-	tcp_exception(const char* message) : std::exception(message) { }
+	tcp_exception() : std::runtime_error("tcp error") { }
+	tcp_exception(const char* message) : std::runtime_error(message) { }
+	tcp_exception(const std::string& message) : std::runtime_error(message) { }
 };
\ No newline at end of file
@@ -1,7 +1,18 @@
 #pragma once
 
 #include <iostream>
+#include <stdexcept>
+#include <string_view>
+
+#ifdef _WIN32
 #include <windows.h>
+#else
+// Same bit layout as the Windows console text attributes, mapped to ANSI escapes when printed
+#define FOREGROUND_BLUE 0x0001
+#define FOREGROUND_GREEN 0x0002
+#define FOREGROUND_RED 0x0004
+#define FOREGROUND_INTENSITY 0x0008
+#endif
 
 namespace Utils
 {
@@ -9,6 +20,9 @@ namespace Utils
 	{
 		int code;
 
+		// false drops every color change (batch mode, output going to a log)
+		inline static bool enabled = true;
+
 		Color(int code) : code(code) { }
 
 		static Color Red() { return Color{ FOREGROUND_INTENSITY | FOREGROUND_RED }; }
@@ -31,7 +45,13 @@ namespace Utils
 	// returns the address of the first occurence of c in buff, otherwise exception
 	const char* my_strnchr(const char* buff, int len, char c);
 
+	// returns the address of the first occurence of c in the first len bytes of buff, nullptr if missing (SSE2 scan when available)
+	const char* find_char(const char* buff, size_t len, char c);
+
 	int my_atoi(const char* input);
+
+	// shell-style match of a whole name: '*' any run of characters, '?' one character
+	bool glob_match(std::string_view pattern, std::string_view name);
 	
 	// safely checks if strlen(str) < max_len, returns strlen(str) if bounded, -1 otherwise
 	inline static constexpr int get_str_bound(const char* str, int max_len)
@@ -1,14 +1,30 @@
 #include "utils.h"
 #include "bout.h"
+#include <climits>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTILS_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 // Overload of the << operator to handle color output in the console
 std::ostream& Utils::operator << (std::ostream& o, const Utils::Color& color)
 {
-    // Check if the output stream is std::cout (for console output)
-    if (o.rdbuf() == std::cout.rdbuf())
+    // Check if the output stream is std::cout (for console output) and colors are wanted
+    if (Color::enabled && o.rdbuf() == std::cout.rdbuf())
     {
+#ifdef _WIN32
         // Change the text color using Windows API based on color code
         SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), color.code);
+#else
+        // ANSI colors use the opposite red/blue bit order of the Windows attributes
+        int rgb = (color.code & FOREGROUND_RED ? 1 : 0) | (color.code & FOREGROUND_GREEN ? 2 : 0) | (color.code & FOREGROUND_BLUE ? 4 : 0);
+        o << "\033[" << (color.code & FOREGROUND_INTENSITY ? 90 : 30) + rgb << "m";
+#endif
     }
     return o;
 }
@@ -24,7 +40,50 @@ const char* Utils::my_strnchr(const char* buff, int len, char c)
     if (*buff == c) return buff;
 
     // If the character was not found, throw an exception
-    throw std::exception(bout() << "Failed to find character: '" << c << "'" << bfin);
+    throw std::runtime_error(bout() << "Failed to find character: '" << c << "'" << bfin);
+}
+
+#ifdef UTILS_HAS_SSE2
+namespace
+{
+    // Index of the lowest set bit of a non-zero mask
+    inline int lowest_set_bit(unsigned int mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (int)index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+}
+#endif
+
+// Function to find the first occurrence of character 'c' in the first 'len' bytes of 'buff'
+// Returns nullptr if the character is not found; the buffer does not need to be '\0'-terminated
+const char* Utils::find_char(const char* buff, size_t len, char c)
+{
+    size_t i = 0;
+
+#ifdef UTILS_HAS_SSE2
+    // Compare 16 bytes at a time and pick the first matching lane from the byte mask
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buff + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask != 0)
+            return buff + i + lowest_set_bit(mask);
+    }
+#endif
+
+    // Scalar tail (or the whole buffer when SSE2 is unavailable)
+    for (; i < len; i++)
+    {
+        if (buff[i] == c) return buff + i;
+    }
+    return nullptr;
 }
 
 // Function to convert a string to an integer, with basic error checking
@@ -52,18 +111,52 @@ int Utils::my_atoi(const char* input)
         }
 
         // If an invalid character is encountered, throw an exception
-        throw std::exception(bout() << "Failed to parse integer: invalid character '" << *input << "'" << bfin);
+        throw std::runtime_error(bout() << "Failed to parse integer: invalid character '" << *input << "'" << bfin);
     }
 
     // If we encountered extra characters, input length exceeded
     if (*input)
-        throw std::exception("Failed to parse integer: input length exceeded");
+        throw std::runtime_error("Failed to parse integer: input length exceeded");
 
     // Apply the sign and check if the result is within the valid integer range
     result *= sgn;
     if (result >= INT_MAX || result <= INT_MIN)
-        throw std::exception(bout() << "Argument out of range: " << result << bfin);
+        throw std::runtime_error(bout() << "Argument out of range: " << result << bfin);
 
     // Return the final parsed integer
     return (int)result;
 }
+
+// Function to match a name against a pattern with '*' and '?' wildcards
+bool Utils::glob_match(std::string_view pattern, std::string_view name)
+{
+    size_t p = 0, n = 0;
+    size_t star = std::string_view::npos, star_name = 0;  // last '*' seen and where its match currently ends
+
+    while (n < name.size())
+    {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n]))
+        {
+            p++;
+            n++;
+        }
+        else if (p < pattern.size() && pattern[p] == '*')
+        {
+            star = p++;
+            star_name = n;
+        }
+        else if (star != std::string_view::npos)
+        {
+            // Let the last '*' take one more character and retry from there
+            p = star + 1;
+            n = ++star_name;
+        }
+        else
+            return false;
+    }
+
+    // Only '*'s may be left in the pattern
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+    return p == pattern.size();
+}